@@ -18,13 +18,12 @@
 #include "LED.h"
 #include "ADC.h"
 #include "GPIO.h"
-#include "FloatToString.h"
+#include "Utility.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
 extern bsp_t bsp;
 extern ADC_HandleTypeDef hadc3;
-extern char buffer[];
 extern float measurements[];
 extern SemaphoreHandle_t MeasMutex;
 extern TIM_HandleTypeDef htim3;
@@ -111,26 +110,18 @@ static u32_t float_to_sampling_time(float value)
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static void http_measurements(struct netconn *conn)
+static err_t http_measurements_chunk(void* arg, const char* data, size_t len, bool last)
 {
-    size_t size ;
-    size_t sum = 0;
+	return netconn_write((struct netconn*)arg, data, len, NETCONN_COPY);
+}
 
+static void http_measurements(struct netconn *conn)
+{
 	if(pdTRUE == xSemaphoreTake(MeasMutex,  pdMS_TO_TICKS(20000)))
 	{
 		if(ADC_Measurement(bsp.adc.sample_count))
 		{
-
-			for (uint32_t i = 0; i < bsp.adc.sample_count; i++)
-			{
-				size = floatToString(buffer + sum, measurements[i]);
-				sum +=size;
-			}
-
-			buffer[sum - 1] = 0;
-
-			netconn_write(conn, buffer,strlen(buffer), NETCONN_NOCOPY);
-
+			UTIL_FloatArrayToASCII(measurements, bsp.adc.sample_count, FTOA_PRECISION_DEF, http_measurements_chunk, conn);
 		}
 
 		xSemaphoreGive(MeasMutex);
@@ -143,22 +134,15 @@ static void http_measurements(struct netconn *conn)
 static void http_average(struct netconn *conn)
 {
 	float average = 0.0f;
-	float tmp = 0.0f;
 
 	char txt[12];
 	memset(txt, 0, 12);
 
 	if(pdTRUE == xSemaphoreTake(MeasMutex,  pdMS_TO_TICKS(20000)))
 	{
-		if(ADC_Measurement(bsp.adc.sample_count))
+		if(ADC_MeasurementRaw(bsp.adc.sample_count))
 		{
-
-			for (uint32_t i = 0; i < bsp.adc.sample_count ; i++)
-			{
-				tmp += measurements[i];
-			}
-
-			average = (float)(tmp/bsp.adc.sample_count);
+			average = ADC_Average();
 
 			sprintf(txt, "%.6f", average);
 
@@ -172,23 +156,6 @@ static void http_average(struct netconn *conn)
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static float http_calc_offset_average(uint32_t sample_count)
-{
-	float average = 0.0f;
-	float tmp = 0.0f;
-
-
-
-	for (uint32_t i = 0; i < sample_count ; i++)
-	{
-		tmp += measurements[i];
-	}
-
-	average = (float)(tmp/sample_count);
-
-	return average;
-}
-
 static void http_offset(struct netconn *conn)
 {
 	float average = 0.0f;
@@ -204,10 +171,10 @@ static void http_offset(struct netconn *conn)
 
 	 bsp.adc.math_offset.enable = false;
 
-		if(ADC_Measurement(sample_size))
+		if(ADC_MeasurementRaw(sample_size))
 		{
 
-			bsp.adc.math_offset.zero[bsp.adc.gain.index] = -1.0f * http_calc_offset_average(sample_size);
+			bsp.adc.math_offset.zero[bsp.adc.gain.index] = -1.0f * ADC_Average();
 			bsp.adc.math_offset.enable = null_offset_state;
 
 			average = bsp.adc.math_offset.zero[bsp.adc.gain.index];
@@ -354,11 +321,15 @@ bool http_control_page(struct netconn *conn, char* buf, u16_t buflen)
 			char* post = http_post_data(buf, buflen, &post_len);
 			memcpy(control, post, post_len);
 
-			if(sscanf(control, "%d", &int_val) > 0)
+			if((sscanf(control, "%d", &int_val) > 0) && (pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000))))
 			{
+				// As CONFiguration:GAIN, the streams restart with the new scale
+				ADC_StreamStop();
 				bsp.adc.gain.value = (uint8_t)int_val;
 				bsp.adc.gain.index = ADC_GainIndex((uint8_t)int_val);
 				GPIO_SelectGain((uint8_t)int_val);
+
+				xSemaphoreGive(MeasMutex);
 			}
 
 			memcpy(pagedata, http_valid_response, strlen(http_valid_response));
@@ -12,6 +12,8 @@
 #include "ip_addr.h"
 #include "err.h"
 
+#include "scpi/scpi.h"
+
 // --------------------------------------------------------------------------------------------------------------------
 
 #define HISLIP_INITIALIZE									(uint8_t)0
@@ -178,6 +180,8 @@ typedef struct {
 	hislip_netconn_t netconn;
 	uint16_t session_id;
 	char end[2];
+	scpi_t* context;		// SCPI session of the synchronous channel
+	uint32_t max_msg_size;	// largest message payload the client accepts, see AsyncMaximumMessageSize
 }hislip_instr_t;
 
 // --------------------------------------------------------------------------------------------------------------------
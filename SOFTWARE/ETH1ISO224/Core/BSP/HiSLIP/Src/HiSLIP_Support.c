@@ -16,6 +16,8 @@
 void hislip_Init(hislip_instr_t* hislip_instr)
 {
 	memset(hislip_instr->end, 0, sizeof(hislip_instr->end));
+	hislip_instr->context = NULL;
+	hislip_instr->max_msg_size = UINT32_MAX;	// no limit until the client sends one
 }
 
 
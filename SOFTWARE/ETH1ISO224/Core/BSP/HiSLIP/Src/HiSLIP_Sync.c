@@ -35,7 +35,7 @@ int8_t hislip_Trigger(hislip_instr_t* hislip_instr)
 
 	//msg_rx = hislip_MsgParser(hislip_instr);
 
-	return SCPI_Input(&scpi_context, scpi_data, strlen(scpi_data));
+	return SCPI_Input(hislip_instr->context, scpi_data, strlen(scpi_data));
 }
 
 
@@ -53,7 +53,7 @@ int8_t hislip_Data(hislip_instr_t* hislip_instr)
 #define LED_START	1
 #define LED_STOP	2
 
-static void hislip_LED(u8_t status)
+static void hislip_LED(hislip_instr_t* hislip_instr, u8_t status)
 {
 	if(LED_START == status)
 	{
@@ -63,7 +63,7 @@ static void hislip_LED(u8_t status)
 		}
 	}else if(LED_STOP == status)
 	{
-		if(scpi_hislip_context.cmd_error)
+		if(hislip_instr->context->cmd_error)
 		{
 			if(bsp.led)
 				LED_osQueue(RED);
@@ -116,27 +116,25 @@ int8_t hislip_DataEnd(hislip_instr_t* hislip_instr)
 		memcpy(end, SCPI_LINE_ENDING, strlen(SCPI_LINE_ENDING));
 		msg_rx.payload_len.lo -= strlen(SCPI_LINE_ENDING);
 
-		memset(&scpi_hislip_context.end[0], 0, sizeof(scpi_hislip_context.end));
-		memcpy(&scpi_hislip_context.end[0], ends[index], strlen(ends[index]));
+		memset(&hislip_instr->context->end[0], 0, sizeof(hislip_instr->context->end));
+		memcpy(&hislip_instr->context->end[0], ends[index], strlen(ends[index]));
 
 	}
 	else
 	{
 		memcpy(buf + msg_rx.payload_len.lo, SCPI_LINE_ENDING, strlen(SCPI_LINE_ENDING));
 
-		memset(&scpi_hislip_context.end[0], 0, sizeof(scpi_hislip_context.end));
-		memcpy(&scpi_hislip_context.end[0], SCPI_LINE_ENDING, strlen(SCPI_LINE_ENDING));
+		memset(&hislip_instr->context->end[0], 0, sizeof(hislip_instr->context->end));
+		memcpy(&hislip_instr->context->end[0], SCPI_LINE_ENDING, strlen(SCPI_LINE_ENDING));
 	}
 
 
 
 	memcpy(&hislip_instr->msg, &msg_rx, sizeof(msg_rx));
 
-	bsp.resource = VISA_HISLIP;
+	hislip_LED(hislip_instr, LED_START);
 
-	hislip_LED(LED_START);
-
-	SCPI_Input(&scpi_hislip_context, buf, msg_rx.payload_len.lo + strlen(SCPI_LINE_ENDING));
+	SCPI_Input(hislip_instr->context, buf, msg_rx.payload_len.lo + strlen(SCPI_LINE_ENDING));
 
 	// TO BE DELETED ?
 	/*
@@ -159,7 +157,7 @@ int8_t hislip_DataEnd(hislip_instr_t* hislip_instr)
 
 */
 
-	hislip_LED(LED_STOP);
+	hislip_LED(hislip_instr, LED_STOP);
 
 	return true;
 }
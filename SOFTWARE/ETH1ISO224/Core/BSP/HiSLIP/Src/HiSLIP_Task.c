@@ -17,6 +17,7 @@
 
 #include "HiSLIP.h"
 #include "SCPI_Def.h"
+#include "SCPI_Session.h"
 #include "BSP.h"
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -35,6 +36,9 @@ extern bsp_t bsp;
 
 static	u8_t task_count = 0;
 
+// Connection state of the synchronous channel, the asynchronous one hands the negotiated message size over
+static hislip_instr_t* hislip_sync_instr = NULL;
+
 // ----------------------------------------------------------------------------
 
 TaskHandle_t hislip_handler;
@@ -138,15 +142,27 @@ static void hislip_SyncTask(void  *arg)
 
 	hislip_instr.netconn.newconn = (struct netconn*)arg;
 
-    SCPI_Init(&scpi_hislip_context,
-            scpi_commands,
-            &scpi_hislip_interface,
-            scpi_units_def,
-            SCPI_IDN1, SCPI_IDN2, bsp.eeprom.structure.info.serial_number, SCPI_IDN4,
-            scpi_input_buffer, SCPI_INPUT_BUFFER_LENGTH,
-            scpi_error_queue_data, SCPI_ERROR_QUEUE_SIZE);
+	scpi_session_t* session = SCPI_SessionOpen(SCPI_SESSION_HISLIP, (void*)&hislip_instr);
+
+	if(NULL == session)
+	{
+		// All sessions taken, refuse the client
+		netconn_close(hislip_instr.netconn.newconn);
+		netconn_delete(hislip_instr.netconn.newconn);
+
+		if(task_count)
+		{
+			task_count--;
+		}
+
+		vTaskDelete(NULL);
+	}
 
-    scpi_hislip_context.user_context = (void*)&hislip_instr;
+	hislip_instr.context = &session->context;
+
+	taskENTER_CRITICAL();
+	hislip_sync_instr = &hislip_instr;
+	taskEXIT_CRITICAL();
 
 	for (;;)
 	{
@@ -161,6 +177,12 @@ static void hislip_SyncTask(void  *arg)
 
 			case HISLIP_CONN_ERR :
 				{
+					taskENTER_CRITICAL();
+					hislip_sync_instr = NULL;
+					taskEXIT_CRITICAL();
+
+					SCPI_SessionClose(session);
+
 					if(task_count)
 					{
 						task_count--;
@@ -192,7 +214,20 @@ static void hislip_aSyncTask(void  *arg)
 		switch(hislip_Recv(&hislip_instr))
 		{
 			case AsyncInitialize : hislip_AsyncInitializeResponse(&hislip_instr); break;
-			case AsyncMaximumMessageSize : hislip_AsyncMaximumMessageSizeResponse(&hislip_instr);break;
+			case AsyncMaximumMessageSize :
+				{
+					hislip_AsyncMaximumMessageSizeResponse(&hislip_instr);
+
+					taskENTER_CRITICAL();
+
+					if(NULL != hislip_sync_instr)
+					{
+						hislip_sync_instr->max_msg_size = hislip_instr.max_msg_size;
+					}
+
+					taskEXIT_CRITICAL();
+
+				}; break;
 			case AsyncStatusQuery : hislip_AsyncStatusQuery(&hislip_instr); break;
 			case AsyncDeviceClear : hislip_AsyncDeviceClearAcknowledge(&hislip_instr); break;
 			case AsyncLock : hislip_AsyncLockResponse(&hislip_instr); break;
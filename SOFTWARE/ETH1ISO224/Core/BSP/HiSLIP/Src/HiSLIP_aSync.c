@@ -7,6 +7,8 @@
 
 // --------------------------------------------------------------------------------------------------------------------
 
+#include <string.h>
+
 #include "api.h"
 
 #include "SCPI_Def.h"
@@ -14,11 +16,37 @@
 
 // --------------------------------------------------------------------------------------------------------------------
 
+// Largest message the device accepts: DataEnd appends the line end when it is missing and SCPI_Input() needs the
+// whole message in the input buffer of the session
+#define HISLIP_DEVICE_MAX_MSG_SIZE	(SCPI_INPUT_BUFFER_LENGTH - sizeof(SCPI_LINE_ENDING))
+
+// The client sends the largest message it accepts, responses are cut into Data messages of at most that size
+
 int8_t hislip_AsyncMaximumMessageSizeResponse(hislip_instr_t* hislip_instr)
 {
 	int8_t err = ERR_OK;
 	hislip_msg_t msg_tx;
 	payload_len_t max_msg_size;
+	hislip_msg_t msg_rx = hislip_MsgParser(hislip_instr);
+	payload_len_t* client_size = (payload_len_t*)(hislip_instr->netbuf.data + sizeof(hislip_msg_t));
+
+	// Without the 8 byte size in the payload the responses are not cut
+	if((0 != msg_rx.payload_len.hi) || (msg_rx.payload_len.lo < sizeof(payload_len_t))
+			|| (hislip_instr->netbuf.len < (sizeof(hislip_msg_t) + sizeof(payload_len_t)))
+			|| (0 != ntohl(client_size->hi)))
+	{
+		hislip_instr->max_msg_size = UINT32_MAX;
+	}
+	else
+	{
+		hislip_instr->max_msg_size = ntohl(client_size->lo);
+	}
+
+	// A Data message has to carry at least one byte besides the line end of the DataEnd
+	if(hislip_instr->max_msg_size <= strlen(HISLIP_LINE_ENDING))
+	{
+		hislip_instr->max_msg_size = strlen(HISLIP_LINE_ENDING) + 1;
+	}
 
 
 	void* sources[] = {&msg_tx, &max_msg_size};
@@ -36,7 +64,7 @@ int8_t hislip_AsyncMaximumMessageSizeResponse(hislip_instr_t* hislip_instr)
 	msg_tx.payload_len.lo = 8;
 
 	max_msg_size.hi = 0;
-	max_msg_size.lo = 1024;
+	max_msg_size.lo = htonl(HISLIP_DEVICE_MAX_MSG_SIZE);
 
 	hislip_htonl(&msg_tx);
 
@@ -9,6 +9,7 @@
 #define BSP_INC_ADC_H_
 
 #include "main.h"
+#include "cmsis_os.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -17,6 +18,73 @@
 #define ADC_VREF				3.3f
 #define ADC_VCOM				3.3f/2.0f
 #define ADC_TIMEOUT_MAX			40000
+#define ADC_WAIT_SLICE			100
+
+// Longest time a query waits for the trigger of a pending capture, -214 Trigger deadlock afterwards
+#define ADC_TRIGGER_TIMEOUT		10000
+
+// The DMA runs over two blocks and every finished half is copied by the CPU. A single capture fills the sample
+// memory linearly and is conditioned block by block, continuous acquisition uses adc_data[] as a ring of
+// ADC_RING_BLOCKS blocks. A record of at most one block is taken one-shot, a triggered one runs circular in
+// blocks of at least ADC_BLOCK_MIN samples.
+
+#define ADC_BLOCK_SIZE			800
+#define ADC_BLOCK_MIN			64
+#define ADC_RING_BLOCKS			(ADC_MEASUREMENT_BUFFER/ADC_BLOCK_SIZE)
+#define ADC_STREAM_LISTENERS	2		// UDP and TCP streaming
+#define ADC_STREAM_SAMPLES_MAX	((ADC_RING_BLOCKS - 2) * ADC_BLOCK_SIZE)
+
+// Deep memory: a single capture continues past adc_data[] into the D2 SRAM1 segment and then into an AXI SRAM
+// segment, 209536 samples in all. The AXI segment is what is left of RAM_D1 next to the heap, stacks and the UDP
+// retransmission window. measurements[] only holds the first ADC_MEASUREMENT_BUFFER samples, longer captures are
+// kept as raw codes (FORMat:DATA INT16).
+
+#define ADC_D2_SAMPLES			65536
+#define ADC_D1_SAMPLES			112000
+#define ADC_MEMORY_SAMPLES		(ADC_MEASUREMENT_BUFFER + ADC_D2_SAMPLES + ADC_D1_SAMPLES)
+
+// TRIGger:COUNt records of SAMPle:COUNt samples each, stored one after the other in the sample memory
+
+#define ADC_RECORDS_MAX			256
+
+// Timer paced sampling: every TIM6 update event (TRGO) starts one conversion. TIM6 runs from the 240 MHz
+// APB1 timer clock. ADC_TIMEOUT_MAX applies to each DMA block, not to the whole capture: at the lowest rate a block of
+// ADC_BLOCK_SIZE samples takes 0.8 s, while a full ADC_MEMORY_SAMPLES capture runs for about 210 s.
+
+#define ADC_TIMER_CLOCK			240000000UL
+#define ADC_RATE_MIN			1000.0f
+#define ADC_RATE_DEF			100000.0f
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Called from the ADC task when a capture started with ADC_Initiate() is finished
+typedef void (*adc_complete_t)(bool status, void* arg);
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Summary of the last acquisition in volts, see ADC_Statistics()
+typedef struct
+{
+	float min;
+	float max;
+	float mean;
+	float rms;
+	float stddev;
+	float pp;
+	uint32_t count;
+
+}adc_statistics_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Block of the running stream, see ADC_StreamBlock()
+typedef struct
+{
+	const uint16_t* codes;		// ADC_BLOCK_SIZE raw codes
+	uint32_t half;				// DMA half since the stream start, the first sample is half * ADC_BLOCK_SIZE
+	uint32_t cycles;			// DWT cycle counter when the DMA completed the block
+
+}adc_stream_block_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -26,16 +94,45 @@ bool ADC_CheckResolution(uint32_t value);
 void ADC_Reset(uint32_t SamplingTime);
 uint32_t ADC_SelectResolution(uint8_t value);
 void ADC_ConfigureOverSampling(FunctionalState enable, uint32_t ratio);
+void ADC_ConfigureTrigger(void);
+float ADC_RateAchieved(float rate);
+float ADC_RateMax(void);
 bool ADC_CheckOverSamplingRation(uint32_t value);
 bool ADC_Sample(uint32_t sample_count);
+bool ADC_Initiate(uint32_t sample_count, uint32_t records, bool condition, adc_complete_t complete, void* arg);
+bool ADC_WaitIdle(uint32_t timeout);
+bool ADC_WaitCapture(uint32_t timeout);
+bool ADC_Busy(void);
+bool ADC_TriggerBus(void);
+void ADC_Abort(void);
+bool ADC_Aborted(void);
 void ADC_AutoCalibration(void);
 void ADC_SignalConditioning(uint8_t gain, uint32_t sample_count, float offset, float calib_gain, float math_offset);
 void ADC_SignalConditioningZeroOffset(uint8_t gain, uint32_t sample_count);
 uint32_t ADC_RightBitShift(uint32_t value);
 bool ADC_Measurement(uint32_t sample_count);
+bool ADC_MeasurementRaw(uint32_t sample_count);
+void ADC_ConvertMeasurements(void);
+void ADC_Scale(float* scale, float* offset);
+bool ADC_Statistics(adc_statistics_t* statistics);
+float ADC_Average(void);
 void ADC_CalibrationSetup(void);
 bool ADC_CalibrationMeasurement(uint32_t sample_count);
 void ADC_BspReset(void);
 void ADC_InitMemory();
+void ADC_CreateTask(void);
+bool ADC_StreamStart(void);
+bool ADC_StreamResume(void);
+void ADC_StreamStop(void);
+uint32_t ADC_StreamOverrun(void);
+uint32_t ADC_StreamId(void);
+uint32_t ADC_StreamCommitted(void);
+bool ADC_StreamBlock(uint32_t block, adc_stream_block_t* info);
+void ADC_StreamListen(TaskHandle_t task, bool listen);
+uint32_t ADC_SampleCountMax(void);
+const uint16_t* ADC_MemorySegment(uint32_t index, uint32_t* count);
+uint32_t ADC_RecordCount(void);
+uint32_t ADC_RecordSize(void);
+double ADC_RecordTime(uint32_t record);
 
 #endif /* BSP_INC_ADC_H_ */
@@ -75,9 +75,56 @@ typedef enum bsp_result
 typedef enum format_data_enum
 {
 	FORMAT_DATA_ASCII = 0,
-	FORMAT_DATA_REAL32 = 1
+	FORMAT_DATA_REAL32 = 1,
+	FORMAT_DATA_INT16 = 2,
+	FORMAT_DATA_REAL64 = 3,
+	FORMAT_DATA_PACKED = 4
 }format_data_t;
 
+// FORMat:DATA types sent as ADC codes, they need no conversion to volts
+#define FORMAT_DATA_RAW(data)	((FORMAT_DATA_INT16 == (data)) || (FORMAT_DATA_PACKED == (data)))
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef enum format_border_enum
+{
+	FORMAT_BORDER_NORMAL = 0,
+	FORMAT_BORDER_SWAPPED = 1
+}format_border_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef enum adc_mode_enum
+{
+	ADC_MODE_SINGLE = 0,
+	ADC_MODE_CONTINUOUS = 1
+}adc_mode_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef enum adc_source_enum
+{
+	ADC_SOURCE_IMMEDIATE = 0,
+	ADC_SOURCE_TIMER = 1
+}adc_source_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef enum trigger_source_enum
+{
+	TRIGGER_SOURCE_IMMEDIATE = 0,
+	TRIGGER_SOURCE_LEVEL = 1,
+	TRIGGER_SOURCE_BUS = 2
+}trigger_source_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef enum trigger_slope_enum
+{
+	TRIGGER_SLOPE_POSITIVE = 0,
+	TRIGGER_SLOPE_NEGATIVE = 1
+}trigger_slope_t;
+
 // --------------------------------------------------------------------------------------------------------------------
 
 #pragma pack(push, 1)
@@ -186,11 +233,26 @@ typedef struct
 	bsp_offset_t math_offset;
 	float resolution;
 	uint32_t right_bit_shift;
+	adc_mode_t mode;
+	adc_source_t source;
+	float rate;
 
 }bsp_adc_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
+typedef struct
+{
+	uint32_t count;
+	trigger_source_t source;
+	float level;
+	trigger_slope_t slope;
+	uint32_t position;				// samples of each record before the trigger
+
+}bsp_trigger_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
 typedef struct
 {
 	float measuring_range;
@@ -203,19 +265,32 @@ typedef struct
 
 typedef struct
 {
-	ip_addr_t* addr;
+	ip_addr_t addr;
 	uint16_t port;
 	uint32_t timeout;
 	uint32_t tick;
 	bool connected;
+	bool reliable;			// sequence header and NACK retransmission on the replies
 
 }udp_client_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
+typedef struct
+{
+	ip_addr_t group;
+	uint16_t port;			// 0 when the multicast stream is off
+
+}udp_multicast_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// FORMat settings, every SCPI session has its own, see SCPI_SessionFormat()
 typedef struct
 {
 	format_data_t data;
+	format_border_t border;
+	uint8_t precision;
 }format_t;
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -226,13 +301,6 @@ typedef struct
 	uint16_t udp_port;
 }scpi_raw_t;
 
-// --------------------------------------------------------------------------------------------------------------------
-
-typedef enum
-{
-	VISA_SCPI_RAW,
-	VISA_HISLIP
-}bsp_resource_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -253,11 +321,11 @@ typedef struct
 	bool default_cfg;
 	bool led;
 	bsp_adc_t adc;
+	bsp_trigger_t trigger;
 	udp_client_t udp_client;
-	format_t format;
+	udp_multicast_t udp_multicast;
 	bsp_iso224_t iso224;
 	scpi_raw_t scpi_raw;
-	bsp_resource_t resource;
 }bsp_t;
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -12,6 +12,15 @@
 
 // --------------------------------------------------------------------------------------------------------------------
 
-size_t floatToString(char* outstr, float value);
+#define FTOA_PRECISION_MIN		1
+#define FTOA_PRECISION_MAX		9
+#define FTOA_PRECISION_DEF		7
+
+// Longest output: sign, FTOA_PRECISION_MAX digits, point, exponent E+xx and ','
+#define FTOA_SIZE				(FTOA_PRECISION_MAX + 7)
+
+// --------------------------------------------------------------------------------------------------------------------
+
+size_t floatToString(char* outstr, float value, uint8_t precision);
 
 #endif /* BSP_INC_FLOATTOSTRING_H_ */
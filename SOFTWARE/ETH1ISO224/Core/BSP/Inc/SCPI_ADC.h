@@ -33,5 +33,14 @@ scpi_result_t SCPI_AdcConfigurationGainQ(scpi_t * context);
 scpi_result_t SCPI_AdcConfigurationSampleCount(scpi_t * context);
 scpi_result_t SCPI_AdcConfigurationSampleCountQ(scpi_t * context);
 
+scpi_result_t SCPI_AdcSampleSource(scpi_t * context);
+scpi_result_t SCPI_AdcSampleSourceQ(scpi_t * context);
+scpi_result_t SCPI_AdcSampleRate(scpi_t * context);
+scpi_result_t SCPI_AdcSampleRateQ(scpi_t * context);
+
+scpi_result_t SCPI_AdcAcquireMode(scpi_t * context);
+scpi_result_t SCPI_AdcAcquireModeQ(scpi_t * context);
+scpi_result_t SCPI_AdcAcquireOverrunQ(scpi_t * context);
+
 
 #endif /* BSP_INC_SCPI_ADC_H_ */
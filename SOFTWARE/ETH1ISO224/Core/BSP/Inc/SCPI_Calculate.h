@@ -17,5 +17,6 @@ scpi_result_t SCPI_CalculateOffsetEnableQ(scpi_t * context);
 scpi_result_t SCPI_CalculateOffset(scpi_t * context);
 scpi_result_t SCPI_CalculateOffsetQ(scpi_t * context);
 scpi_result_t SCPI_CalculateAverageQ(scpi_t * context);
+scpi_result_t SCPI_CalculateStatisticsQ(scpi_t * context);
 
 #endif /* BSP_INC_SCPI_CALCULATE_H_ */
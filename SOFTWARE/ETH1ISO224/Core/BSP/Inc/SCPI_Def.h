@@ -21,11 +21,8 @@
 
 extern const scpi_command_t scpi_commands[];
 extern scpi_interface_t scpi_interface;
-extern char scpi_input_buffer[];
-extern scpi_error_t scpi_error_queue_data[];
-extern scpi_t scpi_context;
 extern scpi_interface_t scpi_hislip_interface;
-extern scpi_t scpi_hislip_context;
+extern scpi_interface_t scpi_udp_interface;
 
 // --------------------------------------------------------------------------------------------------------------------
 
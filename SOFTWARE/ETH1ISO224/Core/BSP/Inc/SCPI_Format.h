@@ -14,5 +14,10 @@
 
 scpi_result_t SCPI_FormatData(scpi_t * context);
 scpi_result_t SCPI_FormatDataQ(scpi_t * context);
+scpi_result_t SCPI_FormatScaleQ(scpi_t * context);
+scpi_result_t SCPI_FormatBorder(scpi_t * context);
+scpi_result_t SCPI_FormatBorderQ(scpi_t * context);
+scpi_result_t SCPI_FormatAsciiPrecision(scpi_t * context);
+scpi_result_t SCPI_FormatAsciiPrecisionQ(scpi_t * context);
 
 #endif /* BSP_INC_SCPI_FORMAT_H_ */
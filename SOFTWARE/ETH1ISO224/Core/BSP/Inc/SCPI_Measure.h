@@ -12,13 +12,21 @@
 
 // --------------------------------------------------------------------------------------------------------------------
 
+bool MEAS_TakeIdle(scpi_t * context);
 scpi_result_t SCPI_MeasureQ(scpi_t * context);
 scpi_result_t SCPI_FetchQ(scpi_t * context);
 scpi_result_t SCPI_Initiate(scpi_t * context);
+scpi_result_t SCPI_Opc(scpi_t * context);
+scpi_result_t SCPI_OpcQ(scpi_t * context);
+scpi_result_t SCPI_Wai(scpi_t * context);
 scpi_result_t SCPI_NullOffsetEnable(scpi_t * context);
 scpi_result_t SCPI_NullOffsetEnableQ(scpi_t * context);
 scpi_result_t SCPI_NullOffset(scpi_t * context);
 scpi_result_t SCPI_NullOffsetQ(scpi_t * context);
 scpi_result_t SCPI_DataDataQ(scpi_t * context);
+scpi_result_t SCPI_DataAllQ(scpi_t * context);
+scpi_result_t SCPI_DataRecordQ(scpi_t * context);
+scpi_result_t SCPI_DataRecordCountQ(scpi_t * context);
+scpi_result_t SCPI_DataRecordTimeQ(scpi_t * context);
 
 #endif /* BSP_INC_SCPI_MEASURE_H_ */
@@ -8,6 +8,16 @@
 #ifndef INC_SCPI_SERVER_H_
 #define INC_SCPI_SERVER_H_
 
+#include "scpi/scpi.h"
+
 void SCPI_CreateTask(void);
+void SCPI_RequestControl(void);
+void SCPI_AddError(int16_t err);
+void SCPI_AddContextError(scpi_t * context, int16_t err);
+void SCPI_OperationComplete(scpi_t * context);
+size_t SCPI_WriteInPlace(scpi_t * context, const void * data, size_t len);
+size_t SCPI_WriteChunk(scpi_t * context, const char * data, size_t len);
+void SCPI_OutputReset(scpi_t * context);
+scpi_result_t SCPI_SystemCommTcpipControlQ(scpi_t * context);
 
 #endif /* INC_SCPI_SERVER_H_ */
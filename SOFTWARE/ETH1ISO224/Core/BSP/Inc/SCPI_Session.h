@@ -0,0 +1,85 @@
+/*
+ * SCPI_Session.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: grzegorz
+ */
+
+#ifndef BSP_INC_SCPI_SESSION_H_
+#define BSP_INC_SCPI_SESSION_H_
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "scpi/scpi.h"
+#include "SCPI_Def.h"
+#include "BSP.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Raw socket clients served at the same time, every one has a worker task of its own
+#define SCPI_RAW_CLIENTS	3
+
+// The raw socket clients, one HiSLIP client and the UDP port
+#define SCPI_SESSIONS		(SCPI_RAW_CLIENTS + 2)
+
+// Tags of scpi_commands[], checked while another session holds SYSTem:LOCK. Queries are allowed then and all other
+// commands refused unless their tag says otherwise.
+
+#define SCPI_TAG_UNLOCKED	1		// command which only changes the state of the sending session
+#define SCPI_TAG_LOCKED		2		// query which starts an acquisition
+
+// Errors other tasks can post to a session before its next command takes them
+#define SCPI_SESSION_EVENTS	4
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+	SCPI_SESSION_RAW,
+	SCPI_SESSION_HISLIP,
+	SCPI_SESSION_UDP
+
+}scpi_session_type_t;
+
+// Everything one client changes with its commands. The context is the first member, a scpi_t* of a command
+// callback is the session.
+
+typedef struct
+{
+	scpi_t context;
+	scpi_session_type_t type;
+	bool used;
+	uint32_t generation;		// counts the connections which had the session, see SCPI_SessionFind()
+	bool opc_pending;			// *OPC was sent while an INITiate capture was running
+	format_t format;
+	char input_buffer[SCPI_INPUT_BUFFER_LENGTH];
+	scpi_error_t error_queue[SCPI_ERROR_QUEUE_SIZE];
+
+	// Posted by other tasks, applied by the task which parses for the session, see SCPI_SessionPost()
+	scpi_reg_val_t pending_esr;
+	int16_t pending_errors[SCPI_SESSION_EVENTS];
+	uint8_t pending_count;
+
+}scpi_session_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_session_t* SCPI_SessionOpen(scpi_session_type_t type, void* user_context);
+void SCPI_SessionClose(scpi_session_t* session);
+scpi_session_t* SCPI_SessionGet(uint8_t id);
+uint8_t SCPI_SessionId(scpi_t * context);
+uint32_t SCPI_SessionGeneration(scpi_t * context);
+scpi_t* SCPI_SessionFind(uint8_t id, uint32_t generation);
+void SCPI_SessionOpcArm(scpi_t * context);
+void SCPI_SessionOpcComplete(void);
+scpi_session_type_t SCPI_SessionType(scpi_t * context);
+format_t* SCPI_SessionFormat(scpi_t * context);
+void SCPI_SessionReset(scpi_t * context);
+void SCPI_SessionPost(scpi_t * context, scpi_reg_val_t esr, int16_t err);
+scpi_result_t SCPI_SessionCommand(scpi_t * context);
+scpi_result_t SCPI_SystemLockRequestQ(scpi_t * context);
+scpi_result_t SCPI_SystemLockRelease(scpi_t * context);
+scpi_result_t SCPI_SystemLockOwnerQ(scpi_t * context);
+
+#endif /* BSP_INC_SCPI_SESSION_H_ */
@@ -49,6 +49,10 @@ scpi_result_t SCPI_SystemServiceMDNSEnableQ(scpi_t * context);
 scpi_result_t SCPI_SystemServiceHISLIPEnable(scpi_t * context);
 scpi_result_t SCPI_SystemServiceHISLIPEnableQ(scpi_t * context);
 scpi_result_t SCPI_SystemCommunicationLanUpdate(scpi_t * context);
+scpi_result_t SCPI_SystemCommunicateUdpMulticast(scpi_t * context);
+scpi_result_t SCPI_SystemCommunicateUdpMulticastQ(scpi_t * context);
+scpi_result_t SCPI_SystemCommunicateUdpReliable(scpi_t * context);
+scpi_result_t SCPI_SystemCommunicateUdpReliableQ(scpi_t * context);
 scpi_result_t SCPI_SystemSecureState(scpi_t * context);
 scpi_result_t SCPI_SystemSecureStateQ(scpi_t * context);
 scpi_result_t SCPI_SystemServiceEeprom(scpi_t * context);
@@ -0,0 +1,28 @@
+/*
+ * SCPI_Trigger.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: BehrensG
+ */
+
+#ifndef BSP_INC_SCPI_TRIGGER_H_
+#define BSP_INC_SCPI_TRIGGER_H_
+
+#include "scpi/scpi.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerCount(scpi_t * context);
+scpi_result_t SCPI_TriggerCountQ(scpi_t * context);
+scpi_result_t SCPI_TriggerSource(scpi_t * context);
+scpi_result_t SCPI_TriggerSourceQ(scpi_t * context);
+scpi_result_t SCPI_TriggerLevel(scpi_t * context);
+scpi_result_t SCPI_TriggerLevelQ(scpi_t * context);
+scpi_result_t SCPI_TriggerSlope(scpi_t * context);
+scpi_result_t SCPI_TriggerSlopeQ(scpi_t * context);
+scpi_result_t SCPI_TriggerPosition(scpi_t * context);
+scpi_result_t SCPI_TriggerPositionQ(scpi_t * context);
+scpi_result_t SCPI_TriggerImmediate(scpi_t * context);
+scpi_result_t SCPI_Abort(scpi_t * context);
+
+#endif /* BSP_INC_SCPI_TRIGGER_H_ */
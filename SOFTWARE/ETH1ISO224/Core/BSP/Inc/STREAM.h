@@ -0,0 +1,23 @@
+/*
+ * STREAM.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: grzegorz
+ */
+
+#ifndef BSP_INC_STREAM_H_
+#define BSP_INC_STREAM_H_
+
+#include "main.h"
+#include "scpi/scpi.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define STREAM_PORT		5027
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void STREAM_CreateTask(void);
+scpi_result_t SCPI_SystemCommTcpipStreamOverflowQ(scpi_t * context);
+
+#endif /* BSP_INC_STREAM_H_ */
@@ -9,6 +9,8 @@
 #define BSP_INC_UDP_H_
 
 #include "main.h"
+#include "ip_addr.h"
+#include "scpi/scpi.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -17,5 +19,10 @@
 // --------------------------------------------------------------------------------------------------------------------
 
 void UDP_CreateTask(void);
+void UDP_Multicast(const ip_addr_t* group, uint16_t port);
+size_t UDP_Write(scpi_t * context, const char * data, size_t len);
+scpi_result_t UDP_Flush(scpi_t * context);
+scpi_result_t SCPI_UdpStreamSubscribe(scpi_t * context);
+scpi_result_t SCPI_UdpStreamUnsubscribe(scpi_t * context);
 
 #endif /* BSP_INC_UDP_H_ */
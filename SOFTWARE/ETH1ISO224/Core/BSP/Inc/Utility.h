@@ -14,17 +14,57 @@
 #include "SCPI_Def.h"
 #include "scpi/scpi.h"
 #include "api.h"
+#include "FloatToString.h"
+#include "BSP.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
-#define UTIL_ASCII_SIZE	12
+#define UTIL_ASCII_SIZE	FTOA_SIZE
+#define UTIL_CHUNK_SIZE	(4 * TCP_MSS)
+#define UTIL_ACK_TIMEOUT	5000
+#define UTIL_SEGMENTS_MAX	4
+#define UTIL_PACKED_FRAME	64
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Part of a response which is sent from where it is
+
+typedef struct
+{
+	const void* data;
+	size_t size;
+
+}util_segment_t;
+
+// Block payload which has to be converted on the way, count values of in_size bytes become count * out_size bytes
+
+typedef struct
+{
+	void (*convert)(void* out, const void* in, uint32_t count);
+	uint8_t in_size;
+	uint8_t out_size;
+
+}util_encoding_t;
+
+// Consumer of UTIL_FloatArrayToASCII(), last is set for the final chunk of the text
+typedef err_t (*util_chunk_t)(void* arg, const char* data, size_t len, bool last);
 
 // --------------------------------------------------------------------------------------------------------------------
 
 bool UTIL_Timeout(uint32_t start, uint32_t timeout);
-char* UTIL_FloatArrayToASCII(scpi_t * context, enum netconn_type conn_type, float* float_array, uint32_t num_floats2, size_t* frame_size);
-char* UTIL_FloatArrayToREAL(scpi_t * context, enum netconn_type conn_type, float* float_array, uint32_t num_floats, size_t* frame_size);
-float UTIL_Average(uint32_t sample_count);
+err_t UTIL_FloatArrayToASCII(const float* float_array, uint32_t num_floats, uint8_t precision, util_chunk_t send,
+		void* arg);
+scpi_result_t UTIL_ResultASCII(scpi_t * context, const float* float_array, uint32_t num_floats);
+void UTIL_CleanDCache(const void* data, size_t len);
+err_t UTIL_NetconnWriteInPlace(struct netconn* conn, const void* data, size_t len, uint8_t flags);
+bool UTIL_NetconnWaitAcked(struct netconn* conn, uint32_t timeout);
+const util_encoding_t* UTIL_BlockEncoding(const format_t* format);
+uint32_t UTIL_MemorySegments(uint32_t index, uint32_t sample_count, util_segment_t* segments);
+uint32_t UTIL_PackedSize(const util_segment_t* segments, uint32_t count);
+err_t UTIL_Pack(const util_segment_t* segments, uint32_t count, util_chunk_t send, void* arg);
+scpi_result_t UTIL_ResultPacked(scpi_t * context, const util_segment_t* segments, uint32_t count);
+scpi_result_t UTIL_ResultBlock(scpi_t * context, const util_segment_t* segments, uint32_t count,
+		const util_encoding_t* encoding);
 int32_t UTIL_WhiteSpace(const char* string, uint32_t size);
 
 #endif /* BSP_INC_UTILITY_H_ */
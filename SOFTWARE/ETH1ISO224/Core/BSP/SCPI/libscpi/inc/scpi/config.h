@@ -105,6 +105,20 @@ extern "C" {
 #define USE_COMMAND_TAGS 1
 #endif
 
+/* Bucket scpi_commands[] by the first two header characters at SCPI_Init() */
+#ifndef USE_COMMAND_INDEX
+#define USE_COMMAND_INDEX 1
+#endif
+
+#ifndef SCPI_COMMAND_INDEX_BUCKETS
+#define SCPI_COMMAND_INDEX_BUCKETS 32
+#endif
+
+/* Without room for the whole table the parser scans it linearly */
+#ifndef SCPI_COMMAND_INDEX_SIZE
+#define SCPI_COMMAND_INDEX_SIZE 256
+#endif
+
 #ifndef USE_DEPRECATED_FUNCTIONS
 #define USE_DEPRECATED_FUNCTIONS 1
 #endif
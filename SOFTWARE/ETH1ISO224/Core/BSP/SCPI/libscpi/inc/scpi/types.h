@@ -363,10 +363,29 @@ extern "C" {
         scpi_write_control_t control;
         scpi_command_callback_t flush;
         scpi_command_callback_t reset;
+        /* optional, called before every command callback, the command is
+         * not executed unless it returns SCPI_RES_OK */
+        scpi_command_callback_t command;
     };
 
+#if USE_COMMAND_INDEX
+    /*
+     * Positions of the commands in cmdlist per bucket, in table order. Every
+     * bucket also lists the patterns without a fixed beginning.
+     */
+    struct _scpi_command_index_t {
+        const scpi_command_t * cmdlist;
+        uint16_t bucket[SCPI_COMMAND_INDEX_BUCKETS + 1];
+        uint16_t entry[SCPI_COMMAND_INDEX_SIZE];
+    };
+    typedef struct _scpi_command_index_t scpi_command_index_t;
+#endif
+
     struct _scpi_t {
         const scpi_command_t * cmdlist;
+#if USE_COMMAND_INDEX
+        scpi_command_index_t cmdindex;
+#endif
         scpi_buffer_t buffer;
         scpi_param_list_t param_list;
         scpi_interface_t * interface;
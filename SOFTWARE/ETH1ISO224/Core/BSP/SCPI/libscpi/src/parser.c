@@ -135,8 +135,14 @@ static scpi_bool_t processCommand(scpi_t * context) {
     context->input_count = 0;
     context->arbitrary_reminding = 0;
 
-    /* if callback exists - call command callback */
-    if (cmd->callback != NULL) {
+    /* interface can refuse the command, the callback is not called then */
+    if ((cmd->callback != NULL) && context->interface && context->interface->command
+            && (context->interface->command(context) != SCPI_RES_OK)) {
+        if (!context->cmd_error) {
+            SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        }
+        result = FALSE;
+    } else if (cmd->callback != NULL) {
         if ((cmd->callback(context) != SCPI_RES_OK)) {
             if (!context->cmd_error) {
                 SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
@@ -158,6 +164,112 @@ static scpi_bool_t processCommand(scpi_t * context) {
     return result;
 }
 
+#if USE_COMMAND_INDEX
+
+/**
+ * Bucket of two header characters, case insensitive like matchPattern
+ * @param c1
+ * @param c2
+ * @return bucket number
+ */
+static int32_t commandIndexKey(char c1, char c2) {
+    return ((toupper((unsigned char) c1) * 31) ^ toupper((unsigned char) c2)) % SCPI_COMMAND_INDEX_BUCKETS;
+}
+
+/**
+ * Bucket of a pattern. Any header matching the pattern starts with the first
+ * two characters of its short form, a leading ':' excluded. Patterns with an
+ * optional first mnemonic or a shorter short form have no bucket.
+ * @param pattern
+ * @return bucket number or -1 if the pattern belongs to all buckets
+ */
+static int32_t commandIndexPatternBucket(const char * pattern) {
+    if (pattern[0] == ':') {
+        pattern++;
+    }
+
+    if ((isupper((unsigned char) pattern[0]) || isdigit((unsigned char) pattern[0]) || (pattern[0] == '*'))
+            && (isupper((unsigned char) pattern[1]) || isdigit((unsigned char) pattern[1]) || (pattern[1] == '*'))) {
+        return commandIndexKey(pattern[0], pattern[1]);
+    }
+
+    return -1;
+}
+
+/**
+ * Bucket of a program header, the leading ':' is skipped the same way
+ * matchCommand does. A header too short for two characters can only match
+ * patterns listed in all buckets.
+ * @param header
+ * @param len
+ * @return bucket number
+ */
+static int32_t commandIndexHeaderBucket(const char * header, int len) {
+    if ((len >= 2) && (header[0] == ':')) {
+        header++;
+        len--;
+    }
+
+    return commandIndexKey((len > 0) ? header[0] : 0, (len > 1) ? header[1] : 0);
+}
+
+/**
+ * Build the command index of the context. The index is left unused when the
+ * table does not fit into SCPI_COMMAND_INDEX_SIZE entries.
+ * @param context
+ */
+static void commandIndexInit(scpi_t * context) {
+    scpi_command_index_t * index = &context->cmdindex;
+    uint16_t count[SCPI_COMMAND_INDEX_BUCKETS];
+    uint16_t all = 0;
+    int32_t bucket;
+    int32_t i;
+    int32_t total = 0;
+
+    index->cmdlist = NULL;
+    if (context->cmdlist == NULL) {
+        return;
+    }
+    memset(count, 0, sizeof (count));
+
+    for (i = 0; context->cmdlist[i].pattern != NULL; i++) {
+        if (i > UINT16_MAX) {
+            return;
+        }
+        bucket = commandIndexPatternBucket(context->cmdlist[i].pattern);
+        if (bucket < 0) {
+            all++;
+        } else {
+            count[bucket]++;
+        }
+    }
+
+    for (bucket = 0; bucket < SCPI_COMMAND_INDEX_BUCKETS; bucket++) {
+        index->bucket[bucket] = total;
+        total += count[bucket] + all;
+        if (total > SCPI_COMMAND_INDEX_SIZE) {
+            return;
+        }
+    }
+    index->bucket[SCPI_COMMAND_INDEX_BUCKETS] = total;
+
+    /* second pass in table order, the first match stays the first match */
+    memset(count, 0, sizeof (count));
+    for (i = 0; context->cmdlist[i].pattern != NULL; i++) {
+        bucket = commandIndexPatternBucket(context->cmdlist[i].pattern);
+        if (bucket < 0) {
+            for (bucket = 0; bucket < SCPI_COMMAND_INDEX_BUCKETS; bucket++) {
+                index->entry[index->bucket[bucket] + count[bucket]++] = i;
+            }
+        } else {
+            index->entry[index->bucket[bucket] + count[bucket]++] = i;
+        }
+    }
+
+    index->cmdlist = context->cmdlist;
+}
+#endif
+
 /**
  * Cycle all patterns and search matching pattern. Execute command callback.
  * @param context
@@ -167,6 +279,23 @@ static scpi_bool_t findCommandHeader(scpi_t * context, const char * header, int
     int32_t i;
     const scpi_command_t * cmd;
 
+#if USE_COMMAND_INDEX
+    const scpi_command_index_t * index = &context->cmdindex;
+
+    if (index->cmdlist == context->cmdlist) {
+        int32_t bucket = commandIndexHeaderBucket(header, len);
+
+        for (i = index->bucket[bucket]; i < index->bucket[bucket + 1]; i++) {
+            cmd = &context->cmdlist[index->entry[i]];
+            if (matchCommand(cmd->pattern, header, len, NULL, 0, 0)) {
+                context->param_list.cmd = cmd;
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+#endif
+
     for (i = 0; context->cmdlist[i].pattern != NULL; i++) {
         cmd = &context->cmdlist[i];
         if (matchCommand(cmd->pattern, header, len, NULL, 0, 0)) {
@@ -277,6 +406,9 @@ void SCPI_Init(scpi_t * context,
     context->buffer.length = input_buffer_length;
     context->buffer.position = 0;
     SCPI_ErrorInit(context, error_queue_data, error_queue_size);
+#if USE_COMMAND_INDEX
+    commandIndexInit(context);
+#endif
 }
 
 #if USE_DEVICE_DEPENDENT_ERROR_INFORMATION && !USE_MEMORY_ALLOCATION_FREE
@@ -6,9 +6,12 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include <Utility.h>
 
 #include "cmsis_os.h"
+#include "event_groups.h"
 #include "ADC.h"
 #include "BSP.h"
 #include "LED.h"
@@ -16,396 +19,1946 @@
 // --------------------------------------------------------------------------------------------------------------------
 
 extern ADC_HandleTypeDef hadc3;
+extern DMA_HandleTypeDef hdma_adc3;
+extern TIM_HandleTypeDef htim6;
 extern bsp_t bsp;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-__attribute__ ((section(".MEAS_BUFF"), used)) float measurements[ADC_MEASUREMENT_BUFFER];
+#define ADC_THREAD_STACKSIZE	512
+#define ADC_QUEUE_LENGTH		8
+
+#define ADC_EVENT_IDLE			(1 << 0)
 
 // --------------------------------------------------------------------------------------------------------------------
 
-ALIGN_32BYTES (uint16_t adc_data[ADC_MEASUREMENT_BUFFER]);
+TaskHandle_t adc_handler;
+uint32_t adc_buffer[ADC_THREAD_STACKSIZE];
+StaticTask_t adc_control_block;
+
+xQueueHandle QueueADCHandle;
+
+static EventGroupHandle_t adc_events;
+static StaticEventGroup_t adc_events_control_block;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-volatile bool adc_convertion_done = false;
+typedef enum
+{
+	ADC_MSG_BLOCK = 0,
+	ADC_MSG_START,
+	ADC_MSG_ABORT
 
+}adc_msg_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc)
-{
-	/* Invalidate Data Cache to get the updated content of the SRAM on the first half of the ADC converted data buffer: 32 bytes */
-	SCB_InvalidateDCache_by_Addr((uint32_t *) &adc_data[0], ADC_MEASUREMENT_BUFFER);
-}
+__attribute__ ((section(".MEAS_BUFF"), used)) float measurements[ADC_MEASUREMENT_BUFFER];
+
+// --------------------------------------------------------------------------------------------------------------------
 
+ALIGN_32BYTES (uint16_t adc_data[ADC_MEASUREMENT_BUFFER]);
+__attribute__ ((section(".ADC_D2_BUFF"), used)) static uint16_t adc_data_d2[ADC_D2_SAMPLES];
+ALIGN_32BYTES (static uint16_t adc_data_d1[ADC_D1_SAMPLES]);
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc)
+// Raw sample memory of a single capture, sample index 0 is adc_data[0], the segments follow each other
+
+typedef struct
 {
+	uint16_t* data;
+	uint32_t size;
 
-	/* Invalidate Data Cache to get the updated content of the SRAM on the second half of the ADC converted data buffer: 32 bytes */
-	SCB_InvalidateDCache_by_Addr((uint32_t *) &adc_data[ADC_MEASUREMENT_BUFFER/2], ADC_MEASUREMENT_BUFFER);
+}adc_segment_t;
 
-	adc_convertion_done = true;
-}
+static const adc_segment_t adc_memory[] =
+{
+	{adc_data, ADC_MEASUREMENT_BUFFER},
+	{adc_data_d2, ADC_D2_SAMPLES},
+	{adc_data_d1, ADC_D1_SAMPLES}
+};
 
+#define ADC_SEGMENTS			(sizeof(adc_memory)/sizeof(adc_segment_t))
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_AutoCalibration(void)
-{
-	if (HAL_ADCEx_Calibration_Start(&hadc3, ADC_CALIB_OFFSET_LINEARITY, ADC_DIFFERENTIAL_ENDED) != HAL_OK)
-	{
-		Error_Handler();
-	}
+// The whole signal conditioning collapsed into one affine step: value = scale * code + bias
 
-	if (HAL_ADCEx_Calibration_Start(&hadc3, ADC_CALIB_OFFSET, ADC_DIFFERENTIAL_ENDED) != HAL_OK)
-	{
-		Error_Handler();
-	}
-}
+typedef struct
+{
+	float scale;
+	float bias;
 
+}adc_coeff_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-bool ADC_Sample(uint32_t sample_count)
+// Running statistics of the raw codes, the affine conditioning maps them to volts when they are read
+
+typedef struct
 {
-	uint32_t start = HAL_GetTick();
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint64_t sum2;
 
-	adc_convertion_done = false;
+}adc_stats_t;
 
-	if (HAL_OK != HAL_ADC_Start_DMA(&hadc3, (uint32_t *)adc_data, sample_count))
-	{
-		return false;
-	}
+// --------------------------------------------------------------------------------------------------------------------
 
-	while(!adc_convertion_done)
-	{
-		if(!UTIL_Timeout(start, ADC_TIMEOUT_MAX))
-		{
-			return false;
-		}
-	}
+// Trigger state of the record being captured
 
-	return true;
-}
+typedef enum
+{
+	ADC_TRIGGER_NONE = 0,			// immediate, the record is filled linearly
+	ADC_TRIGGER_PREFILL,			// collecting the samples kept before the trigger
+	ADC_TRIGGER_ARMED,				// waiting for the signal on the opposite side of the level
+	ADC_TRIGGER_READY,				// waiting for the level crossing or *TRG
+	ADC_TRIGGER_FIRED
 
+}adc_trigger_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_SignalConditioning(uint8_t gain, uint32_t sample_count, float offset, float calib_gain, float math_offset)
+typedef struct
 {
-	float adc = 0.0f;
-	float inv_gain = 1.0f/(float)gain;
+	volatile bool busy;
+	bool status;
+	bool aborted;
+	bool condition;
+	uint32_t sample_count;			// samples per record
+	uint32_t records;
+	uint32_t record;				// record being captured
+	uint32_t block;					// samples per DMA half
+	bool oneshot;					// the record fits one half, the DMA stops after the two halves
+	volatile uint32_t produced;		// halves completed by the DMA
+	uint32_t consumed;				// halves copied and conditioned by the ADC task
+	adc_coeff_t coeff;
+	adc_stats_t stats;
+	adc_complete_t complete;
+	void* arg;
+	volatile adc_trigger_t trigger;
+	trigger_source_t source;
+	uint32_t pretrigger;			// samples kept before the trigger
+	volatile uint32_t trigger_index;// trigger sample counted from the start of the record
+	uint32_t arm_high;				// watchdog window which fires once the signal is before the level
+	uint32_t arm_low;
+	uint32_t fire_high;				// watchdog window which fires on the level crossing
+	uint32_t fire_low;
+
+}adc_capture_t;
+
+static adc_capture_t adc_capture;
+
+static void ADC_CoefficientsSnapshot(adc_coeff_t* coeff);
+static void ADC_StatsReset(adc_stats_t* stats);
 
-	for(uint32_t x = 0; x < sample_count; x++)
-	{
-		adc = inv_gain * (bsp.adc.resolution * adc_data[x] - bsp.adc.vcom) + offset;
-		measurements[x] = calib_gain * bsp.iso224.multiply * bsp.iso224.gain * adc + math_offset;
-	}
+// --------------------------------------------------------------------------------------------------------------------
 
+// The last acquisition: raw codes in adc_data[], measurements[] is filled from them on demand
 
-}
+typedef struct
+{
+	uint32_t sample_count;			// all records
+	uint32_t records;
+	adc_coeff_t coeff;
+	adc_stats_t stats;
+	bool converted;
+
+}adc_result_t;
 
+static adc_result_t adc_result;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_SignalConditioningZeroOffset(uint8_t gain, uint32_t sample_count)
-{
-	float inv_gain = 1.0f/(float)gain;
+// Start of each record: DWT cycle counter for the resolution, HAL tick to count the cycle counter wraps
 
-	for(uint32_t x = 0; x < sample_count; x++)
-	{
-		measurements[x] = inv_gain * (bsp.adc.resolution * adc_data[x] - bsp.adc.vcom);
+typedef struct
+{
+	uint32_t cycles;
+	uint32_t tick;
 
-	}
-}
+}adc_record_t;
 
+static adc_record_t adc_records[ADC_RECORDS_MAX];
 
 // --------------------------------------------------------------------------------------------------------------------
 
-uint32_t ADC_SelectResolution(uint8_t value)
+// DMA target of every acquisition, the ADC task copies each finished half while the DMA fills the other one
+ALIGN_32BYTES (static uint16_t adc_dma[2 * ADC_BLOCK_SIZE]);
+
+typedef struct
 {
-	switch (value)
-	{
-		case 8 : return ADC_RESOLUTION_8B;
-		case 10 : return ADC_RESOLUTION_10B;
-		case 12 : return ADC_RESOLUTION_12B;
-		case 14 : return ADC_RESOLUTION_14B;
-		case 16 : return ADC_RESOLUTION_16B;
-		default : return ADC_RESOLUTION_16B;
-	}
+	volatile bool running;
+	volatile uint32_t produced;		// halves completed by the DMA
+	uint32_t consumed;				// halves copied by the ADC task
+	volatile uint32_t committed;	// blocks written into the adc_data[] ring since the stream was started
+	volatile uint32_t overrun;		// halves lost because the ADC task was too late
+	TaskHandle_t waiter;
+	uint32_t wait_blocks;
+	TaskHandle_t listener[ADC_STREAM_LISTENERS];	// notified on every committed block
+	uint32_t id;					// counts the stream starts
+	volatile uint32_t finished[2];	// DWT cycle counter when the DMA completed each half
+	uint32_t half[ADC_RING_BLOCKS];	// DMA half each ring block was copied from
+	uint32_t cycles[ADC_RING_BLOCKS];
+
+}adc_stream_t;
+
+static adc_stream_t adc_stream;
 
-	return ADC_RESOLUTION_16B;
-}
+// --------------------------------------------------------------------------------------------------------------------
 
+static void ADC_RecordStamp(uint32_t record)
+{
+	adc_records[record].cycles = DWT->CYCCNT;
+	adc_records[record].tick = HAL_GetTick();
+}
 
 // --------------------------------------------------------------------------------------------------------------------
 
-bool ADC_CheckOverSamplingRation(uint32_t value)
+static void ADC_MessageFromISR(adc_msg_t msg)
 {
-	uint32_t valid[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
-	uint32_t size = sizeof(valid)/sizeof(valid[0]);
-
-	for (uint8_t x = 0; x < size; x++)
-	{
-		if (value == valid[x])
-			return true;
-	}
+	BaseType_t higher_priority_task_woken = pdFALSE;
 
-	return false;
+	xQueueSendFromISR(QueueADCHandle, &msg, &higher_priority_task_woken);
+	portYIELD_FROM_ISR(higher_priority_task_woken);
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-uint8_t ADC_GetRightShiftIndex(uint32_t value)
+static void ADC_HalfFromISR(void)
 {
-	uint32_t valid[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
-	uint32_t size = sizeof(valid)/sizeof(valid[0]);
-
-	for (uint8_t x = 0; x < size; x++)
+	if(adc_stream.running)
 	{
-		if (value == valid[x])
-			return x;
+		adc_stream.finished[adc_stream.produced & 0x1] = DWT->CYCCNT;
+		adc_stream.produced++;
+	}
+	else
+	{
+		adc_capture.produced++;
 	}
 
-	return 0;
+	ADC_MessageFromISR(ADC_MSG_BLOCK);
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-uint32_t ADC_RightBitShift(uint32_t value)
-{
-	uint32_t right_bit_shift[] = {
-			ADC_RIGHTBITSHIFT_NONE,
-			ADC_RIGHTBITSHIFT_1,
-			ADC_RIGHTBITSHIFT_2,
-			ADC_RIGHTBITSHIFT_3,
-			ADC_RIGHTBITSHIFT_4,
-			ADC_RIGHTBITSHIFT_5,
-			ADC_RIGHTBITSHIFT_6,
-			ADC_RIGHTBITSHIFT_7,
-			ADC_RIGHTBITSHIFT_8,
-			ADC_RIGHTBITSHIFT_9,
-			ADC_RIGHTBITSHIFT_10
-			};
-
-	return right_bit_shift[ADC_GetRightShiftIndex(value)];
+// The watchdog fires once a conversion is outside of [low, high]
 
+static void ADC_TriggerWindow(uint32_t high, uint32_t low)
+{
+	LL_ADC_SetAnalogWDThresholds(ADC3, LL_ADC_AWD1, LL_ADC_AWD_THRESHOLD_HIGH, high);
+	LL_ADC_SetAnalogWDThresholds(ADC3, LL_ADC_AWD1, LL_ADC_AWD_THRESHOLD_LOW, low);
 }
 
+
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_ConfigureOverSampling( FunctionalState enable, uint32_t ratio)
+// Sample of the record the DMA writes next. The transfer complete interrupt may still be pending when the DMA
+// already wrapped, the half counter is corrected for that.
+
+static uint32_t ADC_DmaPosition(void)
 {
-	hadc3.Init.OversamplingMode = enable;
-	hadc3.Init.Oversampling.Ratio = ratio;
-	hadc3.Init.Oversampling.RightBitShift = ADC_RightBitShift(ratio);
-	hadc3.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
-	hadc3.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
-}
+	uint32_t halves, position, base;
 
+	do
+	{
+		halves = adc_capture.produced;
+		position = (2 * adc_capture.block) - __HAL_DMA_GET_COUNTER(&hdma_adc3);
 
-// --------------------------------------------------------------------------------------------------------------------
+	}while(halves != adc_capture.produced);
 
-bool ADC_CheckResolution(uint32_t value)
-{
-	uint8_t valid[5] = {8, 10, 12, 14, 16};
-	bool status = false;
-	size_t size = sizeof(valid)/sizeof(valid[0]);
+	base = (halves / 2) * 2 * adc_capture.block;
 
-	for (uint8_t x = 0; x < size; x++)
+	if((halves & 0x1) && (position < adc_capture.block))
 	{
-		if (value == valid[x])
-		{
-			status = true;
-			break;
-		}
+		base += 2 * adc_capture.block;
 	}
 
-	return status;
+	return base + position;
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-bool ADC_CheckGain(uint32_t value)
+// The last converted sample is the trigger. Called from the watchdog interrupt or from a critical section.
+
+static void ADC_TriggerFire(void)
 {
-	uint8_t valid[3] = {1, 10, 100};
+	uint32_t index = ADC_DmaPosition();
 
-	for (uint8_t x = 0; x < 3; x++)
-	{
-		if (value == valid[x])
-			return true;
-	}
+	index = (index > 0) ? (index - 1) : 0;
 
-	return false;
+	// The trigger is armed after the pre-trigger samples, a late interrupt can not place it before them
+	adc_capture.trigger_index = (index < adc_capture.pretrigger) ? adc_capture.pretrigger : index;
+	ADC_RecordStamp(adc_capture.record);
+	adc_capture.trigger = ADC_TRIGGER_FIRED;
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-uint8_t ADC_GainIndex(uint8_t gain)
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc)
 {
-	uint8_t valid[] = {1, 10, 100};
+	ADC_HalfFromISR();
+}
 
-	for (uint8_t x = 0; x < 3; x++)
-	{
-		if (gain == valid[x])
-			return x;
-	}
 
-	return 0;
+// --------------------------------------------------------------------------------------------------------------------
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc)
+{
+	ADC_HalfFromISR();
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_Reset(uint32_t SamplingTime)
-{
-	ADC_ChannelConfTypeDef sConfig = {0};
+// Analog watchdog 1: the first window finds the signal before the level, the second one the crossing
 
-	if (HAL_ADC_DeInit(&hadc3) != HAL_OK)
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef* hadc)
+{
+	if(ADC_TRIGGER_ARMED == adc_capture.trigger)
 	{
-		Error_Handler();
+		ADC_TriggerWindow(adc_capture.fire_high, adc_capture.fire_low);
+		adc_capture.trigger = ADC_TRIGGER_READY;
 	}
-
-	if (HAL_ADC_Init(&hadc3) != HAL_OK)
+	else if(ADC_TRIGGER_READY == adc_capture.trigger)
 	{
-		Error_Handler();
+		__HAL_ADC_DISABLE_IT(hadc, ADC_IT_AWD1);
+		ADC_TriggerFire();
 	}
-
-	sConfig.Channel = ADC_CHANNEL_1;
-	sConfig.Rank = ADC_REGULAR_RANK_1;
-	sConfig.SamplingTime = SamplingTime;
-	sConfig.SingleDiff = ADC_DIFFERENTIAL_ENDED;
-	sConfig.OffsetNumber = ADC_OFFSET_NONE;
-	sConfig.Offset = 0;
-	sConfig.OffsetSignedSaturation = DISABLE;
-
-	if (HAL_ADC_ConfigChannel(&hadc3, &sConfig) != HAL_OK)
+	else
 	{
-		Error_Handler();
+		__HAL_ADC_DISABLE_IT(hadc, ADC_IT_AWD1);
 	}
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_BspReset(void)
+// Split the TIM6 update period into prescaler and auto-reload, returns the rate which is really achieved
+
+static float ADC_RateDivider(float rate, uint32_t* prescaler, uint32_t* period)
 {
-	ADC_ChannelConfTypeDef sConfig = {0};
+	float max = ADC_RateMax();
+	uint32_t ticks;
 
-	if (HAL_ADC_DeInit(&hadc3) != HAL_OK)
+	if(rate > max)
 	{
-		Error_Handler();
+		rate = max;
 	}
 
-	  hadc3.Instance = ADC3;
-	  hadc3.Init.Resolution = bsp.adc.resolution;
-	  hadc3.Init.ScanConvMode = ADC_SCAN_DISABLE;
-	  hadc3.Init.EOCSelection = ADC_EOC_SEQ_CONV;
-	  hadc3.Init.LowPowerAutoWait = DISABLE;
-	  hadc3.Init.ContinuousConvMode = ENABLE;
-	  hadc3.Init.NbrOfConversion = 1;
-	  hadc3.Init.DiscontinuousConvMode = DISABLE;
-	  hadc3.Init.ExternalTrigConv = ADC_SOFTWARE_START;
-	  hadc3.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
-	  hadc3.Init.ConversionDataManagement = ADC_CONVERSIONDATA_DMA_ONESHOT;
-	  hadc3.Init.Overrun = ADC_OVR_DATA_PRESERVED;
-	  hadc3.Init.LeftBitShift = ADC_LEFTBITSHIFT_NONE;
+	if(rate < ADC_RATE_MIN)
+	{
+		rate = ADC_RATE_MIN;
+	}
 
-	  hadc3.Init.OversamplingMode = bsp.adc.oversampling.enable;
-	  hadc3.Init.Oversampling.Ratio = bsp.adc.oversampling.ratio;
-	  hadc3.Init.Oversampling.RightBitShift =ADC_RightBitShift(bsp.adc.oversampling.ratio);
-	  hadc3.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
-	  hadc3.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+	ticks = (uint32_t)(((float)ADC_TIMER_CLOCK / rate) + 0.5f);
 
-	  if (HAL_ADC_Init(&hadc3) != HAL_OK)
-	  {
-	    Error_Handler();
-	  }
+	if(ticks < 2)
+	{
+		ticks = 2;
+	}
 
-	  /** Configure Regular Channel
-	  */
-	  sConfig.Channel = ADC_CHANNEL_1;
-	  sConfig.Rank = ADC_REGULAR_RANK_1;
-	  sConfig.SamplingTime = ADC_SAMPLETIME_1CYCLE_5;
-	  sConfig.SingleDiff = ADC_DIFFERENTIAL_ENDED;
-	  sConfig.OffsetNumber = ADC_OFFSET_NONE;
-	  sConfig.Offset = 0;
-	  sConfig.OffsetSignedSaturation = DISABLE;
-	  if (HAL_ADC_ConfigChannel(&hadc3, &sConfig) != HAL_OK)
-	  {
-	    Error_Handler();
-	  }
+	*prescaler = (ticks - 1) / 65536;
+	*period = (uint32_t)(((float)ticks / (float)(*prescaler + 1)) + 0.5f) - 1;
+
+	return (float)ADC_TIMER_CLOCK / ((float)(*prescaler + 1) * (float)(*period + 1));
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-bool ADC_Measurement(uint32_t sample_count)
+float ADC_RateAchieved(float rate)
 {
-	float zero_offset = 0.0f;
-	float math_offset = 0.0f;
+	uint32_t prescaler, period;
 
-	float cal_gain = bsp.eeprom.structure.calibration.gain[bsp.adc.gain.index];
+	return ADC_RateDivider(rate, &prescaler, &period);
+}
 
-	if(ADC_Sample(sample_count))
-	{
-		(bsp.adc.offset.enable) ? (zero_offset = bsp.adc.offset.zero[bsp.adc.gain.index]) : (zero_offset = 0.0f);
-		(bsp.adc.math_offset.enable) ? (math_offset = bsp.adc.math_offset.zero[bsp.adc.gain.index]) : (math_offset = 0.0f);
 
-		ADC_SignalConditioning(bsp.adc.gain.value, sample_count, zero_offset, cal_gain, math_offset);
+// --------------------------------------------------------------------------------------------------------------------
 
-		return true;
+// Fastest trigger rate the ADC can follow, bsp.adc.period is the conversion time in us
+
+float ADC_RateMax(void)
+{
+	float conversion = bsp.adc.period;
+
+	if(bsp.adc.oversampling.enable)
+	{
+		conversion *= (float)bsp.adc.oversampling.ratio;
 	}
 
-	return false;
+	return 1000000.0f / conversion;
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-bool ADC_CalibrationMeasurement(uint32_t sample_count)
+// Load TIM6 before the ADC is started, the update event generated here is not seen by the ADC
+
+static void ADC_TimerArm(void)
 {
+	uint32_t prescaler, period;
 
-	if(ADC_Sample(sample_count))
+	if(ADC_EXTERNALTRIG_T6_TRGO != hadc3.Init.ExternalTrigConv)
 	{
+		return;
+	}
 
-		ADC_SignalConditioning(bsp.adc.gain.value, sample_count, 0.0f, 1.0f, 0.0f);
+	HAL_TIM_Base_Stop(&htim6);
 
-		return true;
-	}
+	ADC_RateDivider(bsp.adc.rate, &prescaler, &period);
 
-	return false;
+	__HAL_TIM_SET_PRESCALER(&htim6, prescaler);
+	__HAL_TIM_SET_AUTORELOAD(&htim6, period);
+	__HAL_TIM_SET_COUNTER(&htim6, 0);
+	htim6.Instance->EGR = TIM_EGR_UG;
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-void ADC_CalibrationSetup(void)
+static void ADC_TimerStart(void)
 {
-	  ADC_ChannelConfTypeDef sConfig = {0};
+	if(ADC_EXTERNALTRIG_T6_TRGO == hadc3.Init.ExternalTrigConv)
+	{
+		HAL_TIM_Base_Start(&htim6);
+	}
+}
 
 
-		if (HAL_ADC_DeInit(&hadc3) != HAL_OK)
-		{
-			Error_Handler();
-		}
+// --------------------------------------------------------------------------------------------------------------------
 
+static void ADC_TimerStop(void)
+{
+	HAL_TIM_Base_Stop(&htim6);
+}
 
-	  hadc3.Init.Resolution = ADC_RESOLUTION_16B;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_DataManagement(uint32_t conversion_data, uint32_t dma_mode)
+{
+	hadc3.Init.ConversionDataManagement = conversion_data;
+	hdma_adc3.Init.Mode = dma_mode;
+
+	if (HAL_DMA_Init(&hdma_adc3) != HAL_OK)
+	{
+		Error_Handler();
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Run the ADC into the adc_dma[] ping-pong, one half is block samples. One-shot the DMA stops after both halves, a
+// record of one block is complete after the first one and nothing is refilled while it is copied.
+
+static bool ADC_PingPongStart(uint32_t block, bool oneshot)
+{
+	if(oneshot)
+	{
+		ADC_DataManagement(ADC_CONVERSIONDATA_DMA_ONESHOT, DMA_NORMAL);
+	}
+	else
+	{
+		ADC_DataManagement(ADC_CONVERSIONDATA_DMA_CIRCULAR, DMA_CIRCULAR);
+	}
+
+	ADC_TimerArm();
+
+	if (HAL_OK != HAL_ADC_Start_DMA(&hadc3, (uint32_t *)adc_dma, 2 * block))
+	{
+		ADC_DataManagement(ADC_CONVERSIONDATA_DMA_ONESHOT, DMA_NORMAL);
+		return false;
+	}
+
+	ADC_TimerStart();
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_PingPongStop(void)
+{
+	ADC_TimerStop();
+	HAL_ADC_Stop_DMA(&hadc3);
+
+	ADC_DataManagement(ADC_CONVERSIONDATA_DMA_ONESHOT, DMA_NORMAL);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Largest block in [ADC_BLOCK_SIZE/2, ADC_BLOCK_SIZE] which divides the capture, so the last half is not padded. A
+// record of one block is taken one-shot in a single half. Only a triggered record runs circular in a small block,
+// which is kept at ADC_BLOCK_MIN so the interrupts do not take all of the CPU.
+
+static uint32_t ADC_CaptureBlock(uint32_t sample_count, bool triggered)
+{
+	if(sample_count <= ADC_BLOCK_SIZE)
+	{
+		return (triggered && (sample_count < ADC_BLOCK_MIN)) ? ADC_BLOCK_MIN : sample_count;
+	}
+
+	for(uint32_t block = ADC_BLOCK_SIZE; block >= (ADC_BLOCK_SIZE / 2); block--)
+	{
+		if(0 == (sample_count % block))
+		{
+			return block;
+		}
+	}
+
+	return ADC_BLOCK_SIZE;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// ADC code as watchdog threshold. With oversampling the watchdog compares the accumulated conversions before
+// the right shift.
+
+static uint32_t ADC_TriggerThreshold(float code)
+{
+	float max = (float)((1UL << bsp.adc.bits) - 1);
+
+	if(code < 0.0f)
+	{
+		code = 0.0f;
+	}
+	else if(code > max)
+	{
+		code = max;
+	}
+
+	if(ENABLE == hadc3.Init.OversamplingMode)
+	{
+		return (uint32_t)code * hadc3.Init.Oversampling.Ratio;
+	}
+
+	return (uint32_t)code;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// A positive slope first waits below the level, then above it
+
+static bool ADC_TriggerSetup(const bsp_trigger_t* trigger)
+{
+	ADC_AnalogWDGConfTypeDef awd = {0};
+	uint32_t level = ADC_TriggerThreshold((trigger->level - adc_capture.coeff.bias) / adc_capture.coeff.scale);
+	uint32_t top = ADC_TriggerThreshold((float)UINT16_MAX);
+
+	adc_capture.source = trigger->source;
+	adc_capture.pretrigger = trigger->position;
+
+	if(TRIGGER_SLOPE_POSITIVE == trigger->slope)
+	{
+		adc_capture.arm_high = top;
+		adc_capture.arm_low = level;
+		adc_capture.fire_high = level;
+		adc_capture.fire_low = 0;
+	}
+	else
+	{
+		adc_capture.arm_high = level;
+		adc_capture.arm_low = 0;
+		adc_capture.fire_high = top;
+		adc_capture.fire_low = level;
+	}
+
+	if(TRIGGER_SOURCE_LEVEL != trigger->source)
+	{
+		return true;
+	}
+
+	awd.WatchdogNumber = ADC_ANALOGWATCHDOG_1;
+	awd.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+	awd.Channel = ADC_CHANNEL_1;
+	awd.ITMode = DISABLE;
+	awd.HighThreshold = 0;
+	awd.LowThreshold = 0;
+
+	if(HAL_OK != HAL_ADC_AnalogWDGConfig(&hadc3, &awd))
+	{
+		return false;
+	}
+
+	// Written directly, HAL_ADC_AnalogWDGConfig() shifts the thresholds for the resolution
+	ADC_TriggerWindow(adc_capture.arm_high, adc_capture.arm_low);
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// The pre-trigger samples are in the record, from now on a trigger is accepted
+
+static void ADC_TriggerArm(void)
+{
+	if(TRIGGER_SOURCE_LEVEL == adc_capture.source)
+	{
+		ADC_TriggerWindow(adc_capture.arm_high, adc_capture.arm_low);
+		__HAL_ADC_CLEAR_FLAG(&hadc3, ADC_FLAG_AWD1);
+		adc_capture.trigger = ADC_TRIGGER_ARMED;
+		__HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_AWD1);
+	}
+	else
+	{
+		adc_capture.trigger = ADC_TRIGGER_READY;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_TriggerStart(void)
+{
+	if(ADC_TRIGGER_NONE == adc_capture.trigger)
+	{
+		return;
+	}
+
+	adc_capture.trigger = ADC_TRIGGER_PREFILL;
+
+	if(0 == adc_capture.pretrigger)
+	{
+		ADC_TriggerArm();
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool ADC_TriggerPending(void)
+{
+	return adc_capture.busy && (ADC_TRIGGER_NONE != adc_capture.trigger) && (ADC_TRIGGER_FIRED != adc_capture.trigger);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// *TRG with TRIGger:SOURce BUS, false when no capture waits for a trigger
+
+bool ADC_TriggerBus(void)
+{
+	bool fired = false;
+
+	taskENTER_CRITICAL();
+
+	if(adc_capture.busy && (TRIGGER_SOURCE_BUS == adc_capture.source) && (ADC_TRIGGER_READY == adc_capture.trigger))
+	{
+		ADC_TriggerFire();
+		fired = true;
+	}
+
+	taskEXIT_CRITICAL();
+
+	return fired;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// ABORt: a running stream is stopped, a capture is ended without a result
+
+void ADC_Abort(void)
+{
+	adc_msg_t msg = ADC_MSG_ABORT;
+
+	ADC_StreamStop();
+
+	if(adc_capture.busy)
+	{
+		xQueueSend(QueueADCHandle, &msg, 0);
+		ADC_WaitIdle(ADC_TIMEOUT_MAX);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// The last capture was ended by ABORt and not by an error
+
+bool ADC_Aborted(void)
+{
+	return adc_capture.aborted;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Wait for a pending capture and stop the stream before the ADC is reconfigured. A capture which still waits for
+// its trigger could wait forever, it is aborted.
+static void ADC_Quiesce(void)
+{
+	ADC_StreamStop();
+
+	if((NULL != adc_events) && ADC_TriggerPending())
+	{
+		ADC_Abort();
+	}
+
+	if((NULL != adc_events) && adc_capture.busy)
+	{
+		ADC_WaitCapture(ADC_TRIGGER_TIMEOUT);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_AutoCalibration(void)
+{
+	ADC_Quiesce();
+
+	if (HAL_ADCEx_Calibration_Start(&hadc3, ADC_CALIB_OFFSET_LINEARITY, ADC_DIFFERENTIAL_ENDED) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	if (HAL_ADCEx_Calibration_Start(&hadc3, ADC_CALIB_OFFSET, ADC_DIFFERENTIAL_ENDED) != HAL_OK)
+	{
+		Error_Handler();
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool ADC_Start(uint32_t sample_count, uint32_t records, bool condition, const bsp_trigger_t* trigger,
+		adc_complete_t complete, void* arg)
+{
+	adc_msg_t msg;
+
+	if(adc_capture.busy)
+	{
+		return false;
+	}
+
+	ADC_StreamStop();
+
+	// Only the part of the sample memory backed by measurements[] can be conditioned
+	adc_capture.condition = condition && ((sample_count * records) <= ADC_MEASUREMENT_BUFFER);
+	adc_capture.sample_count = sample_count;
+	adc_capture.records = records;
+	adc_capture.record = 0;
+	adc_capture.produced = 0;
+	adc_capture.consumed = 0;
+	ADC_CoefficientsSnapshot(&adc_capture.coeff);
+	ADC_StatsReset(&adc_capture.stats);
+	adc_capture.complete = complete;
+	adc_capture.arg = arg;
+	adc_capture.status = false;
+	adc_capture.aborted = false;
+	adc_capture.trigger = ADC_TRIGGER_NONE;
+
+	if((NULL != trigger) && (TRIGGER_SOURCE_IMMEDIATE != trigger->source))
+	{
+		if(!ADC_TriggerSetup(trigger))
+		{
+			return false;
+		}
+
+		// The record is rotated into place after the trigger, it can only be converted afterwards
+		adc_capture.condition = false;
+		adc_capture.trigger = ADC_TRIGGER_PREFILL;
+	}
+
+	adc_capture.block = ADC_CaptureBlock(sample_count, ADC_TRIGGER_NONE != adc_capture.trigger);
+	adc_capture.oneshot = (ADC_TRIGGER_NONE == adc_capture.trigger) && (sample_count <= ADC_BLOCK_SIZE);
+
+	adc_capture.busy = true;
+
+	xEventGroupClearBits(adc_events, ADC_EVENT_IDLE);
+
+	ADC_TriggerStart();
+
+	if (!ADC_PingPongStart(adc_capture.block, adc_capture.oneshot))
+	{
+		__HAL_ADC_DISABLE_IT(&hadc3, ADC_IT_AWD1);
+		adc_capture.trigger = ADC_TRIGGER_NONE;
+		adc_capture.busy = false;
+		xEventGroupSetBits(adc_events, ADC_EVENT_IDLE);
+
+		return false;
+	}
+
+	// A triggered record is stamped when the trigger fires
+	if(ADC_TRIGGER_NONE == adc_capture.trigger)
+	{
+		ADC_RecordStamp(0);
+	}
+
+	// Wake the ADC task so it waits for the capture with the abort timeout
+	msg = ADC_MSG_START;
+	xQueueSend(QueueADCHandle, &msg, 0);
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_WaitIdle(uint32_t timeout)
+{
+	EventBits_t bits = xEventGroupWaitBits(adc_events, ADC_EVENT_IDLE, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout));
+
+	return (0 != (bits & ADC_EVENT_IDLE));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// A deep capture at a low rate can run longer than any fixed timeout. Every block restarts the abort timeout of the
+// ADC task, so a stalled capture still ends this wait. Only the wait for a trigger is limited, false when the pending
+// capture waited for it longer than timeout ms.
+
+bool ADC_WaitCapture(uint32_t timeout)
+{
+	uint32_t start = HAL_GetTick();
+
+	while(!ADC_WaitIdle(ADC_WAIT_SLICE))
+	{
+		if(!ADC_TriggerPending())
+		{
+			start = HAL_GetTick();
+		}
+		else if((HAL_GetTick() - start) >= timeout)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_Busy(void)
+{
+	return adc_capture.busy;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_Initiate(uint32_t sample_count, uint32_t records, bool condition, adc_complete_t complete, void* arg)
+{
+	if((0 == records) || (records > ADC_RECORDS_MAX) || ((sample_count * records) > ADC_MEMORY_SAMPLES))
+	{
+		return false;
+	}
+
+	if((TRIGGER_SOURCE_IMMEDIATE != bsp.trigger.source) && (bsp.trigger.position >= sample_count))
+	{
+		return false;
+	}
+
+	// Without condition the float conversion is left to the first fetch which needs it
+	return ADC_Start(sample_count, records, condition, &bsp.trigger, complete, arg);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Fails while an INITiate capture is pending, the caller waits for it before it takes MeasMutex
+
+static bool ADC_Capture(uint32_t sample_count, bool condition)
+{
+	if(!ADC_Start(sample_count, 1, condition, NULL, NULL, NULL))
+	{
+		return false;
+	}
+
+	// Without a trigger the capture ends by itself or by the abort timeout of the ADC task
+	ADC_WaitCapture(ADC_TIMEOUT_MAX);
+
+	return adc_capture.status;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_Sample(uint32_t sample_count)
+{
+	return ADC_Capture(sample_count, false);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_ConditionBlock(const uint16_t* src, float* dst, uint32_t count, const adc_coeff_t* coeff)
+{
+	const float scale = coeff->scale;
+	const float bias = coeff->bias;
+	uint32_t x = 0;
+
+	// Four independent samples per pass, the loads, conversions and multiply-adds pair up in the dual issue pipeline
+	for(; (x + 4) <= count; x += 4)
+	{
+		float a = (float)src[x];
+		float b = (float)src[x + 1];
+		float c = (float)src[x + 2];
+		float d = (float)src[x + 3];
+
+		dst[x] = scale * a + bias;
+		dst[x + 1] = scale * b + bias;
+		dst[x + 2] = scale * c + bias;
+		dst[x + 3] = scale * d + bias;
+	}
+
+	for(; x < count; x++)
+	{
+		dst[x] = scale * (float)src[x] + bias;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_StatsReset(adc_stats_t* stats)
+{
+	stats->count = 0;
+	stats->min = UINT16_MAX;
+	stats->max = 0;
+	stats->sum = 0;
+	stats->sum2 = 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_StatsBlock(adc_stats_t* stats, const uint16_t* src, uint32_t count)
+{
+	uint32_t min = stats->min;
+	uint32_t max = stats->max;
+	uint64_t sum = stats->sum;
+	uint64_t sum2 = stats->sum2;
+	uint32_t code;
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		code = src[x];
+
+		min = (code < min) ? code : min;
+		max = (code > max) ? code : max;
+		sum += code;
+		sum2 += code * code;
+	}
+
+	stats->count += count;
+	stats->min = min;
+	stats->max = max;
+	stats->sum = sum;
+	stats->sum2 = sum2;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Condition and accumulate block by block, the statistics read each block while it is still in the cache
+
+static void ADC_ConditionStats(const uint16_t* src, float* dst, uint32_t count, const adc_coeff_t* coeff,
+		adc_stats_t* stats)
+{
+	uint32_t part;
+
+	while(0 != count)
+	{
+		part = (count > ADC_BLOCK_SIZE) ? ADC_BLOCK_SIZE : count;
+
+		ADC_ConditionBlock(src, dst, part, coeff);
+		ADC_StatsBlock(stats, src, part);
+
+		src += part;
+		dst += part;
+		count -= part;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_Coefficients(adc_coeff_t* coeff, uint8_t gain, float offset, float calib_gain, float math_offset)
+{
+	float inv_gain = 1.0f/(float)gain;
+	float k = calib_gain * bsp.iso224.multiply * bsp.iso224.gain;
+
+	// k * (inv_gain * (resolution * code - vcom) + offset) + math_offset
+	coeff->scale = k * inv_gain * bsp.adc.resolution;
+	coeff->bias = k * (offset - inv_gain * bsp.adc.vcom) + math_offset;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Coefficients for the present gain, offsets and calibration, taken once when a capture is armed
+
+static void ADC_CoefficientsSnapshot(adc_coeff_t* coeff)
+{
+	float offset = (bsp.adc.offset.enable) ? bsp.adc.offset.zero[bsp.adc.gain.index] : 0.0f;
+	float math_offset = (bsp.adc.math_offset.enable) ? bsp.adc.math_offset.zero[bsp.adc.gain.index] : 0.0f;
+
+	ADC_Coefficients(coeff, bsp.adc.gain.value, offset, bsp.eeprom.structure.calibration.gain[bsp.adc.gain.index], math_offset);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_SignalConditioning(uint8_t gain, uint32_t sample_count, float offset, float calib_gain, float math_offset)
+{
+	adc_coeff_t coeff;
+
+	ADC_Coefficients(&coeff, gain, offset, calib_gain, math_offset);
+	ADC_ConditionBlock(adc_data, measurements, sample_count, &coeff);
+
+	// measurements[] follows these coefficients now, so do the statistics
+	adc_result.coeff = coeff;
+	adc_result.converted = true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_SignalConditioningZeroOffset(uint8_t gain, uint32_t sample_count)
+{
+	float inv_gain = 1.0f/(float)gain;
+	adc_coeff_t coeff;
+
+	coeff.scale = inv_gain * bsp.adc.resolution;
+	coeff.bias = -inv_gain * bsp.adc.vcom;
+
+	ADC_ConditionBlock(adc_data, measurements, sample_count, &coeff);
+
+	adc_result.coeff = coeff;
+	adc_result.converted = true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t ADC_SelectResolution(uint8_t value)
+{
+	switch (value)
+	{
+		case 8 : return ADC_RESOLUTION_8B;
+		case 10 : return ADC_RESOLUTION_10B;
+		case 12 : return ADC_RESOLUTION_12B;
+		case 14 : return ADC_RESOLUTION_14B;
+		case 16 : return ADC_RESOLUTION_16B;
+		default : return ADC_RESOLUTION_16B;
+	}
+
+	return ADC_RESOLUTION_16B;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_CheckOverSamplingRation(uint32_t value)
+{
+	uint32_t valid[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+	uint32_t size = sizeof(valid)/sizeof(valid[0]);
+
+	for (uint8_t x = 0; x < size; x++)
+	{
+		if (value == valid[x])
+			return true;
+	}
+
+	return false;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint8_t ADC_GetRightShiftIndex(uint32_t value)
+{
+	uint32_t valid[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+	uint32_t size = sizeof(valid)/sizeof(valid[0]);
+
+	for (uint8_t x = 0; x < size; x++)
+	{
+		if (value == valid[x])
+			return x;
+	}
+
+	return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t ADC_RightBitShift(uint32_t value)
+{
+	uint32_t right_bit_shift[] = {
+			ADC_RIGHTBITSHIFT_NONE,
+			ADC_RIGHTBITSHIFT_1,
+			ADC_RIGHTBITSHIFT_2,
+			ADC_RIGHTBITSHIFT_3,
+			ADC_RIGHTBITSHIFT_4,
+			ADC_RIGHTBITSHIFT_5,
+			ADC_RIGHTBITSHIFT_6,
+			ADC_RIGHTBITSHIFT_7,
+			ADC_RIGHTBITSHIFT_8,
+			ADC_RIGHTBITSHIFT_9,
+			ADC_RIGHTBITSHIFT_10
+			};
+
+	return right_bit_shift[ADC_GetRightShiftIndex(value)];
+
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_ConfigureOverSampling( FunctionalState enable, uint32_t ratio)
+{
+	hadc3.Init.OversamplingMode = enable;
+	hadc3.Init.Oversampling.Ratio = ratio;
+	hadc3.Init.Oversampling.RightBitShift = ADC_RightBitShift(ratio);
+	hadc3.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+	hadc3.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_ConfigureTrigger(void)
+{
+	if(ADC_SOURCE_TIMER == bsp.adc.source)
+	{
+		// One conversion (or one oversampled burst) per TIM6 update event
+		hadc3.Init.ContinuousConvMode = DISABLE;
+		hadc3.Init.ExternalTrigConv = ADC_EXTERNALTRIG_T6_TRGO;
+		hadc3.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+	}
+	else
+	{
+		hadc3.Init.ContinuousConvMode = ENABLE;
+		hadc3.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+		hadc3.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_CheckResolution(uint32_t value)
+{
+	uint8_t valid[5] = {8, 10, 12, 14, 16};
+	bool status = false;
+	size_t size = sizeof(valid)/sizeof(valid[0]);
+
+	for (uint8_t x = 0; x < size; x++)
+	{
+		if (value == valid[x])
+		{
+			status = true;
+			break;
+		}
+	}
+
+	return status;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_CheckGain(uint32_t value)
+{
+	uint8_t valid[3] = {1, 10, 100};
+
+	for (uint8_t x = 0; x < 3; x++)
+	{
+		if (value == valid[x])
+			return true;
+	}
+
+	return false;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint8_t ADC_GainIndex(uint8_t gain)
+{
+	uint8_t valid[] = {1, 10, 100};
+
+	for (uint8_t x = 0; x < 3; x++)
+	{
+		if (gain == valid[x])
+			return x;
+	}
+
+	return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_Reset(uint32_t SamplingTime)
+{
+	ADC_ChannelConfTypeDef sConfig = {0};
+
+	ADC_Quiesce();
+
+	if (HAL_ADC_DeInit(&hadc3) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	if (HAL_ADC_Init(&hadc3) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	sConfig.Channel = ADC_CHANNEL_1;
+	sConfig.Rank = ADC_REGULAR_RANK_1;
+	sConfig.SamplingTime = SamplingTime;
+	sConfig.SingleDiff = ADC_DIFFERENTIAL_ENDED;
+	sConfig.OffsetNumber = ADC_OFFSET_NONE;
+	sConfig.Offset = 0;
+	sConfig.OffsetSignedSaturation = DISABLE;
+
+	if (HAL_ADC_ConfigChannel(&hadc3, &sConfig) != HAL_OK)
+	{
+		Error_Handler();
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_BspReset(void)
+{
+	ADC_ChannelConfTypeDef sConfig = {0};
+
+	ADC_Quiesce();
+
+	if (HAL_ADC_DeInit(&hadc3) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	  hadc3.Instance = ADC3;
+	  hadc3.Init.Resolution = bsp.adc.resolution;
+	  hadc3.Init.ScanConvMode = ADC_SCAN_DISABLE;
+	  hadc3.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+	  hadc3.Init.LowPowerAutoWait = DISABLE;
+	  hadc3.Init.NbrOfConversion = 1;
+	  hadc3.Init.DiscontinuousConvMode = DISABLE;
+	  hadc3.Init.ConversionDataManagement = ADC_CONVERSIONDATA_DMA_ONESHOT;
+	  hadc3.Init.Overrun = ADC_OVR_DATA_PRESERVED;
+	  hadc3.Init.LeftBitShift = ADC_LEFTBITSHIFT_NONE;
+	  ADC_ConfigureTrigger();
+
+	  hadc3.Init.OversamplingMode = bsp.adc.oversampling.enable;
+	  hadc3.Init.Oversampling.Ratio = bsp.adc.oversampling.ratio;
+	  hadc3.Init.Oversampling.RightBitShift =ADC_RightBitShift(bsp.adc.oversampling.ratio);
+	  hadc3.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+	  hadc3.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+
+	  if (HAL_ADC_Init(&hadc3) != HAL_OK)
+	  {
+	    Error_Handler();
+	  }
+
+	  /** Configure Regular Channel
+	  */
+	  sConfig.Channel = ADC_CHANNEL_1;
+	  sConfig.Rank = ADC_REGULAR_RANK_1;
+	  sConfig.SamplingTime = ADC_SAMPLETIME_1CYCLE_5;
+	  sConfig.SingleDiff = ADC_DIFFERENTIAL_ENDED;
+	  sConfig.OffsetNumber = ADC_OFFSET_NONE;
+	  sConfig.Offset = 0;
+	  sConfig.OffsetSignedSaturation = DISABLE;
+	  if (HAL_ADC_ConfigChannel(&hadc3, &sConfig) != HAL_OK)
+	  {
+	    Error_Handler();
+	  }
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// The ring overwrites adc_data[], it can not start while an INITiate capture is pending
+
+bool ADC_StreamStart(void)
+{
+	if(adc_stream.running)
+	{
+		return true;
+	}
+
+	if(adc_capture.busy)
+	{
+		return false;
+	}
+
+	adc_stream.produced = 0;
+	adc_stream.consumed = 0;
+	adc_stream.committed = 0;
+	adc_stream.id = (0 == (adc_stream.id + 1)) ? 1 : (adc_stream.id + 1);
+	adc_stream.running = true;
+
+	if (!ADC_PingPongStart(ADC_BLOCK_SIZE, false))
+	{
+		adc_stream.running = false;
+		return false;
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Restart of the stream for the streaming ports, call with MeasMutex. Only ACQuire:MODE CONTinuous streams, in SINGle
+// mode adc_data[] holds the last capture which FETCh? and DATA? read.
+
+bool ADC_StreamResume(void)
+{
+	if(ADC_MODE_CONTINUOUS != bsp.adc.mode)
+	{
+		return false;
+	}
+
+	return ADC_StreamStart();
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_StreamStop(void)
+{
+	if(!adc_stream.running)
+	{
+		return;
+	}
+
+	ADC_PingPongStop();
+	adc_stream.running = false;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t ADC_StreamOverrun(void)
+{
+	return adc_stream.overrun;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Identifies the running stream, a new value after every restart, 0 while no stream runs
+
+uint32_t ADC_StreamId(void)
+{
+	return adc_stream.running ? adc_stream.id : 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t ADC_StreamCommitted(void)
+{
+	return adc_stream.committed;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Block of the running stream by its number since the start. False when it is not committed yet or the ring already
+// wrapped onto it. The codes stay valid while ADC_StreamCommitted() - block < ADC_RING_BLOCKS.
+
+bool ADC_StreamBlock(uint32_t block, adc_stream_block_t* info)
+{
+	uint32_t committed = adc_stream.committed;
+	uint32_t ring = block % ADC_RING_BLOCKS;
+
+	if(!adc_stream.running || (block >= committed) || ((committed - block) >= ADC_RING_BLOCKS))
+	{
+		return false;
+	}
+
+	info->codes = &adc_data[ring * ADC_BLOCK_SIZE];
+	info->half = adc_stream.half[ring];
+	info->cycles = adc_stream.cycles[ring];
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Add or remove a task which is notified for every committed block
+
+void ADC_StreamListen(TaskHandle_t task, bool listen)
+{
+	taskENTER_CRITICAL();
+
+	for(uint32_t x = 0; x < ADC_STREAM_LISTENERS; x++)
+	{
+		if(task == adc_stream.listener[x])
+		{
+			adc_stream.listener[x] = NULL;
+		}
+	}
+
+	for(uint32_t x = 0; listen && (x < ADC_STREAM_LISTENERS); x++)
+	{
+		if(NULL == adc_stream.listener[x])
+		{
+			adc_stream.listener[x] = task;
+			break;
+		}
+	}
+
+	taskEXIT_CRITICAL();
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// A single capture spans all segments of adc_memory[], a stream only the ring in adc_data[]
+
+uint32_t ADC_SampleCountMax(void)
+{
+	return (ADC_MODE_CONTINUOUS == bsp.adc.mode) ? ADC_STREAM_SAMPLES_MAX : ADC_MEMORY_SAMPLES;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Address of sample index in the sample memory, count is limited to the samples left in that segment
+
+static uint16_t* ADC_MemoryAt(uint32_t index, uint32_t* count)
+{
+	for(uint32_t i = 0; i < ADC_SEGMENTS; i++)
+	{
+		if(index < adc_memory[i].size)
+		{
+			if(*count > (adc_memory[i].size - index))
+			{
+				*count = adc_memory[i].size - index;
+			}
+
+			return &adc_memory[i].data[index];
+		}
+
+		index -= adc_memory[i].size;
+	}
+
+	*count = 0;
+
+	return NULL;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+const uint16_t* ADC_MemorySegment(uint32_t index, uint32_t* count)
+{
+	return ADC_MemoryAt(index, count);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_MemoryWrite(uint32_t index, const uint16_t* src, uint32_t count)
+{
+	while(0 != count)
+	{
+		uint32_t run = count;
+		uint16_t* dst = ADC_MemoryAt(index, &run);
+
+		if(NULL == dst)
+		{
+			return;
+		}
+
+		memcpy(dst, src, run * sizeof(uint16_t));
+
+		index += run;
+		src += run;
+		count -= run;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t ADC_RecordCount(void)
+{
+	return adc_result.records;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t ADC_RecordSize(void)
+{
+	return (0 != adc_result.records) ? (adc_result.sample_count / adc_result.records) : 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Start of record relative to the first record of the last acquisition in seconds
+
+double ADC_RecordTime(uint32_t record)
+{
+	double clock = (double)SystemCoreClock;
+	uint32_t cycles = adc_records[record].cycles - adc_records[0].cycles;
+	uint32_t ticks = adc_records[record].tick - adc_records[0].tick;
+
+	// The cycle counter wraps every 2^32 / SystemCoreClock (about 9 s), the tick count tells how often it did
+	double wraps = round(((double)ticks * 1.0e-3 * clock - (double)cycles) / 4294967296.0);
+
+	return ((double)cycles + wraps * 4294967296.0) / clock;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_StreamCommit(void)
+{
+	uint32_t pending = adc_stream.produced - adc_stream.consumed;
+	uint16_t* src;
+	uint16_t* dst;
+
+	if(pending > 1)
+	{
+		// The DMA already refilled the halves we did not copy in time, keep only the newest one
+		adc_stream.overrun += pending - 1;
+		adc_stream.consumed += pending - 1;
+	}
+
+	src = &adc_dma[(adc_stream.consumed & 0x1) * ADC_BLOCK_SIZE];
+	dst = &adc_data[(adc_stream.committed % ADC_RING_BLOCKS) * ADC_BLOCK_SIZE];
+
+	SCB_InvalidateDCache_by_Addr((uint32_t *)src, ADC_BLOCK_SIZE * sizeof(uint16_t));
+	memcpy(dst, src, ADC_BLOCK_SIZE * sizeof(uint16_t));
+
+	adc_stream.half[adc_stream.committed % ADC_RING_BLOCKS] = adc_stream.consumed;
+	adc_stream.cycles[adc_stream.committed % ADC_RING_BLOCKS] = adc_stream.finished[adc_stream.consumed & 0x1];
+
+	adc_stream.consumed++;
+	adc_stream.committed++;
+
+	if((NULL != adc_stream.waiter) && (adc_stream.committed >= adc_stream.wait_blocks))
+	{
+		xTaskNotifyGive(adc_stream.waiter);
+	}
+
+	for(uint32_t x = 0; x < ADC_STREAM_LISTENERS; x++)
+	{
+		TaskHandle_t listener = adc_stream.listener[x];
+
+		if(NULL != listener)
+		{
+			xTaskNotifyGive(listener);
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_Reverse(uint16_t* data, uint32_t count)
+{
+	uint16_t tmp;
+
+	for(uint32_t x = 0, y = count - 1; x < y; x++, y--)
+	{
+		tmp = data[x];
+		data[x] = data[y];
+		data[y] = tmp;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Rotate the stopped ring left so the window starting at first is at the beginning of adc_data[]
+
+static void ADC_RingRotate(uint32_t first)
+{
+	if(0 == first)
+	{
+		return;
+	}
+
+	ADC_Reverse(adc_data, first);
+	ADC_Reverse(&adc_data[first], ADC_MEASUREMENT_BUFFER - first);
+	ADC_Reverse(adc_data, ADC_MEASUREMENT_BUFFER);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Reverse count samples of the sample memory, the range may cross the segment boundary
+
+static void ADC_MemoryReverse(uint32_t first, uint32_t count)
+{
+	uint32_t run = count;
+	uint16_t* data = ADC_MemoryAt(first, &run);
+	uint32_t last = first + count - 1;
+	uint16_t* x;
+	uint16_t* y;
+	uint16_t tmp;
+
+	if(0 == count)
+	{
+		return;
+	}
+
+	if(run == count)
+	{
+		ADC_Reverse(data, count);
+		return;
+	}
+
+	for(; first < last; first++, last--)
+	{
+		run = 1;
+		x = ADC_MemoryAt(first, &run);
+		run = 1;
+		y = ADC_MemoryAt(last, &run);
+
+		tmp = *x;
+		*x = *y;
+		*y = tmp;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Rotate count samples of the sample memory starting at base left by shift
+
+static void ADC_MemoryRotate(uint32_t base, uint32_t count, uint32_t shift)
+{
+	if(0 == shift)
+	{
+		return;
+	}
+
+	ADC_MemoryReverse(base, shift);
+	ADC_MemoryReverse(base + shift, count - shift);
+	ADC_MemoryReverse(base, count);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_MemoryStats(adc_stats_t* stats, uint32_t index, uint32_t count)
+{
+	const uint16_t* data;
+	uint32_t run;
+
+	while(0 != count)
+	{
+		run = count;
+		data = ADC_MemoryAt(index, &run);
+
+		if((NULL == data) || (0 == run))
+		{
+			return;
+		}
+
+		ADC_StatsBlock(stats, data, run);
+
+		index += run;
+		count -= run;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool ADC_StreamRead(uint32_t sample_count, const adc_coeff_t* coeff, bool convert, adc_stats_t* stats)
+{
+	uint32_t blocks = (sample_count + ADC_BLOCK_SIZE - 1) / ADC_BLOCK_SIZE;
+	uint32_t newest, first, part;
+
+	if((0 == sample_count) || (sample_count > ADC_STREAM_SAMPLES_MAX))
+	{
+		return false;
+	}
+
+	if(!ADC_StreamStart())
+	{
+		return false;
+	}
+
+	adc_stream.wait_blocks = blocks;
+	adc_stream.waiter = xTaskGetCurrentTaskHandle();
+
+	while(adc_stream.committed < blocks)
+	{
+		if(!adc_stream.running || (0 == ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ADC_TIMEOUT_MAX))))
+		{
+			adc_stream.waiter = NULL;
+			return false;
+		}
+	}
+
+	adc_stream.waiter = NULL;
+
+	if(!convert)
+	{
+		// Raw codes are sent straight from adc_data[], so the ring has to stand still. The next read restarts the stream.
+		ADC_StreamStop();
+
+		newest = adc_stream.committed;
+		first = ((newest % ADC_RING_BLOCKS) * ADC_BLOCK_SIZE + ADC_MEASUREMENT_BUFFER - sample_count) % ADC_MEASUREMENT_BUFFER;
+		ADC_RingRotate(first);
+		ADC_StatsBlock(stats, adc_data, sample_count);
+
+		return true;
+	}
+
+	// The ring keeps running while we read it, retry if the ADC task wrapped onto the oldest block in use
+	for(uint8_t retry = 0; retry < 3; retry++)
+	{
+		newest = adc_stream.committed;
+		first = ((newest % ADC_RING_BLOCKS) * ADC_BLOCK_SIZE + ADC_MEASUREMENT_BUFFER - sample_count) % ADC_MEASUREMENT_BUFFER;
+		part = ADC_MEASUREMENT_BUFFER - first;
+		ADC_StatsReset(stats);
+
+		if(part >= sample_count)
+		{
+			ADC_ConditionStats(&adc_data[first], measurements, sample_count, coeff, stats);
+		}
+		else
+		{
+			ADC_ConditionStats(&adc_data[first], measurements, part, coeff, stats);
+			ADC_ConditionStats(adc_data, &measurements[part], sample_count - part, coeff, stats);
+		}
+
+		if((adc_stream.committed - newest + blocks + 1) <= ADC_RING_BLOCKS)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool ADC_Acquire(uint32_t sample_count, bool convert)
+{
+	adc_coeff_t coeff;
+	adc_stats_t stats;
+	bool status;
+
+	if(ADC_MODE_CONTINUOUS != bsp.adc.mode)
+	{
+		if(convert && (sample_count > ADC_MEASUREMENT_BUFFER))
+		{
+			return false;
+		}
+
+		return ADC_Capture(sample_count, convert);
+	}
+
+	ADC_CoefficientsSnapshot(&coeff);
+	ADC_StatsReset(&stats);
+	status = ADC_StreamRead(sample_count, &coeff, convert, &stats);
+
+	if(status)
+	{
+		adc_result.sample_count = sample_count;
+		adc_result.records = 1;
+		adc_result.coeff = coeff;
+		adc_result.stats = stats;
+		adc_result.converted = convert;
+
+		ADC_RecordStamp(0);
+	}
+
+	return status;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Acquire sample_count samples, measurements[] holds the values in volts afterwards
+
+bool ADC_Measurement(uint32_t sample_count)
+{
+	return ADC_Acquire(sample_count, true);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Acquire sample_count samples, adc_data[] holds the raw codes afterwards, measurements[] is not updated
+
+bool ADC_MeasurementRaw(uint32_t sample_count)
+{
+	return ADC_Acquire(sample_count, false);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Fill measurements[] from the raw codes of the last acquisition, if it was not done yet. Of a deep capture only the
+// samples in adc_data[] are converted.
+
+void ADC_ConvertMeasurements(void)
+{
+	uint32_t sample_count = adc_result.sample_count;
+
+	if(sample_count > ADC_MEASUREMENT_BUFFER)
+	{
+		sample_count = ADC_MEASUREMENT_BUFFER;
+	}
+
+	if(!adc_result.converted && (0 != sample_count))
+	{
+		ADC_ConditionBlock(adc_data, measurements, sample_count, &adc_result.coeff);
+	}
+
+	adc_result.converted = true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Volts = scale * code + offset for the raw codes of the last acquisition
+
+void ADC_Scale(float* scale, float* offset)
+{
+	adc_coeff_t coeff = adc_result.coeff;
+
+	if(0 == adc_result.sample_count)
+	{
+		ADC_CoefficientsSnapshot(&coeff);
+	}
+
+	*scale = coeff.scale;
+	*offset = coeff.bias;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Statistics of all samples of the last acquisition in volts, the standard deviation is the population one
+
+bool ADC_Statistics(adc_statistics_t* statistics)
+{
+	const adc_stats_t* stats = &adc_result.stats;
+	double scale = adc_result.coeff.scale;
+	double bias = adc_result.coeff.bias;
+	double mean, variance, min, max, tmp;
+
+	if((0 == adc_result.sample_count) || (0 == stats->count))
+	{
+		return false;
+	}
+
+	mean = (double)stats->sum / (double)stats->count;
+	variance = ((double)stats->sum2 / (double)stats->count) - (mean * mean);
+	variance = (variance > 0.0) ? variance : 0.0;
+
+	min = scale * (double)stats->min + bias;
+	max = scale * (double)stats->max + bias;
+
+	if(min > max)
+	{
+		tmp = min;
+		min = max;
+		max = tmp;
+	}
+
+	statistics->count = stats->count;
+	statistics->min = (float)min;
+	statistics->max = (float)max;
+	statistics->mean = (float)(scale * mean + bias);
+	statistics->stddev = (float)(fabs(scale) * sqrt(variance));
+	statistics->rms = sqrtf((statistics->mean * statistics->mean) + (statistics->stddev * statistics->stddev));
+	statistics->pp = (float)(max - min);
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+float ADC_Average(void)
+{
+	adc_statistics_t statistics;
+
+	if(!ADC_Statistics(&statistics))
+	{
+		return 0.0f;
+	}
+
+	return statistics.mean;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool ADC_CalibrationMeasurement(uint32_t sample_count)
+{
+
+	if(ADC_Sample(sample_count))
+	{
+
+		ADC_SignalConditioning(bsp.adc.gain.value, sample_count, 0.0f, 1.0f, 0.0f);
+
+		return true;
+	}
+
+	return false;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_CalibrationSetup(void)
+{
+	  ADC_ChannelConfTypeDef sConfig = {0};
+
+	  ADC_Quiesce();
+
+		if (HAL_ADC_DeInit(&hadc3) != HAL_OK)
+		{
+			Error_Handler();
+		}
+
+
+	  hadc3.Init.Resolution = ADC_RESOLUTION_16B;
 	  hadc3.Init.OversamplingMode = ENABLE;
 	  hadc3.Init.Oversampling.Ratio = 1024;
 	  hadc3.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_10;
 	  hadc3.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
 	  hadc3.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
 
+	  // Calibration always runs free, ADC_BspReset() restores the selected trigger
+	  hadc3.Init.ContinuousConvMode = ENABLE;
+	  hadc3.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+	  hadc3.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+
 		if (HAL_ADC_Init(&hadc3) != HAL_OK)
 		{
 			Error_Handler();
@@ -432,3 +1985,235 @@ void ADC_InitMemory()
 {
 	memset(measurements, 0, ADC_MEASUREMENT_BUFFER*sizeof(float));
 }
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_CaptureDone(bool status)
+{
+	adc_complete_t complete = adc_capture.complete;
+	void* arg = adc_capture.arg;
+
+	__HAL_ADC_DISABLE_IT(&hadc3, ADC_IT_AWD1);
+	ADC_PingPongStop();
+	adc_capture.trigger = ADC_TRIGGER_NONE;
+
+	if(status)
+	{
+		adc_result.sample_count = adc_capture.sample_count * adc_capture.records;
+		adc_result.records = adc_capture.records;
+		adc_result.coeff = adc_capture.coeff;
+		adc_result.stats = adc_capture.stats;
+		adc_result.converted = adc_capture.condition;
+	}
+
+	adc_capture.status = status;
+	adc_capture.busy = false;
+	xEventGroupSetBits(adc_events, ADC_EVENT_IDLE);
+
+	if(NULL != complete)
+	{
+		complete(status, arg);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Re-arm the ping-pong for the next record of a TRIGger:COUNt capture, or finish the capture after the last one
+
+static void ADC_RecordDone(void)
+{
+	adc_capture.record++;
+
+	if(adc_capture.record >= adc_capture.records)
+	{
+		ADC_CaptureDone(true);
+		return;
+	}
+
+	ADC_PingPongStop();
+
+	adc_capture.produced = 0;
+	adc_capture.consumed = 0;
+
+	ADC_TriggerStart();
+
+	if(!ADC_PingPongStart(adc_capture.block, adc_capture.oneshot))
+	{
+		ADC_CaptureDone(false);
+		return;
+	}
+
+	if(ADC_TRIGGER_NONE == adc_capture.trigger)
+	{
+		ADC_RecordStamp(adc_capture.record);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// A triggered record is filled as a ring, sample n of the record goes to n modulo SAMPle:COUNt. The ring stops
+// SAMPle:COUNt - TRIGger:POSition samples after the trigger and is rotated into place.
+
+static void ADC_CaptureCommit(void)
+{
+	uint32_t first = adc_capture.consumed * adc_capture.block;
+	uint32_t base = adc_capture.record * adc_capture.sample_count;
+	uint32_t end = adc_capture.sample_count;
+	uint32_t count = adc_capture.block;
+	uint32_t offset, run, skip;
+	adc_trigger_t trigger = adc_capture.trigger;
+	uint16_t* src = &adc_dma[(adc_capture.consumed & 0x1) * adc_capture.block];
+
+	if(ADC_TRIGGER_FIRED == trigger)
+	{
+		end = adc_capture.trigger_index + adc_capture.sample_count - adc_capture.pretrigger;
+	}
+	else if(ADC_TRIGGER_NONE != trigger)
+	{
+		end = UINT32_MAX;
+	}
+
+	// The trigger can put the end of the record before this block, nothing of it belongs to the record then
+	if(end <= first)
+	{
+		count = 0;
+	}
+	else if(count > (end - first))
+	{
+		count = end - first;
+	}
+
+	// The block size does not have to be cache line aligned, adc_dma[] is never written by the CPU so drop all of it
+	SCB_InvalidateDCache_by_Addr((uint32_t *)adc_dma, sizeof(adc_dma));
+
+	// The block does not always divide SAMPle:COUNt, a block of the ring can wrap around. A block longer than the
+	// record (ADC_BLOCK_MIN) would overwrite its own oldest samples, only the newest SAMPle:COUNt are written.
+	skip = (count > adc_capture.sample_count) ? (count - adc_capture.sample_count) : 0;
+	offset = (first + skip) % adc_capture.sample_count;
+	run = adc_capture.sample_count - offset;
+
+	if(run >= (count - skip))
+	{
+		ADC_MemoryWrite(base + offset, &src[skip], count - skip);
+	}
+	else
+	{
+		ADC_MemoryWrite(base + offset, &src[skip], run);
+		ADC_MemoryWrite(base, &src[skip + run], count - skip - run);
+	}
+
+	// The half was refilled before or while it was copied, the capture would not be contiguous. One-shot the DMA
+	// stops after the second half and never writes the first one again.
+	if(!adc_capture.oneshot && ((adc_capture.produced - adc_capture.consumed) > 1))
+	{
+		ADC_CaptureDone(false);
+		return;
+	}
+
+	adc_capture.consumed++;
+
+	// Condition this block while the DMA fills the other half. A triggered record is only complete after the rotation.
+	if(adc_capture.condition)
+	{
+		ADC_ConditionStats(&adc_data[base + first], &measurements[base + first], count, &adc_capture.coeff,
+				&adc_capture.stats);
+	}
+	else if(ADC_TRIGGER_NONE == trigger)
+	{
+		ADC_StatsBlock(&adc_capture.stats, src, count);
+	}
+
+	if((ADC_TRIGGER_PREFILL == trigger) && ((first + count) >= adc_capture.pretrigger))
+	{
+		ADC_TriggerArm();
+	}
+
+	if((first + count) >= end)
+	{
+		if(ADC_TRIGGER_NONE != trigger)
+		{
+			ADC_MemoryRotate(base, adc_capture.sample_count, end % adc_capture.sample_count);
+			ADC_MemoryStats(&adc_capture.stats, base, adc_capture.sample_count);
+		}
+
+		ADC_RecordDone();
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void StartADCTask(void* argument)
+{
+	adc_msg_t msg;
+
+	for(;;)
+	{
+		// A capture which does not finish within ADC_TIMEOUT_MAX is aborted
+		if(pdTRUE != xQueueReceive(QueueADCHandle, &msg, adc_capture.busy ? pdMS_TO_TICKS(ADC_TIMEOUT_MAX) : portMAX_DELAY))
+		{
+			if(adc_capture.busy)
+			{
+				ADC_CaptureDone(false);
+			}
+
+			continue;
+		}
+
+		switch(msg)
+		{
+			case ADC_MSG_BLOCK:
+			{
+				while(adc_stream.running && (adc_stream.consumed != adc_stream.produced))
+				{
+					ADC_StreamCommit();
+				}
+
+				while(adc_capture.busy && (adc_capture.consumed != adc_capture.produced))
+				{
+					ADC_CaptureCommit();
+				}
+			}; break;
+			case ADC_MSG_START: break;
+			case ADC_MSG_ABORT:
+			{
+				if(adc_capture.busy)
+				{
+					adc_capture.aborted = true;
+					ADC_CaptureDone(false);
+				}
+			}; break;
+			default: break;
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void ADC_CycleCounterInit(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void ADC_CreateTask(void)
+{
+	ADC_CycleCounterInit();
+
+	QueueADCHandle = xQueueCreate(ADC_QUEUE_LENGTH, sizeof(adc_msg_t));
+	adc_events = xEventGroupCreateStatic(&adc_events_control_block);
+	xEventGroupSetBits(adc_events, ADC_EVENT_IDLE);
+
+	adc_handler = xTaskCreateStatic(StartADCTask, "adc_Task",
+			ADC_THREAD_STACKSIZE, (void*)1, tskIDLE_PRIORITY + 4,
+			adc_buffer, &adc_control_block);
+}
@@ -11,6 +11,7 @@
 #include "ADC.h"
 #include "SCPI_Def.h"
 #include "EEPROM.h"
+#include "FloatToString.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -30,6 +31,14 @@ static void BSP_Init_Common()
 	bsp.adc.oversampling.ratio = 1;
 	bsp.adc.bits = 16;
 	bsp.adc.sample_count = ADC_DEF_SIZE;
+	bsp.adc.mode = ADC_MODE_SINGLE;
+	bsp.adc.source = ADC_SOURCE_IMMEDIATE;
+	bsp.adc.rate = ADC_RATE_DEF;
+	bsp.trigger.count = 1;
+	bsp.trigger.source = TRIGGER_SOURCE_IMMEDIATE;
+	bsp.trigger.level = 0.0f;
+	bsp.trigger.slope = TRIGGER_SLOPE_POSITIVE;
+	bsp.trigger.position = 0;
 	bsp.adc.vcom = ADC_VCOM;
 	bsp.adc.resolution = (float)(ADC_VREF/pow(2.0,(double)bsp.adc.bits));
 
@@ -52,10 +61,6 @@ static void BSP_Init_Common()
 	bsp.iso224.multiply = 200.0f; // to reconstruct the signal we need to invert the dividers: voltage divider (100) * op-amp gain OPA2340 (2)
 	bsp.iso224.gain = 3.0f;
 
-	bsp.format.data = FORMAT_DATA_ASCII;
-
-	bsp.resource = VISA_SCPI_RAW;
-
 
 }
 
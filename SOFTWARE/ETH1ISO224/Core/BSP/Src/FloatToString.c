@@ -5,261 +5,319 @@
  *      Author: grzegorz
  */
 
-
-//
-// Author: Daniel Wright
-// Influenced by: https://github.com/vinceallenvince/floatToString/blob/master/floatToString.h
-//
-// Simple demo involving a custom float to string implementation
-// Should be portable, but cannot process IEEE-754 double precision numbers
-// ^^ this can only handle single (float32) floating point numbers.
-//
-// Decently accurate compared to sprintf, but I don't think it is going to be
-// nearly as rigorous.
-//
-// Appears to be about ~5 times faster than glibc's sprintf("%f", number)
-// implementation, but that is at least on the machine tested. The performance
-// advantage seems to diminish slightly for numbers
-// with a very large magnitude (> (+/-)10^12)
-//
-//
-
-#include <stdint.h>
-#include <stdio.h>
-
-#include <stdlib.h>
-#include <time.h>
-#include <math.h>
-
-// Random huge number to test how much divergence from
-// glibc's sprintf the implementation will acheieve
-#define HI 1.6212959e+17
-#define LO -HI
-
-// 250 thousand iterations, takes about a few seconds.
-// Covers a good amount of ground computationally for
-// just a simple benchmark.
-#define ITERATIONS_PERF 250000
-
-// Used in function below to print side-by-side outputs
-// from both libc's sprintf and the custom implementation
-#define ITERATIONS_LOGICAL 33
-
-// Used for char buffer
-#define BUFFERSIZE 4096
-
-// Change to refine precision
-#define NUM_DECIMAL_PLACES 6
-
-
-// Our ***very*** constrained digit-to-char function
-static inline void to_digit_char_unsafe(int8_t digit, char* out) {
-	out[0] = '0' + digit;
-}
-
-// lossy floating point values probably not a big deal.
-// Enabled it since some platforms (e.g. ARM) can't use
-// some SIMD instructions (i.e. NEON) without relaxed fp.
-// Should only affect infinities, but I'm not entirely sure.
-// #pragma FP_CONTRACT fast
-#define __FAST_MATH__ 1
-
-// Instead of calculating powers of 10 (and their reciprocals),
-// it is computationally quicker to have tables of these values
-// to which the code can look. Only goes up to 10^38 (and 10^-38)
-// since that is the order of magnitude of the maximum value for
-// an IEEE-754 32 bit floating point number.
-// See: https://en.wikipedia.org/wiki/Single-precision_floating-point_format
-//
-// Note that a double (64-bit) has a maximum on the order of 10^308.
-// Feel free to implement that, but I didn't really have a demand for
-// implementing this for double precision as well
-// (float is enough precision for my use).
-static const float __inv_pow_10[] = {
-1.0f, 						// 0
-	0.1f, 						// 1
-	0.01f, 						// 2
-	0.001f, 					// 3
-	0.0001f, 					// 4
-	0.00001f, 					// 5
-	0.000001f, 					// 6
-	0.0000001f, 					// 7
-	0.00000001f, 					// 8
-	0.000000001f, 					// 9
-	0.0000000001f, 					// 10
-	0.00000000001f, 				// 11
-	0.000000000001f, 				// 12
-	0.0000000000001f, 				// 13
-	0.00000000000001f, 				// 14
-	0.000000000000001f, 				// 15
-	0.0000000000000001f, 				// 16
-	0.00000000000000001f, 				// 17
-	0.000000000000000001f, 				// 18
-	0.0000000000000000001f, 			// 19
-	0.00000000000000000001f, 			// 20
-	0.000000000000000000001f, 			// 21
-	0.0000000000000000000001f, 			// 22
-	0.00000000000000000000001f, 			// 23
-	0.000000000000000000000001f, 			// 24
-	0.0000000000000000000000001f, 			// 25
-	0.00000000000000000000000001f, 			// 26
-	0.000000000000000000000000001f, 		// 27
-	0.0000000000000000000000000001f, 		// 28
-	0.00000000000000000000000000001f, 		// 29
-	0.000000000000000000000000000001f, 		// 30
-	0.0000000000000000000000000000001f, 		// 31
-	0.00000000000000000000000000000001f, 		// 32
-	0.000000000000000000000000000000001f, 		// 33
-	0.0000000000000000000000000000000001f, 		// 34
-	0.00000000000000000000000000000000001f, 	// 35
-	0.000000000000000000000000000000000001f, 	// 36
-	0.00000000000000000000000000000000000001f, 	// 37
-	0.000000000000000000000000000000000000001f 	// 38
-
+// --------------------------------------------------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "FloatToString.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// NR3 text with a fixed number of significant digits, same as snprintf("%.*E", precision - 1, value). The float
+// m * 2^e is multiplied with a 64 bit power of ten in integers only, the digits come from a two digit table.
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define FTOA_SCALE_MIN		-39
+#define FTOA_SCALE_MAX		54
+
+// floor(log2(10^s)) - 63, the binary exponent of ftoa_pow10[]
+#define FTOA_POW10_EXP(s)	((((s) * 1741647) >> 19) - 63)
+
+// The rounded power leaves less than 2^33 in the 64 bit fraction, closer to a half the exact product decides
+#define FTOA_HALF_MARGIN	(1ULL << 36)
+
+// Enough 32 bit words for m * 5^FTOA_SCALE_MAX and the other side of the compare
+#define FTOA_BIG_WORDS		6
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// 10^s = ftoa_pow10[s - FTOA_SCALE_MIN] * 2^FTOA_POW10_EXP(s), rounded to 64 bits
+
+static const uint64_t ftoa_pow10[FTOA_SCALE_MAX - FTOA_SCALE_MIN + 1] =
+{
+	0xAE397D8AA96C1B78ULL, 0xD9C7DCED53C72256ULL, 0x881CEA14545C7575ULL,
+	0xAA242499697392D3ULL, 0xD4AD2DBFC3D07788ULL, 0x84EC3C97DA624AB5ULL,
+	0xA6274BBDD0FADD62ULL, 0xCFB11EAD453994BAULL, 0x81CEB32C4B43FCF5ULL,
+	0xA2425FF75E14FC32ULL, 0xCAD2F7F5359A3B3EULL, 0xFD87B5F28300CA0EULL,
+	0x9E74D1B791E07E48ULL, 0xC612062576589DDBULL, 0xF79687AED3EEC551ULL,
+	0x9ABE14CD44753B53ULL, 0xC16D9A0095928A27ULL, 0xF1C90080BAF72CB1ULL,
+	0x971DA05074DA7BEFULL, 0xBCE5086492111AEBULL, 0xEC1E4A7DB69561A5ULL,
+	0x9392EE8E921D5D07ULL, 0xB877AA3236A4B449ULL, 0xE69594BEC44DE15BULL,
+	0x901D7CF73AB0ACD9ULL, 0xB424DC35095CD80FULL, 0xE12E13424BB40E13ULL,
+	0x8CBCCC096F5088CCULL, 0xAFEBFF0BCB24AAFFULL, 0xDBE6FECEBDEDD5BFULL,
+	0x89705F4136B4A597ULL, 0xABCC77118461CEFDULL, 0xD6BF94D5E57A42BCULL,
+	0x8637BD05AF6C69B6ULL, 0xA7C5AC471B478423ULL, 0xD1B71758E219652CULL,
+	0x83126E978D4FDF3BULL, 0xA3D70A3D70A3D70AULL, 0xCCCCCCCCCCCCCCCDULL,
+	0x8000000000000000ULL, 0xA000000000000000ULL, 0xC800000000000000ULL,
+	0xFA00000000000000ULL, 0x9C40000000000000ULL, 0xC350000000000000ULL,
+	0xF424000000000000ULL, 0x9896800000000000ULL, 0xBEBC200000000000ULL,
+	0xEE6B280000000000ULL, 0x9502F90000000000ULL, 0xBA43B74000000000ULL,
+	0xE8D4A51000000000ULL, 0x9184E72A00000000ULL, 0xB5E620F480000000ULL,
+	0xE35FA931A0000000ULL, 0x8E1BC9BF04000000ULL, 0xB1A2BC2EC5000000ULL,
+	0xDE0B6B3A76400000ULL, 0x8AC7230489E80000ULL, 0xAD78EBC5AC620000ULL,
+	0xD8D726B7177A8000ULL, 0x878678326EAC9000ULL, 0xA968163F0A57B400ULL,
+	0xD3C21BCECCEDA100ULL, 0x84595161401484A0ULL, 0xA56FA5B99019A5C8ULL,
+	0xCECB8F27F4200F3AULL, 0x813F3978F8940984ULL, 0xA18F07D736B90BE5ULL,
+	0xC9F2C9CD04674EDFULL, 0xFC6F7C4045812296ULL, 0x9DC5ADA82B70B59EULL,
+	0xC5371912364CE305ULL, 0xF684DF56C3E01BC7ULL, 0x9A130B963A6C115CULL,
+	0xC097CE7BC90715B3ULL, 0xF0BDC21ABB48DB20ULL, 0x96769950B50D88F4ULL,
+	0xBC143FA4E250EB31ULL, 0xEB194F8E1AE525FDULL, 0x92EFD1B8D0CF37BEULL,
+	0xB7ABC627050305AEULL, 0xE596B7B0C643C719ULL, 0x8F7E32CE7BEA5C70ULL,
+	0xB35DBF821AE4F38CULL, 0xE0352F62A19E306FULL, 0x8C213D9DA502DE45ULL,
+	0xAF298D050E4395D7ULL, 0xDAF3F04651D47B4CULL, 0x88D8762BF324CD10ULL,
+	0xAB0E93B6EFEE0054ULL, 0xD5D238A4ABE98068ULL, 0x85A36366EB71F041ULL,
+	0xA70C3C40A64E6C52ULL
 };
 
-// Same concept as above, but positive exponents of 10.
-static const float __pos_pow_10[] = {
-
-	1.0f, 					        // 0
-	10.0f, 					        // 1
-	100.0f, 				        // 2
-	1000.0f, 				        // 3
-	10000.0f, 				        // 4
-	100000.0f, 				        // 5
-	1000000.0f, 				        // 6
-	10000000.0f, 				        // 7
-	100000000.0f, 				        // 8
-	1000000000.0f, 				        // 9
-	10000000000.0f, 			        // 10
-	100000000000.0f, 			        // 11
-	1000000000000.0f, 			        // 12
-	10000000000000.0f, 			        // 13
-	100000000000000.0f, 				// 14
-	1000000000000000.0f, 				// 15
-	10000000000000000.0f, 				// 16
-	100000000000000000.0f, 				// 17
-	1000000000000000000.0f, 			// 18
-	10000000000000000000.0f, 			// 19
-	100000000000000000000.0f, 			// 20
-	1000000000000000000000.0f, 			// 21
-	10000000000000000000000.0f, 		        // 22
-	100000000000000000000000.0f, 		        // 23
-	1000000000000000000000000.0f, 		        // 24
-	10000000000000000000000000.0f, 		        // 25
-	100000000000000000000000000.0f, 	        // 26
-	1000000000000000000000000000.0f, 	        // 27
-	10000000000000000000000000000.0f, 	        // 28
-	100000000000000000000000000000.0f, 	        // 29
-	1000000000000000000000000000000.0f, 		// 30
-	10000000000000000000000000000000.0f, 		// 31
-	100000000000000000000000000000000.0f, 		// 32
-	1000000000000000000000000000000000.0f, 		// 33
-	10000000000000000000000000000000000.0f, 	// 34
-	100000000000000000000000000000000000.0f, 	// 35
-	1000000000000000000000000000000000000.0f, 	// 36
-	10000000000000000000000000000000000000.0f, 	// 37
-	100000000000000000000000000000000000000.0f 	// 38
-
+static const uint32_t ftoa_int10[FTOA_PRECISION_MAX + 1] =
+{
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
 };
 
-// Offset pointers for calculation below (to save a few instructions)
-static const float* const __inv_pow_10p = &(__inv_pow_10[-1]);
-static const float* const __pos_pow_10o = &(__pos_pow_10[1]);
-static const float* const __pos_pow_10p = &(__pos_pow_10[-1]);
-
-size_t floatToString(char* outstr, float value) {
-
-	size_t places=NUM_DECIMAL_PLACES;
-    // Used to store current digit for calculations below.
-    // That means the possible values for this byte are [0, 9]
-    int8_t digit;
-
-    // The order of magnitude on which the input resides
-    // i.e. tenscount = (int)log10f(abs(value))
-    // ^^ dont use log10f here -- tried and it's miserably slow :-)
-    size_t tenscount = 0;
+static const char ftoa_digits[200] =
+{
+	'0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+	'1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+	'2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+	'3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+	'4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+	'5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+	'6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+	'7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+	'8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+	'9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
 
-    // counter for loops below
-    size_t i;
 
-    // temp variable for calculations below
-    float tempfloat = value;
+// --------------------------------------------------------------------------------------------------------------------
 
-    // the number of characters consumed by the string representing this float
-    // (this is what is returned)
-    size_t c = 0;
+static void ftoa_BigMul(uint32_t* big, uint32_t factor)
+{
+	uint64_t carry = 0;
 
-    // calculate rounding term d:   0.5/pow(10,places)
-    float d = (value < 0) ? -0.5f : 0.5f;
+	for (uint32_t x = 0; x < FTOA_BIG_WORDS; x++)
+	{
+		carry += (uint64_t)big[x] * factor;
+		big[x] = (uint32_t)carry;
+		carry >>= 32;
+	}
+}
 
-    // divide by ten for each decimal place
-    d = d * __inv_pow_10[places];
 
-    // this small addition, combined with truncation will round our values properly
-    if (value < 0) {
-        tempfloat = -(value + d);
-    } else {
-    	tempfloat = value + d;
-    }
+// --------------------------------------------------------------------------------------------------------------------
 
-    // This logic is similar to
-    // tenscount = (int)log10f(tempfloat)
-    // but is not miserably slow.
-    while (__pos_pow_10o[tenscount++] <= tempfloat) {}
+static void ftoa_BigShift(uint32_t* big, uint32_t bits)
+{
+	for (; bits >= 32; bits -= 32)
+	{
+		memmove(&big[1], &big[0], (FTOA_BIG_WORDS - 1) * sizeof(uint32_t));
+		big[0] = 0;
+	}
 
-    // the number is negative
-    if (value < 0) {
-        outstr[c++] = '-';
-    }
+	ftoa_BigMul(big, 1U << bits);
+}
 
-    if (tenscount == 0) {
-        outstr[c++] = '0';
-    }
 
-    // #pragma nounroll
-    for (i = 0; i < tenscount; i++) {
+// --------------------------------------------------------------------------------------------------------------------
+
+// m * 2^e * 10^s against n + 0.5 in exact integers, the rare case in which the rounded power does not tell
+
+static int32_t ftoa_CompareHalf(uint32_t m, int32_t e, int32_t s, uint32_t n)
+{
+	uint32_t value[FTOA_BIG_WORDS] = {m};
+	uint32_t half[FTOA_BIG_WORDS] = {2U * n + 1U};
+	uint32_t* five = (s >= 0) ? value : half;
+	int32_t t = e + 1 + s;
+
+	// 2 * m * 2^e * 2^s * 5^s against 2n + 1
+	for (int32_t x = (s >= 0) ? s : -s; x > 0; x--)
+	{
+		ftoa_BigMul(five, 5U);
+	}
+
+	if (t >= 0)
+	{
+		ftoa_BigShift(value, (uint32_t)t);
+	}
+	else
+	{
+		ftoa_BigShift(half, (uint32_t)-t);
+	}
+
+	for (int32_t x = FTOA_BIG_WORDS - 1; x >= 0; x--)
+	{
+		if (value[x] != half[x])
+		{
+			return (value[x] > half[x]) ? 1 : -1;
+		}
+	}
+
+	return 0;
+}
 
-    	const ssize_t idx = tenscount-i;
 
-        digit = (int8_t) (tempfloat * __inv_pow_10p[idx]);
+// --------------------------------------------------------------------------------------------------------------------
 
-        to_digit_char_unsafe(digit, &outstr[c++]);
-        tempfloat = tempfloat - ((float)digit * __pos_pow_10p[idx]);
+// Integer part of m * 2^e * 10^s and the 64 bit fraction behind it, m has its top bit at bit 23
 
-    }
+static uint64_t ftoa_Scale(uint32_t m, int32_t e, int32_t s, uint64_t* fraction)
+{
+	uint64_t power = ftoa_pow10[s - FTOA_SCALE_MIN];
+	uint64_t low = (uint64_t)m * (uint32_t)power;
+	uint64_t high = (uint64_t)m * (uint32_t)(power >> 32) + (low >> 32);
 
-    // if places is zero, then there is no decimal part
-    if (places > 0) {
-    	outstr[c++] = '.';
-    }
+	// m * power = high * 2^32 + (uint32_t)low, the integer part starts at bit shift of high, 22..56
+	uint32_t shift = (uint32_t)(-(e + FTOA_POW10_EXP(s))) - 32U;
 
-  //  #pragma nounroll
-    for (i = 0; i < places; i++) {
+	*fraction = high << (64U - shift);
+	*fraction |= (shift <= 32U) ? ((low & 0xFFFFFFFFULL) << (32U - shift)) : ((low & 0xFFFFFFFFULL) >> (shift - 32U));
 
-        tempfloat *= 10.0f;
-        digit = (int8_t) tempfloat;
+	return high >> shift;
+}
 
-        // convert digit to character
-        // If you replace this function with sprintf("%d", digit)
-        // you will see where sprintf most likely spends most of
-        // its time during their implementation of this routine :-)
-        //
-        // Note that if for some reason digit is not within [0,9],
-        // your number will be a flaming pile of shit
-        to_digit_char_unsafe(digit, &outstr[c++]);
 
-        tempfloat = tempfloat - (float) digit;
+// --------------------------------------------------------------------------------------------------------------------
 
-    }
+// Write count digits of value right aligned ending at out, two per step
 
-    outstr[c++] = ',';
+static void ftoa_Digits(char* out, uint32_t value, uint32_t count)
+{
+	while (count >= 2)
+	{
+		uint32_t pair = (value % 100U) * 2U;
 
-    return c;
+		value /= 100U;
+		out -= 2;
+		out[0] = ftoa_digits[pair];
+		out[1] = ftoa_digits[pair + 1];
+		count -= 2;
+	}
 
+	if (count)
+	{
+		*(--out) = (char)('0' + value);
+	}
 }
 
 
-
-
-
+// --------------------------------------------------------------------------------------------------------------------
+
+// Format value followed by ',' and return the length, at most FTOA_SIZE characters. NaN and infinity are reported
+// with the SCPI values 9.91E+37 and +/-9.9E+37.
+
+size_t floatToString(char* outstr, float value, uint8_t precision)
+{
+	uint32_t bits;
+	uint32_t mantissa;
+	uint32_t exponent_bits;
+	int32_t exponent;
+	char* out = outstr;
+
+	if (precision < FTOA_PRECISION_MIN)
+	{
+		precision = FTOA_PRECISION_MIN;
+	}
+	else if (precision > FTOA_PRECISION_MAX)
+	{
+		precision = FTOA_PRECISION_MAX;
+	}
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	exponent_bits = (bits >> 23) & 0xFFU;
+	mantissa = bits & 0x7FFFFFU;
+
+	if (0xFFU == exponent_bits)
+	{
+		const char* text = mantissa ? "9.91E+37," : ((bits >> 31) ? "-9.9E+37," : "9.9E+37,");
+		size_t length = strlen(text);
+
+		memcpy(outstr, text, length);
+
+		return length;
+	}
+
+	*out = '-';
+	out += bits >> 31;
+
+	if ((0U == exponent_bits) && (0U == mantissa))
+	{
+		exponent = 0;
+	}
+	else
+	{
+		uint32_t m;
+		int32_t e;
+		int32_t scale;
+		uint64_t integer;
+		uint64_t fraction;
+		int64_t half;
+
+		// |value| = m * 2^e, a subnormal is shifted up to a 24 bit m as well
+		if (exponent_bits)
+		{
+			m = mantissa | 0x800000U;
+			e = (int32_t)exponent_bits - 150;
+		}
+		else
+		{
+			uint32_t shift = (uint32_t)__builtin_clz(mantissa) - 8U;
+
+			m = mantissa << shift;
+			e = -149 - (int32_t)shift;
+		}
+
+		// floor(log10(2^e)) from the binary exponent is the decimal exponent or one below, then one more digit comes out
+		exponent = ((e + 23) * 78913) >> 18;
+		scale = (int32_t)precision - 1 - exponent;
+
+		while ((integer = ftoa_Scale(m, e, scale, &fraction)) >= ftoa_int10[precision])
+		{
+			exponent++;
+			scale--;
+		}
+
+		mantissa = (uint32_t)integer;
+
+		// Rounded half to even as printf does, only an exact tie is even
+		half = (int64_t)(fraction - 0x8000000000000000ULL);
+
+		if ((half > (int64_t)FTOA_HALF_MARGIN) || (half < -(int64_t)FTOA_HALF_MARGIN))
+		{
+			mantissa += (uint32_t)(half > 0);
+		}
+		else
+		{
+			int32_t compare = ftoa_CompareHalf(m, e, scale, mantissa);
+
+			mantissa += (uint32_t)((compare > 0) || ((0 == compare) && (mantissa & 1U)));
+		}
+
+		// Rounded up to the next decade, 9.9999999 -> 1.000000E+01
+		if (mantissa >= ftoa_int10[precision])
+		{
+			mantissa /= 10U;
+			exponent++;
+		}
+	}
+
+	// d.ddddddE+xx, the leading digit is moved in front of the point afterwards
+	ftoa_Digits(out + precision + 1, mantissa, precision);
+	out[0] = out[1];
+	out[1] = '.';
+	out += (precision > 1) ? (precision + 1) : 1;
+
+	*out++ = 'E';
+
+	// '+' and '-' are two apart
+	*out++ = (char)('+' + ((exponent < 0) ? 2 : 0));
+	exponent = (exponent < 0) ? -exponent : exponent;
+
+	ftoa_Digits(out + 2, (uint32_t)exponent, 2);
+	out += 2;
+
+	*out++ = ',';
+
+	return (size_t)(out - outstr);
+}
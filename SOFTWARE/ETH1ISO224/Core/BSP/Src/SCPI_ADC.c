@@ -22,6 +22,23 @@
 extern bsp_t bsp;
 extern ADC_HandleTypeDef hadc3;
 extern scpi_choice_def_t scpi_boolean_select[];
+extern SemaphoreHandle_t MeasMutex;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_choice_def_t adc_acquire_mode_select[] =
+{
+    {"SINGle", ADC_MODE_SINGLE},
+    {"CONTinuous", ADC_MODE_CONTINUOUS},
+    SCPI_CHOICE_LIST_END
+};
+
+scpi_choice_def_t adc_sample_source_select[] =
+{
+    {"IMMediate", ADC_SOURCE_IMMEDIATE},
+    {"TIMer", ADC_SOURCE_TIMER},
+    SCPI_CHOICE_LIST_END
+};
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -43,6 +60,12 @@ scpi_result_t SCPI_AdcConfigurationResolution(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
+	// The ADC is stopped and initialised again, no other session may measure meanwhile
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	bsp.adc.bits = (uint8_t)value;
 	bsp.adc.resolution = ADC_VREF/pow(2,(double)bsp.adc.bits);
 	hadc3.Init.Resolution = ADC_SelectResolution((uint8_t)value);
@@ -52,6 +75,8 @@ scpi_result_t SCPI_AdcConfigurationResolution(scpi_t * context)
 
 	bsp.adc.period = SCPI_CycleToPeriod(bsp.adc.cycles, bsp.adc.bits);
 
+	xSemaphoreGive(MeasMutex);
+
 	return SCPI_RES_OK;
 }
 
@@ -203,12 +228,19 @@ scpi_result_t SCPI_AdcConfigurationSamplingTimeCycle(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	bsp.adc.sampling_time = sampling_time;
 	bsp.adc.cycles = value;
 	bsp.adc.period = SCPI_CycleToPeriod(bsp.adc.cycles, bsp.adc.bits);
 	ADC_Reset(sampling_time);
 	ADC_AutoCalibration();
 
+	xSemaphoreGive(MeasMutex);
+
 	return SCPI_RES_OK;
 }
 
@@ -247,6 +279,11 @@ scpi_result_t SCPI_AdcConfigurationSamplingTimePeriod(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	bsp.adc.sampling_time = sampling_time;
 	bsp.adc.cycles = SCPI_PeriodToCycle(value, bsp.adc.bits);
 	bsp.adc.period = value;
@@ -254,6 +291,8 @@ scpi_result_t SCPI_AdcConfigurationSamplingTimePeriod(scpi_t * context)
 	ADC_Reset(sampling_time);
 	ADC_AutoCalibration();
 
+	xSemaphoreGive(MeasMutex);
+
 	return SCPI_RES_OK;
 }
 
@@ -275,12 +314,19 @@ scpi_result_t SCPI_AdcConfigurationOverSamplingEnable(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	bsp.adc.oversampling.enable = (bool)value;
 
 	ADC_ConfigureOverSampling(bsp.adc.oversampling.enable, bsp.adc.oversampling.ratio);
 	ADC_Reset(bsp.adc.sampling_time);
 	ADC_AutoCalibration();
 
+	xSemaphoreGive(MeasMutex);
+
 	return SCPI_RES_OK;
 }
 
@@ -312,6 +358,11 @@ scpi_result_t SCPI_AdcConfigurationOverSamplingRatio(scpi_t * context)
 	}
 
 
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	if (bsp.adc.oversampling.enable)
 	{
 		if (bsp.adc.oversampling.ratio != value)
@@ -325,6 +376,8 @@ scpi_result_t SCPI_AdcConfigurationOverSamplingRatio(scpi_t * context)
 
 	bsp.adc.oversampling.ratio = (uint16_t)value;
 
+	xSemaphoreGive(MeasMutex);
+
 	return SCPI_RES_OK;
 }
 
@@ -356,9 +409,20 @@ scpi_result_t SCPI_AdcConfigurationGain(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
-	bsp.adc.gain.value = (uint8_t)gain;
-	bsp.adc.gain.index = ADC_GainIndex((uint8_t)gain);
-	GPIO_SelectGain((uint8_t)gain);
+	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		// The streams restart with a new stream id and configuration hash, their codes need the new scale
+		ADC_StreamStop();
+		bsp.adc.gain.value = (uint8_t)gain;
+		bsp.adc.gain.index = ADC_GainIndex((uint8_t)gain);
+		GPIO_SelectGain((uint8_t)gain);
+
+		xSemaphoreGive(MeasMutex);
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
 
 	return SCPI_RES_OK;
 }
@@ -389,14 +453,14 @@ scpi_result_t SCPI_AdcConfigurationSampleCount(scpi_t * context)
 			switch(sample_count.content.tag)
 			{
 				case SCPI_NUM_MIN: bsp.adc.sample_count = 1; break;
-				case SCPI_NUM_MAX: bsp.adc.sample_count = ADC_MEASUREMENT_BUFFER; break;
+				case SCPI_NUM_MAX: bsp.adc.sample_count = ADC_SampleCountMax(); break;
 				case SCPI_NUM_DEF: bsp.adc.sample_count = ADC_DEF_SIZE; break;
 				default: SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE); return SCPI_RES_ERR;
 			}
 		}
 		else{
 
-			if ((sample_count.content.value > ADC_MEASUREMENT_BUFFER) || (sample_count.content.value < 1))
+			if ((sample_count.content.value > ADC_SampleCountMax()) || (sample_count.content.value < 1))
 			{
 				SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
 				return SCPI_RES_ERR;
@@ -413,7 +477,224 @@ scpi_result_t SCPI_AdcConfigurationSampleCount(scpi_t * context)
 
 scpi_result_t SCPI_AdcConfigurationSampleCountQ(scpi_t * context)
 {
+	scpi_number_t limit;
+
+	// SAMPle:COUNt? MIN|MAX|DEF reports the limits for the present ACQuire:MODE
+	if(SCPI_ParamNumber(context, scpi_special_numbers_def, &limit, FALSE))
+	{
+		if(!limit.special)
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+			return SCPI_RES_ERR;
+		}
+
+		switch(limit.content.tag)
+		{
+			case SCPI_NUM_MIN: SCPI_ResultUInt32(context, 1); break;
+			case SCPI_NUM_MAX: SCPI_ResultUInt32(context, ADC_SampleCountMax()); break;
+			case SCPI_NUM_DEF: SCPI_ResultUInt32(context, ADC_DEF_SIZE); break;
+			default: SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE); return SCPI_RES_ERR;
+		}
+
+		return SCPI_RES_OK;
+	}
+
+	if(SCPI_ParamErrorOccurred(context))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	SCPI_ResultUInt32(context, bsp.adc.sample_count);
 
 	return SCPI_RES_OK;
 }
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcSampleSource(scpi_t * context)
+{
+	int32_t value;
+
+	if (!SCPI_ParamChoice(context, adc_sample_source_select, &value, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		bsp.adc.source = (adc_source_t)value;
+
+		ADC_ConfigureTrigger();
+		ADC_Reset(bsp.adc.sampling_time);
+		ADC_AutoCalibration();
+
+		xSemaphoreGive(MeasMutex);
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcSampleSourceQ(scpi_t * context)
+{
+	const char* name;
+
+	SCPI_ChoiceToName(adc_sample_source_select, bsp.adc.source, &name);
+	SCPI_ResultMnemonic(context, name);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcSampleRate(scpi_t * context)
+{
+	scpi_number_t rate;
+	float value;
+
+	if(!SCPI_ParamNumber(context, scpi_special_numbers_def, &rate, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if(rate.special)
+	{
+		switch(rate.content.tag)
+		{
+			case SCPI_NUM_MIN: value = ADC_RATE_MIN; break;
+			case SCPI_NUM_MAX: value = ADC_RateMax(); break;
+			case SCPI_NUM_DEF: value = ADC_RATE_DEF; break;
+			default: SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE); return SCPI_RES_ERR;
+		}
+	}
+	else
+	{
+		if ((rate.content.value > ADC_RateMax()) || (rate.content.value < ADC_RATE_MIN))
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+			return SCPI_RES_ERR;
+		}
+
+		value = (float)rate.content.value;
+	}
+
+	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		// A running stream picks up the new rate when it is restarted by the next read
+		ADC_StreamStop();
+		bsp.adc.rate = ADC_RateAchieved(value);
+
+		xSemaphoreGive(MeasMutex);
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcSampleRateQ(scpi_t * context)
+{
+	// Timer paced: the rate TIM6 really runs at, free running: the ADC conversion rate
+	if(ADC_SOURCE_TIMER == bsp.adc.source)
+	{
+		SCPI_ResultDouble(context, ADC_RateAchieved(bsp.adc.rate));
+	}
+	else
+	{
+		SCPI_ResultDouble(context, ADC_RateMax());
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcAcquireMode(scpi_t * context)
+{
+	int32_t value;
+	bool status = true;
+
+	if (!SCPI_ParamChoice(context, adc_acquire_mode_select, &value, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if ((ADC_MODE_CONTINUOUS == value) && (bsp.adc.sample_count > ADC_STREAM_SAMPLES_MAX))
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+		return SCPI_RES_ERR;
+	}
+
+	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		// The ring would overwrite the pending capture
+		if ((ADC_MODE_CONTINUOUS == value) && ADC_Busy())
+		{
+			xSemaphoreGive(MeasMutex);
+			SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+			return SCPI_RES_ERR;
+		}
+
+		bsp.adc.mode = (adc_mode_t)value;
+
+		if (ADC_MODE_CONTINUOUS == bsp.adc.mode)
+		{
+			status = ADC_StreamStart();
+		}
+		else
+		{
+			ADC_StreamStop();
+		}
+
+		xSemaphoreGive(MeasMutex);
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if (!status)
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_SYSTEM_ERROR);
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcAcquireModeQ(scpi_t * context)
+{
+	const char* name;
+
+	SCPI_ChoiceToName(adc_acquire_mode_select, bsp.adc.mode, &name);
+	SCPI_ResultMnemonic(context, name);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_AdcAcquireOverrunQ(scpi_t * context)
+{
+	SCPI_ResultUInt32(context, ADC_StreamOverrun());
+
+	return SCPI_RES_OK;
+}
@@ -13,10 +13,10 @@
 #include "ADC.h"
 #include "GPIO.h"
 #include "SCPI_Calculate.h"
+#include "SCPI_Measure.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
-extern float measurements[];
 extern SemaphoreHandle_t MeasMutex;
 extern scpi_choice_def_t scpi_boolean_select[];
 extern bsp_t bsp;
@@ -48,24 +48,6 @@ scpi_result_t SCPI_CalculateOffsetEnableQ(scpi_t * context)
 }
 
 
-// --------------------------------------------------------------------------------------------------------------------
-
-static float CALC_Average(uint32_t sample_count)
-{
-	float average = 0.0f;
-	float tmp = 0.0f;
-
-	for (uint32_t i = 0; i < sample_count ; i++)
-	{
-		tmp += measurements[i];
-	}
-
-	average = (float)(tmp/sample_count);
-
-	return average;
-}
-
-
 // --------------------------------------------------------------------------------------------------------------------
 
 scpi_result_t SCPI_CalculateOffset(scpi_t * context)
@@ -73,15 +55,15 @@ scpi_result_t SCPI_CalculateOffset(scpi_t * context)
 	uint32_t sample_size = ADC_DEF_SIZE;
 	bool null_offset_state = bsp.adc.math_offset.enable;
 
-	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	if(MEAS_TakeIdle(context))
 	{
 
 	 bsp.adc.math_offset.enable = false;
 
-		if(ADC_Measurement(sample_size))
+		if(ADC_MeasurementRaw(sample_size))
 		{
 
-			bsp.adc.math_offset.zero[bsp.adc.gain.index] = -1.0f * CALC_Average(sample_size);
+			bsp.adc.math_offset.zero[bsp.adc.gain.index] = -1.0f * ADC_Average();
 			bsp.adc.math_offset.enable = null_offset_state;
 		}
 		else
@@ -133,10 +115,33 @@ scpi_result_t SCPI_CalculateOffsetQ(scpi_t * context)
 
 scpi_result_t SCPI_CalculateAverageQ(scpi_t * context)
 {
+	// The statistics cover the whole sample memory, also a deep capture which measurements[] does not hold
+	if(MEAS_TakeIdle(context))
+	{
+		SCPI_ResultFloat(context, ADC_Average());
+		xSemaphoreGive(MeasMutex);
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Minimum, maximum, mean, RMS, standard deviation, peak-to-peak and sample count of the last acquisition
+
+scpi_result_t SCPI_CalculateStatisticsQ(scpi_t * context)
+{
+	adc_statistics_t statistics;
+	bool status;
 
-	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	if(MEAS_TakeIdle(context))
 	{
-		SCPI_ResultFloat(context, CALC_Average(bsp.adc.sample_count));
+		status = ADC_Statistics(&statistics);
 		xSemaphoreGive(MeasMutex);
 	}
 	else
@@ -144,5 +149,19 @@ scpi_result_t SCPI_CalculateAverageQ(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
+	if(!status)
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+		return SCPI_RES_ERR;
+	}
+
+	SCPI_ResultFloat(context, statistics.min);
+	SCPI_ResultFloat(context, statistics.max);
+	SCPI_ResultFloat(context, statistics.mean);
+	SCPI_ResultFloat(context, statistics.rms);
+	SCPI_ResultFloat(context, statistics.stddev);
+	SCPI_ResultFloat(context, statistics.pp);
+	SCPI_ResultUInt32(context, statistics.count);
+
 	return SCPI_RES_OK;
 }
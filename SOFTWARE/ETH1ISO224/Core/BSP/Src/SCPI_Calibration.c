@@ -61,24 +61,6 @@ scpi_result_t SCPI_CalibrationStore(scpi_t * context)
 #define CAL_LIMIT_LOW	0.9f
 #define CAL_SAMP_COUNT	1000
 
-extern float measurements[];
-
-static float CALIB_Average(uint32_t sample_count)
-{
-	float average = 0.0f;
-	float tmp = 0.0f;
-
-	for (uint32_t i = 0; i < sample_count ; i++)
-	{
-		tmp += measurements[i];
-	}
-
-	average = (float)(tmp/sample_count);
-
-	return average;
-}
-
-
 // --------------------------------------------------------------------------------------------------------------------
 
 scpi_result_t SCPI_CalibrationValue(scpi_t * context)
@@ -111,7 +93,7 @@ scpi_result_t SCPI_CalibrationValue(scpi_t * context)
 			return SCPI_RES_ERR;
 		}
 
-		average = fabs(CALIB_Average(CAL_SAMP_COUNT));
+		average = fabs(ADC_Average());
 
 		calib = vref/average;
 
@@ -182,6 +164,8 @@ scpi_result_t SCPI_CalibrationAdcAutoMode(scpi_t * context)
 
 	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
 	{
+		ADC_StreamStop();
+
 		if( ADC_CALIB_OFFSET == select)
 		{
 			if (HAL_ADCEx_Calibration_Start(&hadc3, ADC_CALIB_OFFSET, ADC_DIFFERENTIAL_ENDED) != HAL_OK)
@@ -46,12 +46,17 @@
 #include "scpi/scpi.h"
 
 #include "SCPI_Def.h"
+#include "SCPI_Server.h"
+#include "SCPI_Session.h"
 #include "SCPI_System.h"
 #include "SCPI_ADC.h"
 #include "SCPI_Measure.h"
 #include "SCPI_Calibration.h"
 #include "SCPI_Format.h"
 #include "SCPI_Calculate.h"
+#include "SCPI_Trigger.h"
+#include "UDP.h"
+#include "STREAM.h"
 #include "printf.h"
 #include "FloatToString.h"
 #include "BSP.h"
@@ -61,6 +66,7 @@
 // --------------------------------------------------------------------------------------------------------------------
 
 extern bsp_t bsp;
+extern SemaphoreHandle_t MeasMutex;
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -78,11 +84,22 @@ scpi_choice_def_t scpi_boolean_select[] =
 static scpi_result_t SCPI_Rst(scpi_t * context)
 {
 	// DO NOT MAKE A HARD RESET !
+	// The ADC is stopped and initialised again, no other session may measure meanwhile
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
 	BSP_Init();
 	ADC_InitMemory();
+	ADC_ConfigureTrigger();
 	ADC_Reset(bsp.adc.sampling_time);
 	ADC_AutoCalibration();
 	GPIO_SelectGain(bsp.adc.gain.value);
+
+	xSemaphoreGive(MeasMutex);
+
+	SCPI_SessionReset(context);
 	return SCPI_RES_OK;
 }
 
@@ -149,26 +166,26 @@ scpi_result_t SCPI_TS(scpi_t * context)
 
 const scpi_command_t scpi_commands[] = {
     /* IEEE Mandated Commands (SCPI std V1999.0 4.1.1) */
-    { .pattern = "*CLS", .callback = SCPI_CoreCls,},
-    { .pattern = "*ESE", .callback = SCPI_CoreEse,},
+    { .pattern = "*CLS", .callback = SCPI_CoreCls, .tag = SCPI_TAG_UNLOCKED,},
+    { .pattern = "*ESE", .callback = SCPI_CoreEse, .tag = SCPI_TAG_UNLOCKED,},
     { .pattern = "*ESE?", .callback = SCPI_CoreEseQ,},
     { .pattern = "*ESR?", .callback = SCPI_CoreEsrQ,},
     { .pattern = "*IDN?", .callback = SCPI_IdnQ,},
-    { .pattern = "*OPC", .callback = SCPI_CoreOpc,},
-    { .pattern = "*OPC?", .callback = SCPI_CoreOpcQ,},
+    { .pattern = "*OPC", .callback = SCPI_Opc, .tag = SCPI_TAG_UNLOCKED,},
+    { .pattern = "*OPC?", .callback = SCPI_OpcQ,},
     { .pattern = "*RST", .callback = SCPI_Rst,},
-    { .pattern = "*SRE", .callback = SCPI_CoreSre,},
+    { .pattern = "*SRE", .callback = SCPI_CoreSre, .tag = SCPI_TAG_UNLOCKED,},
     { .pattern = "*SRE?", .callback = SCPI_CoreSreQ,},
     { .pattern = "*STB?", .callback = SCPI_CoreStbQ,},
     { .pattern = "*TST?", .callback = SCPI_CoreTstQ,},
-    { .pattern = "*WAI", .callback = SCPI_CoreWai,},
+    { .pattern = "*WAI", .callback = SCPI_Wai, .tag = SCPI_TAG_UNLOCKED,},
 
     {.pattern = "STATus:QUEStionable[:EVENt]?", .callback = SCPI_StatusQuestionableEventQ,},
     /* {.pattern = "STATus:QUEStionable:CONDition?", .callback = scpi_stub_callback,}, */
-    {.pattern = "STATus:QUEStionable:ENABle", .callback = SCPI_StatusQuestionableEnable,},
+    {.pattern = "STATus:QUEStionable:ENABle", .callback = SCPI_StatusQuestionableEnable, .tag = SCPI_TAG_UNLOCKED,},
     {.pattern = "STATus:QUEStionable:ENABle?", .callback = SCPI_StatusQuestionableEnableQ,},
 
-    {.pattern = "STATus:PRESet", .callback = SCPI_StatusPreset,},
+    {.pattern = "STATus:PRESet", .callback = SCPI_StatusPreset, .tag = SCPI_TAG_UNLOCKED,},
 
     /* Required SCPI commands (SCPI std V1999.0 4.2.1) */
     {.pattern = "SYSTem:ERRor[:NEXT]?", .callback = SCPI_SystemErrorQ,},
@@ -184,6 +201,12 @@ const scpi_command_t scpi_commands[] = {
 	{.pattern = "SYSTem:COMMunicate:LAN:MAC", .callback = SCPI_SystemCommunicateLanMac,},
 	{.pattern = "SYSTem:COMMunicate:LAN:MAC?", .callback = SCPI_SystemCommunicateLanMacQ,},
 	{.pattern = "SYSTem:COMMunicate:LAN:UPDate", .callback = SCPI_SystemCommunicationLanUpdate,},
+	{.pattern = "SYSTem:COMMunicate:UDP:MULTicast", .callback = SCPI_SystemCommunicateUdpMulticast,},
+	{.pattern = "SYSTem:COMMunicate:UDP:MULTicast?", .callback = SCPI_SystemCommunicateUdpMulticastQ,},
+	{.pattern = "SYSTem:COMMunicate:UDP:RELiable", .callback = SCPI_SystemCommunicateUdpReliable,},
+	{.pattern = "SYSTem:COMMunicate:UDP:RELiable?", .callback = SCPI_SystemCommunicateUdpReliableQ,},
+	{.pattern = "SYSTem:COMMunicate:TCPip:CONTrol?", .callback = SCPI_SystemCommTcpipControlQ,},
+	{.pattern = "SYSTem:COMMunicate:TCPip:STReam:OVERflow?", .callback = SCPI_SystemCommTcpipStreamOverflowQ,},
 	{.pattern = "SYSTem:SECure:STATe", .callback = SCPI_SystemSecureState,},
 	{.pattern = "SYSTem:SECure:STATe?", .callback = SCPI_SystemSecureStateQ,},
 	{.pattern = "SYSTem:SERVice:MDNS[:ENAble]", .callback = SCPI_SystemServiceMDNSEnable,},
@@ -195,6 +218,9 @@ const scpi_command_t scpi_commands[] = {
 	{.pattern = "SYSTem:SERVice:LED[:ENAble]?", .callback = SCPI_SystemServiceLEDEnableQ,},
 	{.pattern = "SYSTem:SERVice:LED:PING", .callback = SCPI_SystemServiceLEDPing,},
 	{.pattern = "SYSTem:SERVice:RESET", .callback = SCPI_SystemServiceReset,},
+	{.pattern = "SYSTem:LOCK:REQuest?", .callback = SCPI_SystemLockRequestQ,},
+	{.pattern = "SYSTem:LOCK:RELease", .callback = SCPI_SystemLockRelease, .tag = SCPI_TAG_UNLOCKED,},
+	{.pattern = "SYSTem:LOCK:OWNer?", .callback = SCPI_SystemLockOwnerQ,},
 
 	//{.pattern = "TS", .callback = SCPI_TS,},
 
@@ -214,15 +240,44 @@ const scpi_command_t scpi_commands[] = {
 	{.pattern = "CONFiguration:GAIN?", .callback = SCPI_AdcConfigurationGainQ,},
 	{.pattern = "SAMPle:COUNt", .callback = SCPI_AdcConfigurationSampleCount,},
 	{.pattern = "SAMPle:COUNt?", .callback = SCPI_AdcConfigurationSampleCountQ,},
-
-	{.pattern = "MEASure?", .callback = SCPI_MeasureQ,},
-	{.pattern = "READ?", .callback = SCPI_MeasureQ,},
-	{.pattern = "R?", .callback = SCPI_MeasureQ,},
+	{.pattern = "SAMPle:SOURce", .callback = SCPI_AdcSampleSource,},
+	{.pattern = "SAMPle:SOURce?", .callback = SCPI_AdcSampleSourceQ,},
+	{.pattern = "SAMPle:RATE", .callback = SCPI_AdcSampleRate,},
+	{.pattern = "SAMPle:RATE?", .callback = SCPI_AdcSampleRateQ,},
+	{.pattern = "ACQuire:MODE", .callback = SCPI_AdcAcquireMode,},
+	{.pattern = "ACQuire:MODE?", .callback = SCPI_AdcAcquireModeQ,},
+	{.pattern = "ACQuire:OVERrun?", .callback = SCPI_AdcAcquireOverrunQ,},
+
+	{.pattern = "MEASure?", .callback = SCPI_MeasureQ, .tag = SCPI_TAG_LOCKED,},
+	{.pattern = "READ?", .callback = SCPI_MeasureQ, .tag = SCPI_TAG_LOCKED,},
+	{.pattern = "R?", .callback = SCPI_MeasureQ, .tag = SCPI_TAG_LOCKED,},
 	{.pattern = "FETCh?", .callback = SCPI_FetchQ,},
+	{.pattern = "UDP:MEASure?", .callback = SCPI_MeasureQ, .tag = SCPI_TAG_LOCKED,},
+	{.pattern = "UDP:READ?", .callback = SCPI_MeasureQ, .tag = SCPI_TAG_LOCKED,},
+	{.pattern = "UDP:R?", .callback = SCPI_MeasureQ, .tag = SCPI_TAG_LOCKED,},
+	{.pattern = "UDP:FETCh?", .callback = SCPI_FetchQ,},
+	{.pattern = "UDP:INITiate[:IMMediate]", .callback = SCPI_Initiate,},
+	{.pattern = "UDP:STReam:SUBScribe", .callback = SCPI_UdpStreamSubscribe, .tag = SCPI_TAG_UNLOCKED,},
+	{.pattern = "UDP:STReam:UNSubscribe", .callback = SCPI_UdpStreamUnsubscribe, .tag = SCPI_TAG_UNLOCKED,},
 	{.pattern = "DATA[:DATA]?", .callback = SCPI_DataDataQ,},
+	{.pattern = "DATA:ALL?", .callback = SCPI_DataAllQ,},
+	{.pattern = "DATA:RECord?", .callback = SCPI_DataRecordQ,},
+	{.pattern = "DATA:RECord:COUNt?", .callback = SCPI_DataRecordCountQ,},
+	{.pattern = "DATA:RECord:TIMe?", .callback = SCPI_DataRecordTimeQ,},
 
 	{.pattern = "INITiate[:IMMediate]", .callback = SCPI_Initiate,},
-	{.pattern = "*TRG", .callback = SCPI_Initiate,},
+	{.pattern = "*TRG", .callback = SCPI_TriggerImmediate,},
+	{.pattern = "TRIGger:COUNt", .callback = SCPI_TriggerCount,},
+	{.pattern = "TRIGger:COUNt?", .callback = SCPI_TriggerCountQ,},
+	{.pattern = "TRIGger:SOURce", .callback = SCPI_TriggerSource,},
+	{.pattern = "TRIGger:SOURce?", .callback = SCPI_TriggerSourceQ,},
+	{.pattern = "TRIGger:LEVel", .callback = SCPI_TriggerLevel,},
+	{.pattern = "TRIGger:LEVel?", .callback = SCPI_TriggerLevelQ,},
+	{.pattern = "TRIGger:SLOPe", .callback = SCPI_TriggerSlope,},
+	{.pattern = "TRIGger:SLOPe?", .callback = SCPI_TriggerSlopeQ,},
+	{.pattern = "TRIGger:POSition", .callback = SCPI_TriggerPosition,},
+	{.pattern = "TRIGger:POSition?", .callback = SCPI_TriggerPositionQ,},
+	{.pattern = "ABORt", .callback = SCPI_Abort,},
 
 	{.pattern = "ADC:NULL:OFFSet:ENAble", .callback = SCPI_NullOffsetEnable,},
 	{.pattern = "ADC:NULL:OFFSet:ENAble?", .callback = SCPI_NullOffsetEnableQ,},
@@ -235,10 +290,16 @@ const scpi_command_t scpi_commands[] = {
 	{.pattern = "CALibration:VALue?", .callback = SCPI_CalibrationValueQ,},
 	{.pattern = "CALIBration:ADC:AUTO[:MODE]", .callback = SCPI_CalibrationAdcAutoMode,},
 
-	{.pattern = "FORMat[:DATA]", .callback = SCPI_FormatData,},
+	{.pattern = "FORMat[:DATA]", .callback = SCPI_FormatData, .tag = SCPI_TAG_UNLOCKED,},
 	{.pattern = "FORMat[:DATA]?", .callback = SCPI_FormatDataQ,},
+	{.pattern = "FORMat:SCALe?", .callback = SCPI_FormatScaleQ,},
+	{.pattern = "FORMat:BORDer", .callback = SCPI_FormatBorder, .tag = SCPI_TAG_UNLOCKED,},
+	{.pattern = "FORMat:BORDer?", .callback = SCPI_FormatBorderQ,},
+	{.pattern = "FORMat:ASCii:PRECision", .callback = SCPI_FormatAsciiPrecision, .tag = SCPI_TAG_UNLOCKED,},
+	{.pattern = "FORMat:ASCii:PRECision?", .callback = SCPI_FormatAsciiPrecisionQ,},
 
 	{.pattern = "CALCulate:AVERage?", .callback = SCPI_CalculateAverageQ,},
+	{.pattern = "CALCulate:STATistics?", .callback = SCPI_CalculateStatisticsQ,},
 	{.pattern = "CALCulate:OFFSet:ENAble", .callback = SCPI_CalculateOffsetEnable,},
 	{.pattern = "CALCulate:OFFSet:ENAble?", .callback = SCPI_CalculateOffsetEnableQ,},
 	{.pattern = "CALCulate:OFFSet", .callback = SCPI_CalculateOffset,},
@@ -255,6 +316,7 @@ scpi_interface_t scpi_interface = {
     .control = SCPI_Control,
     .flush = SCPI_Flush,
     .reset = SCPI_Reset,
+    .command = SCPI_SessionCommand,
 };
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -265,12 +327,16 @@ scpi_interface_t scpi_hislip_interface = {
     .control = SCPI_Control,
     .flush = SCPI_Flush,
     .reset = SCPI_Reset,
+    .command = SCPI_SessionCommand,
 };
 
 // --------------------------------------------------------------------------------------------------------------------
 
-char scpi_input_buffer[SCPI_INPUT_BUFFER_LENGTH];
-scpi_error_t scpi_error_queue_data[SCPI_ERROR_QUEUE_SIZE];
-
-scpi_t scpi_context;
-scpi_t scpi_hislip_context;
+scpi_interface_t scpi_udp_interface = {
+    .error = SCPI_Error,
+    .write = UDP_Write,
+    .control = SCPI_Control,
+    .flush = UDP_Flush,
+    .reset = SCPI_Reset,
+    .command = SCPI_SessionCommand,
+};
@@ -8,7 +8,10 @@
 // --------------------------------------------------------------------------------------------------------------------
 
 #include "SCPI_Format.h"
+#include "SCPI_Session.h"
 #include "BSP.h"
+#include "ADC.h"
+#include "FloatToString.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -20,22 +23,53 @@ scpi_choice_def_t format_data_select[] =
 {
     {"ASCII", FORMAT_DATA_ASCII},
     {"REAL", FORMAT_DATA_REAL32},
+    {"INT16", FORMAT_DATA_INT16},
+    {"PACKed", FORMAT_DATA_PACKED},
+    SCPI_CHOICE_LIST_END
+};
+
+scpi_choice_def_t format_border_select[] =
+{
+    {"NORMal", FORMAT_BORDER_NORMAL},
+    {"SWAPped", FORMAT_BORDER_SWAPPED},
     SCPI_CHOICE_LIST_END
 };
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
+// FORMat[:DATA] ASCII|REAL[,32|64]|INT16|PACKed
+
 scpi_result_t SCPI_FormatData(scpi_t * context)
 {
+	format_t* format = SCPI_SessionFormat(context);
 	int32_t value;
+	uint32_t length;
 
 	if (!SCPI_ParamChoice(context, format_data_select, &value, TRUE))
 	{
 		return SCPI_RES_ERR;
 	}
 
-	bsp.format.data = (format_data_t)value;
+	if (SCPI_ParamUInt32(context, &length, FALSE))
+	{
+		if ((FORMAT_DATA_REAL32 != value) || ((32 != length) && (64 != length)))
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+			return SCPI_RES_ERR;
+		}
+
+		if (64 == length)
+		{
+			value = FORMAT_DATA_REAL64;
+		}
+	}
+	else if (SCPI_ParamErrorOccurred(context))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	format->data = (format_data_t)value;
 
 	return SCPI_RES_OK;
 }
@@ -45,13 +79,129 @@ scpi_result_t SCPI_FormatData(scpi_t * context)
 
 scpi_result_t SCPI_FormatDataQ(scpi_t * context)
 {
-	if (FORMAT_DATA_ASCII == bsp.format.data)
+	format_t* format = SCPI_SessionFormat(context);
+
+	if (FORMAT_DATA_ASCII == format->data)
 	{
 		SCPI_ResultCharacters(context, "ASCII", 5);
 	}
-	else if (FORMAT_DATA_REAL32 == bsp.format.data)
+	else if (FORMAT_DATA_REAL32 == format->data)
+	{
+		SCPI_ResultCharacters(context, "REAL", 4);
+		SCPI_ResultUInt32(context, 32);
+	}
+	else if (FORMAT_DATA_REAL64 == format->data)
+	{
+		SCPI_ResultCharacters(context, "REAL", 4);
+		SCPI_ResultUInt32(context, 64);
+	}
+	else if (FORMAT_DATA_INT16 == format->data)
+	{
+		SCPI_ResultCharacters(context, "INT16", 5);
+	}
+	else if (FORMAT_DATA_PACKED == format->data)
 	{
-		SCPI_ResultCharacters(context, "REAL", 5);
+		SCPI_ResultCharacters(context, "PACKed", 6);
 	}
 	return SCPI_RES_OK;
 }
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Byte order of REAL and INT16 blocks, NORMal is big endian as IEEE 488.2 defines it
+
+scpi_result_t SCPI_FormatBorder(scpi_t * context)
+{
+	format_t* format = SCPI_SessionFormat(context);
+	int32_t value;
+
+	if (!SCPI_ParamChoice(context, format_border_select, &value, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	format->border = (format_border_t)value;
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_FormatBorderQ(scpi_t * context)
+{
+	format_t* format = SCPI_SessionFormat(context);
+	const char* name;
+
+	SCPI_ChoiceToName(format_border_select, format->border, &name);
+	SCPI_ResultMnemonic(context, name);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// INT16 samples are converted to volts with: value = scale * code + offset
+
+scpi_result_t SCPI_FormatScaleQ(scpi_t * context)
+{
+	float scale, offset;
+
+	ADC_Scale(&scale, &offset);
+
+	SCPI_ResultDouble(context, scale);
+	SCPI_ResultDouble(context, offset);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Significant digits of FORMat ASCii values, sent as d.ddddddE+xx
+
+scpi_result_t SCPI_FormatAsciiPrecision(scpi_t * context)
+{
+	format_t* format = SCPI_SessionFormat(context);
+	scpi_number_t precision;
+
+	if(!SCPI_ParamNumber(context, scpi_special_numbers_def, &precision, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if(precision.special)
+	{
+		switch(precision.content.tag)
+		{
+			case SCPI_NUM_MIN: format->precision = FTOA_PRECISION_MIN; break;
+			case SCPI_NUM_MAX: format->precision = FTOA_PRECISION_MAX; break;
+			case SCPI_NUM_DEF: format->precision = FTOA_PRECISION_DEF; break;
+			default: SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE); return SCPI_RES_ERR;
+		}
+	}
+	else
+	{
+		if((precision.content.value < FTOA_PRECISION_MIN) || (precision.content.value > FTOA_PRECISION_MAX))
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+			return SCPI_RES_ERR;
+		}
+
+		format->precision = (uint8_t)precision.content.value;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_FormatAsciiPrecisionQ(scpi_t * context)
+{
+	SCPI_ResultUInt8(context, SCPI_SessionFormat(context)->precision);
+
+	return SCPI_RES_OK;
+}
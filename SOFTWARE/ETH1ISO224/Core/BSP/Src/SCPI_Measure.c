@@ -15,6 +15,8 @@
 #include "GPIO.h"
 #include "Utility.h"
 #include "HiSLIP.h"
+#include "SCPI_Server.h"
+#include "SCPI_Session.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -29,64 +31,153 @@ extern SemaphoreHandle_t MeasMutex;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static scpi_result_t HISLIP_Result(scpi_t* context, char* str, size_t hislip_size)
+// Session which sent the running INITiate, by id and generation as the connection may be closed before the end
+
+typedef struct
 {
-	hislip_instr_t* hislip_instr = (hislip_instr_t*)context->user_context;
+	uint8_t id;
+	uint32_t generation;
 
-	if(ERR_OK != netconn_write(hislip_instr->netconn.newconn, str,
-			hislip_size, NETCONN_NOCOPY))
-	{
-		return SCPI_RES_ERR;
-	}
+}meas_initiator_t;
 
-	return SCPI_RES_OK;
+static meas_initiator_t meas_initiator;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static scpi_result_t SCPI_ResultASCII(scpi_t * context, float* measurements, uint32_t sample_count)
+{
+	return UTIL_ResultASCII(context, measurements, sample_count);
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static scpi_result_t SCPI_ResultASCII(scpi_t * context, float* measurements, uint32_t sample_count)
+static scpi_result_t SCPI_ResultREAL(scpi_t * context, float* measurements, uint32_t sample_count)
+{
+	util_segment_t segment = {measurements, sample_count * sizeof(float)};
+
+	return UTIL_ResultBlock(context, &segment, 1, UTIL_BlockEncoding(SCPI_SessionFormat(context)));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// With FORMat:BORDer SWAPped the raw codes are already in the wire format and the block is written straight from
+// each memory segment
+
+static scpi_result_t SCPI_ResultINT16(scpi_t * context, uint32_t index, uint32_t sample_count)
+{
+	util_segment_t segments[UTIL_SEGMENTS_MAX];
+	uint32_t count = UTIL_MemorySegments(index, sample_count, segments);
+
+	return UTIL_ResultBlock(context, segments, count, UTIL_BlockEncoding(SCPI_SessionFormat(context)));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static scpi_result_t SCPI_ResultPACKED(scpi_t * context, uint32_t index, uint32_t sample_count)
+{
+	util_segment_t segments[UTIL_SEGMENTS_MAX];
+	uint32_t count = UTIL_MemorySegments(index, sample_count, segments);
+
+	return UTIL_ResultPacked(context, segments, count);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Send count samples of the last acquisition starting at index in the selected FORMat:DATA. Samples beyond
+// measurements[] exist only as raw codes.
+
+static scpi_result_t SCPI_ResultData(scpi_t * context, uint32_t index, uint32_t count)
 {
-	char* str;
-	size_t hislip_size = 0;
-	scpi_result_t result = SCPI_RES_OK;
+	format_t* format = SCPI_SessionFormat(context);
 
-	str = UTIL_FloatArrayToASCII(context, NETCONN_TCP, measurements, sample_count, &hislip_size);
+	if(FORMAT_DATA_INT16 == format->data)
+	{
+		return SCPI_ResultINT16(context, index, count);
+	}
 
-	if(VISA_SCPI_RAW == bsp.resource)
+	if(FORMAT_DATA_PACKED == format->data)
 	{
-		SCPI_ResultCharacters(context, str, strlen(str));
+		return SCPI_ResultPACKED(context, index, count);
 	}
-	else if(VISA_HISLIP == bsp.resource)
+
+	if((index + count) > ADC_MEASUREMENT_BUFFER)
 	{
-		result = HISLIP_Result(context, str, hislip_size);
+		SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+		return SCPI_RES_ERR;
 	}
 
-	return result;
+	ADC_ConvertMeasurements();
+
+	if(FORMAT_DATA_ASCII == format->data)
+	{
+		return SCPI_ResultASCII(context, &measurements[index], count);
+	}
+	else
+	{
+		return SCPI_ResultREAL(context, &measurements[index], count);
+	}
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static scpi_result_t SCPI_ResultREAL(scpi_t * context, float* measurements, uint32_t sample_count)
+// Samples of the last acquisition, all records of a TRIGger:COUNt capture
+
+static uint32_t MEAS_ResultCount(void)
 {
-	char* str;
-	size_t hislip_size = 0;
-	scpi_result_t result = SCPI_RES_OK;
-	uint32_t size = bsp.adc.sample_count * sizeof(float);
+	uint32_t count = ADC_RecordCount() * ADC_RecordSize();
+
+	return (0 != count) ? count : bsp.adc.sample_count;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
 
-	str = UTIL_FloatArrayToREAL(context, NETCONN_TCP, measurements, sample_count, &hislip_size);
+// INT16 and PACKed output only need the raw codes, the conversion to volts is skipped
 
-	if(VISA_SCPI_RAW == bsp.resource)
+static bool MEAS_Acquire(scpi_t * context, uint32_t sample_count)
+{
+	if(FORMAT_DATA_RAW(SCPI_SessionFormat(context)->data))
 	{
-		SCPI_ResultArbitraryBlock(context, str, size);
+		return ADC_MeasurementRaw(sample_count);
 	}
-	else if(VISA_HISLIP == bsp.resource)
+
+	return ADC_Measurement(sample_count);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Take MeasMutex once no INITiate capture is pending. The capture is waited for without the mutex, the other sessions
+// go on meanwhile. -214 when its trigger does not come within ADC_TRIGGER_TIMEOUT.
+
+bool MEAS_TakeIdle(scpi_t * context)
+{
+	for(;;)
 	{
-		result = HISLIP_Result(context, str, hislip_size);
-	}
+		if(!ADC_WaitCapture(ADC_TRIGGER_TIMEOUT))
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_TRIGGER_DEADLOCK);
+			return false;
+		}
 
-	return result;
+		if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+		{
+			return false;
+		}
+
+		// Another session may have started a capture in between
+		if(!ADC_Busy())
+		{
+			return true;
+		}
+
+		xSemaphoreGive(MeasMutex);
+	}
 }
 
 
@@ -94,21 +185,18 @@ static scpi_result_t SCPI_ResultREAL(scpi_t * context, float* measurements, uint
 
 scpi_result_t SCPI_MeasureQ(scpi_t * context)
 {
+	// A capture longer than measurements[] can only be read as raw codes
+	if(!FORMAT_DATA_RAW(SCPI_SessionFormat(context)->data) && (bsp.adc.sample_count > ADC_MEASUREMENT_BUFFER))
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+		return SCPI_RES_ERR;
+	}
 
-	if(pdTRUE == xSemaphoreTake(MeasMutex,  pdMS_TO_TICKS(20000)))
+	if(MEAS_TakeIdle(context))
 	{
-		if(ADC_Measurement(bsp.adc.sample_count))
+		if(MEAS_Acquire(context, bsp.adc.sample_count))
 		{
-
-			if(FORMAT_DATA_ASCII == bsp.format.data)
-			{
-				SCPI_ResultASCII(context, measurements, bsp.adc.sample_count);
-
-			}
-			else
-			{
-				SCPI_ResultREAL(context, measurements, bsp.adc.sample_count);
-			}
+			SCPI_ResultData(context, 0, bsp.adc.sample_count);
 
 			xSemaphoreGive(MeasMutex);
 			return SCPI_RES_OK;
@@ -133,17 +221,19 @@ scpi_result_t SCPI_MeasureQ(scpi_t * context)
 
 scpi_result_t SCPI_FetchQ(scpi_t * context)
 {
-	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	if(MEAS_TakeIdle(context))
 	{
-		if(FORMAT_DATA_ASCII == bsp.format.data)
-		{
-			SCPI_ResultASCII(context, measurements, bsp.adc.sample_count);
-		}
-		else
+
+		// In continuous mode the last acquisition is the newest window of the ring
+		if((ADC_MODE_CONTINUOUS == bsp.adc.mode) && !MEAS_Acquire(context, bsp.adc.sample_count))
 		{
-			SCPI_ResultREAL(context, measurements, bsp.adc.sample_count);
+			xSemaphoreGive(MeasMutex);
+			SCPI_ErrorPush(context, SCPI_ERROR_SYSTEM_ERROR);
+			return SCPI_RES_ERR;
 		}
 
+		SCPI_ResultData(context, 0, MEAS_ResultCount());
+
 		xSemaphoreGive(MeasMutex);
 		return SCPI_RES_OK;
 	}
@@ -157,20 +247,68 @@ scpi_result_t SCPI_FetchQ(scpi_t * context)
 }
 
 
+// --------------------------------------------------------------------------------------------------------------------
+
+static void SCPI_InitiateComplete(bool status, void* arg)
+{
+	meas_initiator_t* initiator = (meas_initiator_t*)arg;
+	scpi_t* context = SCPI_SessionFind(initiator->id, initiator->generation);
+
+	// Called from the ADC task, the task parsing for the session owns the register and error queue
+	if(!status && !ADC_Aborted() && (NULL != context))
+	{
+		SCPI_AddContextError(context, SCPI_ERROR_SYSTEM_ERROR);
+	}
+
+	SCPI_SessionOpcComplete();
+}
+
+
 // --------------------------------------------------------------------------------------------------------------------
 
 scpi_result_t SCPI_Initiate(scpi_t * context)
 {
+	bool status = false;
+
 	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
 	{
-		if(!ADC_Measurement(bsp.adc.sample_count))
+		if(ADC_MODE_CONTINUOUS == bsp.adc.mode)
+		{
+			// The stream is already running, take the newest window right away
+			status = MEAS_Acquire(context, bsp.adc.sample_count);
+		}
+		else if(ADC_Busy())
 		{
 			xSemaphoreGive(MeasMutex);
-			SCPI_ErrorPush(context, SCPI_ERROR_SYSTEM_ERROR);
+			SCPI_ErrorPush(context, SCPI_ERROR_TRIGGER_IGNORED);
 			return SCPI_RES_ERR;
 		}
+		else if(((bsp.adc.sample_count * bsp.trigger.count) > ADC_MEMORY_SAMPLES) ||
+				((TRIGGER_SOURCE_IMMEDIATE != bsp.trigger.source) && (bsp.trigger.position >= bsp.adc.sample_count)))
+		{
+			xSemaphoreGive(MeasMutex);
+			SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+			return SCPI_RES_ERR;
+		}
+		else
+		{
+			// Returns as soon as the DMA is started, completion is reported with *OPC
+			// With INT16 or PACKed output the float conversion is left to the first fetch which needs it
+			meas_initiator.id = SCPI_SessionId(context);
+			meas_initiator.generation = SCPI_SessionGeneration(context);
+
+			status = ADC_Initiate(bsp.adc.sample_count, bsp.trigger.count,
+					!FORMAT_DATA_RAW(SCPI_SessionFormat(context)->data), SCPI_InitiateComplete, &meas_initiator);
+		}
 
 		xSemaphoreGive(MeasMutex);
+
+		if(!status)
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_SYSTEM_ERROR);
+			return SCPI_RES_ERR;
+		}
+
 		return SCPI_RES_OK;
 	}
 	else
@@ -182,19 +320,54 @@ scpi_result_t SCPI_Initiate(scpi_t * context)
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static float MEAS_Average(uint32_t sample_count)
+scpi_result_t SCPI_Opc(scpi_t * context)
 {
-	float average = 0.0f;
-	float tmp = 0.0f;
+	bool pending;
 
-	for (uint32_t i = 0; i < sample_count ; i++)
+	taskENTER_CRITICAL();
+	pending = ADC_Busy();
+	if(pending)
 	{
-		tmp += measurements[i];
+		SCPI_SessionOpcArm(context);
 	}
+	taskEXIT_CRITICAL();
 
-	average = (float)(tmp/sample_count);
+	if(!pending)
+	{
+		SCPI_RegSetBits(context, SCPI_REG_ESR, ESR_OPC);
+	}
 
-	return average;
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_OpcQ(scpi_t * context)
+{
+	if(!ADC_WaitCapture(ADC_TRIGGER_TIMEOUT))
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_TRIGGER_DEADLOCK);
+		return SCPI_RES_ERR;
+	}
+
+	SCPI_ResultInt32(context, 1);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_Wai(scpi_t * context)
+{
+	if(!ADC_WaitCapture(ADC_TRIGGER_TIMEOUT))
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_TRIGGER_DEADLOCK);
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
 }
 
 
@@ -233,7 +406,7 @@ scpi_result_t SCPI_NullOffset(scpi_t * context)
 	uint8_t gain = bsp.adc.gain.value;
 	bool null_offset_state = bsp.adc.offset.enable;
 
-	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	if(MEAS_TakeIdle(context))
 	{
 		HAL_Delay(10);
 		GPIO_DG419(true);
@@ -244,7 +417,7 @@ scpi_result_t SCPI_NullOffset(scpi_t * context)
 		if(ADC_Sample(sample_size))
 		{
 			ADC_SignalConditioningZeroOffset(gain, sample_size);
-			bsp.adc.offset.zero[bsp.adc.gain.index] = -1.0f * MEAS_Average(sample_size);
+			bsp.adc.offset.zero[bsp.adc.gain.index] = -1.0f * ADC_Average();
 			bsp.adc.offset.enable = null_offset_state;
 		}
 		else
@@ -317,33 +490,141 @@ scpi_result_t SCPI_DataDataQ(scpi_t * context)
 		return SCPI_RES_ERR;
 	}
 
-	if (index > bsp.adc.sample_count)
+	if(MEAS_TakeIdle(context))
+	{
+		// Checked with MeasMutex held, a MEASure? of another session may replace the result until then
+		if ((index > MEAS_ResultCount()) || (count > MEAS_ResultCount()) || ((index + count) > MEAS_ResultCount()))
+		{
+			xSemaphoreGive(MeasMutex);
+			SCPI_ErrorPush(context, SCPI_ERROR_INVALID_RANGE);
+			return SCPI_RES_ERR;
+		}
+
+		SCPI_ResultData(context, index, count);
+
+		xSemaphoreGive(MeasMutex);
+		return SCPI_RES_OK;
+	}
+	else
 	{
-		SCPI_ErrorPush(context, SCPI_ERROR_INVALID_RANGE);
 		return SCPI_RES_ERR;
 	}
 
-	if (count > bsp.adc.sample_count)
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// All records of the last acquisition in one block
+
+scpi_result_t SCPI_DataAllQ(scpi_t * context)
+{
+	if(MEAS_TakeIdle(context))
+	{
+
+		SCPI_ResultData(context, 0, MEAS_ResultCount());
+
+		xSemaphoreGive(MeasMutex);
+		return SCPI_RES_OK;
+	}
+	else
 	{
-		SCPI_ErrorPush(context, SCPI_ERROR_INVALID_RANGE);
 		return SCPI_RES_ERR;
 	}
+}
+
 
-	if ((index + count) > bsp.adc.sample_count)
+// --------------------------------------------------------------------------------------------------------------------
+
+// DATA:RECord? <n>, records are numbered from 1
+
+scpi_result_t SCPI_DataRecordQ(scpi_t * context)
+{
+	uint32_t record = 1;
+
+	if(!SCPI_ParamUInt32(context, &record, TRUE))
 	{
-		SCPI_ErrorPush(context, SCPI_ERROR_INVALID_RANGE);
 		return SCPI_RES_ERR;
 	}
 
-	if(pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	if(MEAS_TakeIdle(context))
 	{
-		if(FORMAT_DATA_ASCII == bsp.format.data)
+
+		if((record < 1) || (record > ADC_RecordCount()))
 		{
-			SCPI_ResultASCII(context, &measurements[index], count);
+			xSemaphoreGive(MeasMutex);
+			SCPI_ErrorPush(context, SCPI_ERROR_INVALID_RANGE);
+			return SCPI_RES_ERR;
+		}
+
+		SCPI_ResultData(context, (record - 1) * ADC_RecordSize(), ADC_RecordSize());
+
+		xSemaphoreGive(MeasMutex);
+		return SCPI_RES_OK;
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_DataRecordCountQ(scpi_t * context)
+{
+	if(MEAS_TakeIdle(context))
+	{
+
+		SCPI_ResultUInt32(context, ADC_RecordCount());
+
+		xSemaphoreGive(MeasMutex);
+		return SCPI_RES_OK;
+	}
+	else
+	{
+		return SCPI_RES_ERR;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Start of a record in seconds after the first record, without a record number the times of all records
+
+scpi_result_t SCPI_DataRecordTimeQ(scpi_t * context)
+{
+	uint32_t record = 0;
+	bool single;
+
+	single = SCPI_ParamUInt32(context, &record, FALSE);
+
+	if(!single && SCPI_ParamErrorOccurred(context))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if(MEAS_TakeIdle(context))
+	{
+
+		if(single)
+		{
+			if((record < 1) || (record > ADC_RecordCount()))
+			{
+				xSemaphoreGive(MeasMutex);
+				SCPI_ErrorPush(context, SCPI_ERROR_INVALID_RANGE);
+				return SCPI_RES_ERR;
+			}
+
+			SCPI_ResultDouble(context, ADC_RecordTime(record - 1));
 		}
 		else
 		{
-			SCPI_ResultREAL(context, &measurements[index], count);
+			for(uint32_t i = 0; i < ADC_RecordCount(); i++)
+			{
+				SCPI_ResultDouble(context, ADC_RecordTime(i));
+			}
 		}
 
 		xSemaphoreGive(MeasMutex);
@@ -353,6 +634,4 @@ scpi_result_t SCPI_DataDataQ(scpi_t * context)
 	{
 		return SCPI_RES_ERR;
 	}
-
-	return SCPI_RES_OK;
 }
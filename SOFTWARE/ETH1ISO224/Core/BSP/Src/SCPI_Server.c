@@ -58,10 +58,12 @@
 
 #include "SCPI_Def.h"
 #include "SCPI_Server.h"
+#include "SCPI_Session.h"
 #include "LED.h"
 #include "BSP.h"
 #include "printf.h"
 #include "HiSLIP.h"
+#include "Utility.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -78,17 +80,23 @@ extern bsp_t bsp;
 #define SCPI_MSG_TEST                   1
 #define SCPI_MSG_IO_LISTEN              2
 #define SCPI_MSG_CONTROL_IO_LISTEN      3
-#define SCPI_MSG_IO                     4
 #define SCPI_MSG_CONTROL_IO             5
-#define SCPI_MSG_SET_ESE_REQ            6
-#define SCPI_MSG_SET_ERROR              7
 
 // --------------------------------------------------------------------------------------------------------------------
 
+// Every raw socket client has a worker task which parses its input in a session of its own. The server task only
+// accepts the connections and serves the control port.
+
+typedef struct {
+    struct netconn *io;
+    scpi_session_t *session;
+    TaskHandle_t task;
+} scpi_client_t;
+
 typedef struct {
     struct netconn *io_listen;
     struct netconn *control_io_listen;
-    struct netconn *io;
+    scpi_client_t clients[SCPI_RAW_CLIENTS];
     struct netconn *control_io;
     xQueueHandle evtQueue;
     //FILE * fio;
@@ -105,207 +113,409 @@ typedef struct _queue_event_t queue_event_t;
 
 user_data_t user_data = {
     .io_listen = NULL,
-    .io = NULL,
     .control_io_listen = NULL,
     .control_io = NULL,
     .evtQueue = 0,
 };
 
-// -----------------------------------------------------------------------------------------------------------
+// --------------------------------------------------------------------------------------------------------------------
+
+// Responses are collected in a chain of SCPI_OUT_SEGMENTS segments of one TCP segment each. A segment goes to TCP
+// without a copy when the next write does not fit any more or when libscpi flushes the end of the message, the
+// next segment is filled meanwhile. A segment is filled again once the peer acknowledged it. Writes longer than a
+// segment are sent from where they are.
+//
+// Every segment keeps room for a HiSLIP header in front, a HiSLIP session sends them as Data messages and the last
+// one of a response as DataEnd. No message is longer than the client accepts (AsyncMaximumMessageSize), segments are
+// filled only that far and longer writes are cut into several Data messages. Each session has a chain of its own.
 
-#define SCPI_OUT_DATA_SIZE	64000
-__attribute__ ((section(".SCPI_READOUT_BUF"), used)) static char scpi_out[SCPI_OUT_DATA_SIZE];
+#define SCPI_OUT_SEGMENTS		(TCP_SND_BUF / TCP_MSS)
+#define SCPI_OUT_SEGMENT_SIZE	(TCP_MSS - sizeof(hislip_msg_t))
+#define SCPI_OUT_BUFFER_SIZE	(sizeof(hislip_msg_t) + SCPI_OUT_SEGMENT_SIZE + sizeof(HISLIP_LINE_ENDING))
+
+typedef struct {
+	size_t len;
+	bool busy;						// handed to TCP, see SCPI_OutputFree()
+	struct tcp_pcb* pcb;
+	uint32_t seq;					// sequence number behind the last byte of the segment
+} scpi_segment_t;
+
+typedef struct {
+	scpi_segment_t segments[SCPI_OUT_SEGMENTS];
+	uint32_t current;
+} scpi_output_t;
+
+__attribute__ ((section(".SCPI_READOUT_BUF"), used)) static char scpi_out[SCPI_SESSIONS][SCPI_OUT_SEGMENTS][SCPI_OUT_BUFFER_SIZE] __ALIGNED(4);
+
+static scpi_output_t scpi_output[SCPI_SESSIONS];
 
-static size_t scpi_out_sum = 0;
 
 // --------------------------------------------------------------------------------------------------------------------
 
-size_t SCPI_WriteHiSLIP(scpi_t * context, const char * data, size_t len) {
+static scpi_output_t* SCPI_Output(scpi_t * context, struct netconn ** conn) {
 
-	hislip_instr_t* hislip_instr = (hislip_instr_t*)context->user_context;
+	*conn = NULL;
 
-		if(NULL != hislip_instr)
+	if (NULL != context->user_context)
+	{
+		if (SCPI_SESSION_HISLIP == SCPI_SessionType(context))
 		{
-			uint16_t hs = 0;
+			*conn = ((hislip_instr_t*)context->user_context)->netconn.newconn;
+		}
+		else
+		{
+			*conn = ((scpi_client_t *) context->user_context)->io;
+		}
+	}
 
-			memcpy(&hs,data,sizeof(hs));
-			hs = htons(hs);
+	return &scpi_output[SCPI_SessionId(context)];
+}
 
-			if((len < SCPI_OUT_DATA_SIZE) && (hs != HISLIP_PROLOGUE))
-			{
-				hislip_msg_t msg_tx;
 
-				bool end = ((len == strlen(&context->end[0])) && (!strcmp(data, &context->end[0])));
+// --------------------------------------------------------------------------------------------------------------------
+
+// Payload of the current segment, the HiSLIP header goes in front of it
 
-				if(!end)
-				{
-					memcpy(scpi_out + sizeof(hislip_msg_t) + scpi_out_sum, data, len);
-					scpi_out_sum += len;
-				}
+static char* SCPI_OutputBuffer(scpi_output_t* output) {
 
+	return scpi_out[output - scpi_output][output->current] + sizeof(hislip_msg_t);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
 
-				if(end)
-				{
+// A new session does not send what an earlier one left behind
 
-					hislip_DataHeader(hislip_instr, &msg_tx, HISLIP_DATAEND, scpi_out_sum + strlen(HISLIP_LINE_ENDING));
+void SCPI_OutputReset(scpi_t * context) {
 
-					memcpy(scpi_out, &msg_tx, sizeof(hislip_msg_t));
+	scpi_output_t* output = &scpi_output[SCPI_SessionId(context)];
 
-					memcpy(scpi_out + sizeof(hislip_msg_t) + scpi_out_sum, HISLIP_LINE_ENDING, strlen(HISLIP_LINE_ENDING));
+	output->segments[output->current].len = 0;
+}
 
-					//vTaskDelay(pdMS_TO_TICKS(1));
-					if(ERR_OK != netconn_write(hislip_instr->netconn.newconn, scpi_out,
-							sizeof(hislip_msg_t) + scpi_out_sum + strlen(HISLIP_LINE_ENDING), NETCONN_COPY))
-					{
-						len = 0;
-					}
 
-					scpi_out_sum = 0;
-					memset(scpi_out, 0, SCPI_OUT_DATA_SIZE);
+// --------------------------------------------------------------------------------------------------------------------
 
-				}
-				else if(SCPI_OUT_DATA_SIZE <= scpi_out_sum) // hislip_out full
-				{
+// Largest HiSLIP message payload the client accepts, no limit for the other sessions
 
-					//Should not enter this
-					Error_Handler();
+static size_t SCPI_OutputLimit(scpi_t * context) {
 
-				}
-			}
-			else
+	if ((SCPI_SESSION_HISLIP == SCPI_SessionType(context)) && (NULL != context->user_context))
+	{
+		return ((hislip_instr_t*)context->user_context)->max_msg_size;
+	}
+
+	return SIZE_MAX;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Bytes a segment is filled with, the HiSLIP line end may still be appended to the last one
+
+static size_t SCPI_OutputCapacity(scpi_t * context) {
+
+	size_t limit = SCPI_OutputLimit(context) - strlen(HISLIP_LINE_ENDING);
+
+	return (limit < SCPI_OUT_SEGMENT_SIZE) ? limit : SCPI_OUT_SEGMENT_SIZE;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// True when the peer acknowledged the segment or the connection it was written to is gone. The pcb belongs to the
+// tcpip thread, which may free it at any time, so it is only read with the core locked.
+
+static bool SCPI_OutputFree(scpi_segment_t* segment, struct netconn* conn) {
+
+	bool pending = false;
+
+	if (segment->busy && (NULL != conn))
+	{
+		LOCK_TCPIP_CORE();
+
+		struct tcp_pcb* pcb = conn->pcb.tcp;
+
+		pending = (NULL != pcb) && (segment->pcb == pcb) && (0 != pcb->snd_queuelen)
+				&& ((int32_t) (pcb->lastack - segment->seq) < 0);
+
+		UNLOCK_TCPIP_CORE();
+	}
+
+	if (pending)
+	{
+		return false;
+	}
+
+	segment->busy = false;
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Current segment to write to, NULL when it was not acknowledged within UTIL_ACK_TIMEOUT
+
+static scpi_segment_t* SCPI_OutputSegment(scpi_output_t* output, struct netconn* conn) {
+
+	scpi_segment_t* segment = &output->segments[output->current];
+	uint32_t start = HAL_GetTick();
+
+	while (!SCPI_OutputFree(segment, conn))
+	{
+		if (!UTIL_Timeout(start, UTIL_ACK_TIMEOUT))
+		{
+			return NULL;
+		}
+
+		vTaskDelay(pdMS_TO_TICKS(1));
+	}
+
+	return segment;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Hand the current segment to TCP and continue with the next one. The end of a HiSLIP response has the line end of
+// the message replaced by HISLIP_LINE_ENDING and goes out as DataEnd, even without any data.
+
+static bool SCPI_OutputSend(scpi_t * context, scpi_output_t* output, struct netconn* conn, bool end) {
+
+	scpi_segment_t* segment = &output->segments[output->current];
+	char* data = SCPI_OutputBuffer(output);
+	size_t len = segment->len;
+	bool hislip = (SCPI_SESSION_HISLIP == SCPI_SessionType(context));
+	err_t err = ERR_CONN;
+
+	if ((0 == len) && !(hislip && end))
+	{
+		return true;
+	}
+
+	// Only an empty DataEnd may still find the segment in flight
+	if (NULL == SCPI_OutputSegment(output, conn))
+	{
+		return false;
+	}
+
+	segment->len = 0;
+
+	if (hislip)
+	{
+		hislip_msg_t msg;
+
+		if (end)
+		{
+			size_t end_len = strlen(&context->end[0]);
+
+			if ((len >= end_len) && (0 == memcmp(data + len - end_len, &context->end[0], end_len)))
 			{
-		   		uint32_t loops = len / SCPI_OUT_DATA_SIZE;
-				uint32_t rest = len % SCPI_OUT_DATA_SIZE;
-				uint32_t index = 0;
-
-
-				for (size_t i = 0; i < loops; i++)
-				{
-					//vTaskDelay(pdMS_TO_TICKS(1));
-					if(ERR_OK != netconn_write(hislip_instr->netconn.newconn, data + index,	SCPI_OUT_DATA_SIZE, NETCONN_NOFLAG))
-					{
-						len = 0;
-					}
-					index += SCPI_OUT_DATA_SIZE;
-
-				}
-				if(rest)
-				{
-					//vTaskDelay(pdMS_TO_TICKS(1));
-					if(ERR_OK != netconn_write(hislip_instr->netconn.newconn, data + index,	rest, NETCONN_NOFLAG))
-					{
-						len = 0;
-					}
-				}
+				len -= end_len;
 			}
+
+			memcpy(data + len, HISLIP_LINE_ENDING, strlen(HISLIP_LINE_ENDING));
+			len += strlen(HISLIP_LINE_ENDING);
 		}
 
-	    return len;
+		hislip_DataHeader((hislip_instr_t*)context->user_context, &msg, end ? HISLIP_DATAEND : HISLIP_DATA, len);
+
+		data -= sizeof(hislip_msg_t);
+		len += sizeof(hislip_msg_t);
+		memcpy(data, &msg, sizeof(hislip_msg_t));
+	}
+
+	if (NULL != conn)
+	{
+		// RAM_D3 is cacheable, the Ethernet DMA reads the segment from memory
+		UTIL_CleanDCache(data, len);
+
+		err = netconn_write(conn, data, len, NETCONN_NOCOPY | (end ? 0 : NETCONN_MORE));
+
+		// Even a failed write may have queued a part of the segment
+		LOCK_TCPIP_CORE();
+
+		if (NULL != conn->pcb.tcp)
+		{
+			segment->busy = true;
+			segment->pcb = conn->pcb.tcp;
+			segment->seq = conn->pcb.tcp->snd_lbb;
+		}
+
+		UNLOCK_TCPIP_CORE();
+	}
+
+	output->current = (output->current + 1) % SCPI_OUT_SEGMENTS;
+
+	return (ERR_OK == err);
 }
 
 
-// -----------------------------------------------------------------------------------------------------------
+// --------------------------------------------------------------------------------------------------------------------
 
-size_t SCPI_Write(scpi_t * context, const char * data, size_t len) {
+// Data written behind what is pending without a segment. A HiSLIP session sends it as Data messages of at most
+// SCPI_OutputLimit() bytes, each one as soon as TCP takes it.
 
-    if (context->user_context != NULL)
-    {
-    	user_data_t * u = (user_data_t *) (context->user_context);
+static bool SCPI_OutputData(scpi_t * context, const void * data, size_t len, bool in_place) {
 
-    	if(len < SCPI_OUT_DATA_SIZE)
-    	{
-			bool end = ((len == strlen(&context->end[0])) && (!strcmp(data, &context->end[0])));
+	struct netconn* conn;
+	scpi_output_t* output = SCPI_Output(context, &conn);
+	bool hislip = (SCPI_SESSION_HISLIP == SCPI_SessionType(context));
+	size_t limit = SCPI_OutputLimit(context);
+	const char* part = (const char*) data;
 
-			memcpy(scpi_out + scpi_out_sum, data, len);
-			scpi_out_sum += len;
+	if (!SCPI_OutputSend(context, output, conn, false) || (NULL == conn))
+	{
+		return false;
+	}
 
-			if(end)
-			{
+	while (0 != len)
+	{
+		size_t part_len = (len < limit) ? len : limit;
+		err_t err;
 
-				//vTaskDelay(pdMS_TO_TICKS(1));
-				if(ERR_OK != netconn_write(u->io, scpi_out,	scpi_out_sum, NETCONN_COPY))
-				{
-					len = 0;
-				}
+		if (hislip)
+		{
+			hislip_msg_t msg;
 
-				scpi_out_sum = 0;
-				memset(scpi_out,0, SCPI_OUT_DATA_SIZE);
+			hislip_DataHeader((hislip_instr_t*)context->user_context, &msg, HISLIP_DATA, part_len);
 
-			}
-			else if(SCPI_OUT_DATA_SIZE < scpi_out_sum) // hislip_out full
+			if (ERR_OK != netconn_write(conn, &msg, sizeof(hislip_msg_t), NETCONN_COPY | NETCONN_MORE))
 			{
+				return false;
+			}
+		}
 
-				//vTaskDelay(pdMS_TO_TICKS(1));
-				if(ERR_OK != netconn_write(u->io, scpi_out,	scpi_out_sum, NETCONN_COPY))
-				{
-					len = 0;
-				}
+		err = in_place ? UTIL_NetconnWriteInPlace(conn, part, part_len, NETCONN_MORE) :
+				netconn_write(conn, part, part_len, NETCONN_COPY | NETCONN_MORE);
 
-				scpi_out_sum = 0;
-				memset(scpi_out,0, SCPI_OUT_DATA_SIZE);
+		if (ERR_OK != err)
+		{
+			return false;
+		}
 
-				//Should not enter this
-				//Error_Handler();
+		part += part_len;
+		len -= part_len;
+	}
 
-			}
+	return true;
+}
 
-    	}
-    	else
-    	{
-    		uint32_t loops = len / SCPI_OUT_DATA_SIZE;
-    		uint32_t rest = len % SCPI_OUT_DATA_SIZE;
-    		uint32_t index = 0;
 
-    		if(scpi_out_sum)
-    		{
-				//vTaskDelay(pdMS_TO_TICKS(1));
-				if(ERR_OK != netconn_write(u->io, scpi_out,	scpi_out_sum, NETCONN_COPY))
-				{
-					len = 0;
-				}
+// --------------------------------------------------------------------------------------------------------------------
 
-				scpi_out_sum = 0;
-				memset(scpi_out,0, SCPI_OUT_DATA_SIZE);
+// Data longer than a segment is written in place behind what is pending. The call returns once the peer acknowledged
+// it, the caller may change the data afterwards.
 
-    		}
+static bool SCPI_OutputDirect(scpi_t * context, const void * data, size_t len) {
 
-    		for (size_t i = 0; i < loops; i++)
-    		{
-				//vTaskDelay(pdMS_TO_TICKS(1));
-				if(ERR_OK != netconn_write(u->io, data + index,	SCPI_OUT_DATA_SIZE, NETCONN_NOFLAG))
-				{
-					len = 0;
-				}
-				index += SCPI_OUT_DATA_SIZE;
+	struct netconn* conn;
 
-    		}
-    		if(rest)
-    		{
-				//vTaskDelay(pdMS_TO_TICKS(1));
-				if(ERR_OK != netconn_write(u->io, data + index,	rest, NETCONN_NOFLAG))
-				{
-					len = 0;
-				}
-    		}
-    	}
+	SCPI_Output(context, &conn);
 
-    }
+	if (!SCPI_OutputData(context, data, len, true))
+	{
+		return false;
+	}
+
+	return UTIL_NetconnWaitAcked(conn, UTIL_ACK_TIMEOUT);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// A write which does not fit behind the pending data starts a new segment, the line end libscpi writes last stays
+// in one piece at the tail of the last segment
+
+static size_t SCPI_OutputWrite(scpi_t * context, const char * data, size_t len) {
+
+	struct netconn* conn;
+	scpi_output_t* output = SCPI_Output(context, &conn);
+	scpi_segment_t* segment = &output->segments[output->current];
+	size_t capacity = SCPI_OutputCapacity(context);
+
+	if (len > capacity)
+	{
+		return SCPI_OutputDirect(context, data, len) ? len : 0;
+	}
+
+	if (((segment->len + len) > capacity) && !SCPI_OutputSend(context, output, conn, false))
+	{
+		len = 0;
+	}
+
+	segment = SCPI_OutputSegment(output, conn);
+
+	if (NULL == segment)
+	{
+		return 0;
+	}
+
+	memcpy(SCPI_OutputBuffer(output) + segment->len, data, len);
+	segment->len += len;
+
+	return len;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+size_t SCPI_WriteHiSLIP(scpi_t * context, const char * data, size_t len) {
+
+	return SCPI_OutputWrite(context, data, len);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+size_t SCPI_Write(scpi_t * context, const char * data, size_t len) {
+
+	return SCPI_OutputWrite(context, data, len);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Payload of a block result sent from where it is, see SCPI_OutputDirect()
+
+size_t SCPI_WriteInPlace(scpi_t * context, const void * data, size_t len) {
+
+	// The UDP context copies everything into datagrams anyway
+	if (SCPI_SESSION_UDP == SCPI_SessionType(context))
+	{
+		return context->interface->write(context, (const char *) data, len);
+	}
+
+	return SCPI_OutputDirect(context, data, len) ? len : 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
 
-    return len;
+// Part of a long result handed to TCP right away, the chunk buffer of the caller is reused afterwards
+
+size_t SCPI_WriteChunk(scpi_t * context, const char * data, size_t len) {
+
+	if (SCPI_SESSION_UDP == SCPI_SessionType(context))
+	{
+		return context->interface->write(context, data, len);
+	}
+
+	return SCPI_OutputData(context, data, len, false) ? len : 0;
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
+// libscpi flushes behind the line end of every response, the end of the message
+
 scpi_result_t SCPI_Flush(scpi_t * context) {
-    if (context->user_context != NULL) {
-        user_data_t * u = (user_data_t *) (context->user_context);
-        if (u->io) {
-            /* flush not implemented */
-            return SCPI_RES_OK;
-        }
-    }
-    return SCPI_RES_OK;
+
+	struct netconn* conn;
+	scpi_output_t* output = SCPI_Output(context, &conn);
+
+	return SCPI_OutputSend(context, output, conn, true) ? SCPI_RES_OK : SCPI_RES_ERR;
 }
 
 
@@ -338,11 +548,11 @@ scpi_result_t SCPI_Control(scpi_t * context, scpi_ctrl_name_t ctrl, scpi_reg_val
         iprintf("**CTRL %02x: 0x%X (%d)\r\n", ctrl, val, val);
     }
 
-    if (context->user_context != NULL) {
-        user_data_t * u = (user_data_t *) (context->user_context);
-        if (u->control_io) {
+    // Only raw socket sessions share the control connection, the HiSLIP user_context is a hislip_instr_t
+    if ((SCPI_SESSION_RAW == SCPI_SessionType(context)) && (context->user_context != NULL)) {
+        if (user_data.control_io) {
             snprintf(b, sizeof (b), "SRQ%d\r\n", val);
-            return netconn_write(u->control_io, b, strlen(b), NETCONN_NOCOPY) == ERR_OK ? SCPI_RES_OK : SCPI_RES_ERR;
+            return netconn_write(user_data.control_io, b, strlen(b), NETCONN_NOCOPY) == ERR_OK ? SCPI_RES_OK : SCPI_RES_ERR;
         }
     }
     return SCPI_RES_OK;
@@ -369,42 +579,50 @@ scpi_result_t SCPI_SystemCommTcpipControlQ(scpi_t * context) {
 
 // -----------------------------------------------------------------------------------------------------------
 
-static void setEseReq(void) {
-    SCPI_RegSetBits(&scpi_context, SCPI_REG_ESR, ESR_REQ);
-}
+// The events below come from other tasks. They are posted to the session and applied by the task which parses for
+// it, see SCPI_SessionPost(). The session pointer is read and posted to in one critical section, closeIo() clears it
+// in one before the session goes back to the pool.
 
+void SCPI_RequestControl(void) {
+    for (uint32_t x = 0; x < SCPI_RAW_CLIENTS; x++) {
+        taskENTER_CRITICAL();
 
-// -----------------------------------------------------------------------------------------------------------
+        if (NULL != user_data.clients[x].session) {
+            SCPI_SessionPost(&user_data.clients[x].session->context, ESR_REQ, 0);
+        }
 
-static void setError(int16_t err) {
-    SCPI_ErrorPush(&scpi_context, err);
+        taskEXIT_CRITICAL();
+    }
 }
 
 
 // -----------------------------------------------------------------------------------------------------------
 
-void SCPI_RequestControl(void) {
-    queue_event_t msg;
-    msg.cmd = SCPI_MSG_SET_ESE_REQ;
+void SCPI_AddError(int16_t err) {
+    // Goes to every raw socket session, dropped when no client is connected
+    for (uint32_t x = 0; x < SCPI_RAW_CLIENTS; x++) {
+        taskENTER_CRITICAL();
 
-    /* Avoid sending evtQueue message if ESR_REQ is already set
-    if((SCPI_RegGet(&scpi_context, SCPI_REG_ESR) & ESR_REQ) == 0) {
-        xQueueSend(user_data.evtQueue, &msg, 1000);
-    }
-     */
+        if (NULL != user_data.clients[x].session) {
+            SCPI_SessionPost(&user_data.clients[x].session->context, 0, err);
+        }
 
-    xQueueSend(user_data.evtQueue, &msg, 1000);
+        taskEXIT_CRITICAL();
+    }
 }
 
 
 // -----------------------------------------------------------------------------------------------------------
 
-void SCPI_AddError(int16_t err) {
-    queue_event_t msg;
-    msg.cmd = SCPI_MSG_SET_ERROR;
-    msg.param2 = err;
+void SCPI_AddContextError(scpi_t * context, int16_t err) {
+    SCPI_SessionPost(context, 0, err);
+}
+
+
+// -----------------------------------------------------------------------------------------------------------
 
-    xQueueSend(user_data.evtQueue, &msg, 1000);
+void SCPI_OperationComplete(scpi_t * context) {
+    SCPI_SessionPost(context, ESR_OPC, 0);
 }
 
 
@@ -418,16 +636,18 @@ void scpi_netconn_callback(struct netconn * conn, enum netconn_evt evt, u16_t le
     if (evt == NETCONN_EVT_RCVPLUS)
     {
         msg.cmd = SCPI_MSG_TEST;
-        if (conn == user_data.io) {
-            msg.cmd = SCPI_MSG_IO;
-        } else if (conn == user_data.io_listen) {
+        if (conn == user_data.io_listen) {
             msg.cmd = SCPI_MSG_IO_LISTEN;
         } else if (conn == user_data.control_io) {
             msg.cmd = SCPI_MSG_CONTROL_IO;
         } else if (conn == user_data.control_io_listen) {
             msg.cmd = SCPI_MSG_CONTROL_IO_LISTEN;
         }
-        xQueueSend(user_data.evtQueue, &msg, 1000);
+
+        // The client connections inherit the callback, their workers block in netconn_recv() instead
+        if (msg.cmd != SCPI_MSG_TEST) {
+            xQueueSend(user_data.evtQueue, &msg, 1000);
+        }
     }
 }
 
@@ -470,16 +690,29 @@ static void waitServer(user_data_t * user_data, queue_event_t * evt) {
 
 static int processIoListen(user_data_t * user_data) {
     struct netconn *newconn;
+    scpi_client_t *client = NULL;
 
     if (netconn_accept(user_data->io_listen, &newconn) == ERR_OK) {
-        if (user_data->io) {
-            // Close unwanted connection
+        for (uint32_t x = 0; x < SCPI_RAW_CLIENTS; x++) {
+            if (NULL == user_data->clients[x].io) {
+                client = &user_data->clients[x];
+                break;
+            }
+        }
+
+        if (NULL != client) {
+            client->session = SCPI_SessionOpen(SCPI_SESSION_RAW, client);
+        }
+
+        if ((NULL == client) || (NULL == client->session)) {
+            // Close unwanted connection, all workers or sessions taken
             netconn_close(newconn);
             netconn_delete(newconn);
         } else {
-            // connection established
+            // connection established, the worker takes over
           //  iprintf("***Connection established %s\r\n", inet_ntoa(newconn->pcb.ip->remote_ip));
-            user_data->io = newconn;
+            client->io = newconn;
+            xTaskNotifyGive(client->task);
         }
     }
 
@@ -509,11 +742,18 @@ static int processSrqIoListen(user_data_t * user_data) {
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static void closeIo(user_data_t * user_data) {
-    // connection closed
-    netconn_close(user_data->io);
-    netconn_delete(user_data->io);
-    user_data->io = NULL;
+static void closeIo(scpi_client_t * client) {
+    // connection closed, the session goes back to the pool and the worker to processIoListen()
+    scpi_session_t * session = client->session;
+
+    taskENTER_CRITICAL();
+    client->session = NULL;
+    taskEXIT_CRITICAL();
+
+    SCPI_SessionClose(session);
+    netconn_close(client->io);
+    netconn_delete(client->io);
+    client->io = NULL;
     iprintf("***Connection closed\r\n");
 }
 
@@ -533,7 +773,7 @@ static void closeSrqIo(user_data_t * user_data) {
 #define LED_START	0
 #define LED_STOP	1
 
-static void scpi_LED(uint8_t status)
+static void scpi_LED(scpi_t * context, uint8_t status)
 {
 	if(LED_START == status)
 	{
@@ -544,7 +784,7 @@ static void scpi_LED(uint8_t status)
 	}
 	else if(LED_STOP == status)
 	{
-        if(scpi_context.cmd_error)
+        if(context->cmd_error)
         {
         	if(bsp.led)
         		LED_osQueue(RED);
@@ -565,12 +805,13 @@ static void scpi_LED(uint8_t status)
 
 #define BUF_SIZE	2048
 
-static int processIo(user_data_t * user_data) {
+static int processIo(scpi_client_t * client) {
     struct netbuf *inbuf;
     char buf[BUF_SIZE];
     u16_t buflen;
     void* data;
 	char* end;
+	scpi_t* context = &client->session->context;
 
     memset(buf, 0, BUF_SIZE);
 
@@ -578,10 +819,10 @@ static int processIo(user_data_t * user_data) {
     // SCPI_LINE_ENDING
 
 
-    if (netconn_recv(user_data->io, &inbuf) != ERR_OK) {
+    if (netconn_recv(client->io, &inbuf) != ERR_OK) {
         goto fail1;
     }
-    if (netconn_err(user_data->io) != ERR_OK) {
+    if (netconn_err(client->io) != ERR_OK) {
         goto fail2;
     }
 
@@ -593,7 +834,7 @@ static int processIo(user_data_t * user_data) {
     	static const char* ends[3] = {LINE_ENDING_CR, LINE_ENDING_LF, LINE_ENDING_CRLF};
 
     	u8_t index = 0;
-    	scpi_LED(LED_START);
+    	scpi_LED(context, LED_START);
 
     	for(u8_t i = 0; i < 3; i++)
     	{
@@ -611,8 +852,8 @@ static int processIo(user_data_t * user_data) {
     		memcpy(end, SCPI_LINE_ENDING, strlen(SCPI_LINE_ENDING));
     		buflen = end - buf + strlen(SCPI_LINE_ENDING);
 
-    		memset(&scpi_context.end[0], 0, sizeof(scpi_context.end));
-    		memcpy(&scpi_context.end[0], ends[index], strlen(ends[index]));
+    		memset(&context->end[0], 0, sizeof(context->end));
+    		memcpy(&context->end[0], ends[index], strlen(ends[index]));
 
     	}
     	else
@@ -620,16 +861,14 @@ static int processIo(user_data_t * user_data) {
     		memcpy(buf + buflen, SCPI_LINE_ENDING, strlen(SCPI_LINE_ENDING));
     		buflen += strlen(SCPI_LINE_ENDING);
 
-    		memset(&scpi_context.end[0], 0, sizeof(scpi_context.end));
-    		memcpy(&scpi_context.end[0], LINE_ENDING_LF, strlen(LINE_ENDING_LF));
+    		memset(&context->end[0], 0, sizeof(context->end));
+    		memcpy(&context->end[0], LINE_ENDING_LF, strlen(LINE_ENDING_LF));
 
     	}
 
-    	bsp.resource = VISA_SCPI_RAW;
-
-   		SCPI_Input(&scpi_context, buf, buflen);
+   		SCPI_Input(context, buf, buflen);
 
-   		scpi_LED(LED_STOP);
+   		scpi_LED(context, LED_STOP);
 
     }
     else
@@ -644,7 +883,7 @@ static int processIo(user_data_t * user_data) {
 fail2:
     netbuf_delete(inbuf);
 fail1:
-    closeIo(user_data);
+    closeIo(client);
 
     return 0;
 }
@@ -694,27 +933,12 @@ static void scpi_server_thread(void *arg) {
 
     user_data.evtQueue = xQueueCreate(10, sizeof (queue_event_t));
 
-    // user_context will be pointer to socket
-    SCPI_Init(&scpi_context,
-            scpi_commands,
-            &scpi_interface,
-            scpi_units_def,
-            SCPI_IDN1, SCPI_IDN2, bsp.eeprom.structure.info.serial_number, SCPI_IDN4,
-            scpi_input_buffer, SCPI_INPUT_BUFFER_LENGTH,
-            scpi_error_queue_data, SCPI_ERROR_QUEUE_SIZE);
-
-    scpi_context.user_context = &user_data;
-
     user_data.io_listen = createServer(bsp.scpi_raw.tcp_port);
-    //user_data.control_io_listen = createServer(CONTROL_PORT);
+    user_data.control_io_listen = createServer(CONTROL_PORT);
 
     while (1) {
         waitServer(&user_data, &evt);
 
-        if (evt.cmd == SCPI_MSG_TIMEOUT) { // timeout
-            SCPI_Input(&scpi_context, NULL, 0);
-        }
-
         if ((user_data.io_listen != NULL) && (evt.cmd == SCPI_MSG_IO_LISTEN)) {
             processIoListen(&user_data);
         }
@@ -723,36 +947,51 @@ static void scpi_server_thread(void *arg) {
             processSrqIoListen(&user_data);
         }
 
-        if ((user_data.io != NULL) && (evt.cmd == SCPI_MSG_IO)) {
-            processIo(&user_data);
-        }
-
         if ((user_data.control_io != NULL) && (evt.cmd == SCPI_MSG_CONTROL_IO)) {
             processSrqIo(&user_data);
         }
 
-        if (evt.cmd == SCPI_MSG_SET_ESE_REQ) {
-            setEseReq();
-        }
-
-        if (evt.cmd == SCPI_MSG_SET_ERROR) {
-            setError(evt.param2);
-        }
-
     }
 
     vTaskDelete(NULL);
 }
 
 
+// --------------------------------------------------------------------------------------------------------------------
+
+// Parses the input of one raw socket client, the session was opened by processIoListen()
+
+static void scpi_client_thread(void *arg) {
+    scpi_client_t * client = (scpi_client_t *) arg;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (client->io != NULL) {
+            processIo(client);
+        }
+    }
+}
+
+
 // --------------------------------------------------------------------------------------------------------------------
 
 TaskHandle_t scpi_handler;
 uint32_t scpi_buffer[DEFAULT_THREAD_STACKSIZE];
 StaticTask_t scpi_control_block;
 
+static uint32_t scpi_client_buffer[SCPI_RAW_CLIENTS][DEFAULT_THREAD_STACKSIZE];
+static StaticTask_t scpi_client_control_block[SCPI_RAW_CLIENTS];
+
 void SCPI_CreateTask(void) {
 
+	for (uint32_t x = 0; x < SCPI_RAW_CLIENTS; x++)
+	{
+		user_data.clients[x].task = xTaskCreateStatic(scpi_client_thread, "scpi_Client",
+				DEFAULT_THREAD_STACKSIZE, (void*)&user_data.clients[x], tskIDLE_PRIORITY + 2,
+				scpi_client_buffer[x], &scpi_client_control_block[x]);
+	}
+
 	scpi_handler = xTaskCreateStatic(scpi_server_thread, "scpi_Task",
 			DEFAULT_THREAD_STACKSIZE, (void*)1, tskIDLE_PRIORITY + 2,
 			scpi_buffer, &scpi_control_block);
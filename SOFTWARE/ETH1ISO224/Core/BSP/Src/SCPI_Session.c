@@ -0,0 +1,402 @@
+/*
+ * SCPI_Session.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: grzegorz
+ */
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "cmsis_os.h"
+
+#include "SCPI_Session.h"
+#include "SCPI_Server.h"
+#include "FloatToString.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+extern bsp_t bsp;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Every connection parses into a session of its own, taken from the pool when it is accepted and given back when it
+// is closed. Input buffer, error queue, status registers, output segments and FORMat settings are not shared, the
+// acquisition settings in bsp and the sample memory are (MeasMutex).
+//
+// There is no copy of the last measurement per session, up to ADC_MEMORY_SAMPLES codes do not fit twice. All sessions
+// read the one result in the sample memory: a response always comes from one acquisition, as the readers hold
+// MeasMutex while they send, but the next INITiate or MEASure? of any session replaces it. A session which has to
+// read its own acquisition takes SYSTem:LOCK, the others can still read it but not start another one.
+
+static scpi_session_t scpi_sessions[SCPI_SESSIONS];
+
+// Session which got SYSTem:LOCK:REQuest?, the others can still query and read the last acquisition but neither change
+// a setting nor start a new acquisition. Never the UDP session: every sender to the UDP port shares it, a lock held
+// by it would keep nobody out.
+static scpi_session_t* scpi_lock_owner = NULL;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static scpi_interface_t* SCPI_SessionInterface(scpi_session_type_t type)
+{
+	switch(type)
+	{
+		case SCPI_SESSION_HISLIP: return &scpi_hislip_interface;
+		case SCPI_SESSION_UDP: return &scpi_udp_interface;
+		default: return &scpi_interface;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// NULL when all sessions are in use, the connection has to be refused
+
+scpi_session_t* SCPI_SessionOpen(scpi_session_type_t type, void* user_context)
+{
+	scpi_session_t* session = NULL;
+
+	taskENTER_CRITICAL();
+
+	for(uint32_t x = 0; x < SCPI_SESSIONS; x++)
+	{
+		if(!scpi_sessions[x].used)
+		{
+			session = &scpi_sessions[x];
+			session->used = true;
+			break;
+		}
+	}
+
+	taskEXIT_CRITICAL();
+
+	if(NULL == session)
+	{
+		return NULL;
+	}
+
+	session->type = type;
+	session->generation++;
+	session->opc_pending = false;
+	session->pending_esr = 0;
+	session->pending_count = 0;
+
+	SCPI_Init(&session->context,
+			scpi_commands,
+			SCPI_SessionInterface(type),
+			scpi_units_def,
+			SCPI_IDN1, SCPI_IDN2, bsp.eeprom.structure.info.serial_number, SCPI_IDN4,
+			session->input_buffer, SCPI_INPUT_BUFFER_LENGTH,
+			session->error_queue, SCPI_ERROR_QUEUE_SIZE);
+
+	session->context.user_context = user_context;
+
+	memset(&session->context.end[0], 0, sizeof(session->context.end));
+	memcpy(&session->context.end[0], LINE_ENDING_LF, strlen(LINE_ENDING_LF));
+
+	SCPI_SessionReset(&session->context);
+	SCPI_OutputReset(&session->context);
+
+	return session;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void SCPI_SessionClose(scpi_session_t* session)
+{
+	if(NULL != session)
+	{
+		taskENTER_CRITICAL();
+
+		if(scpi_lock_owner == session)
+		{
+			scpi_lock_owner = NULL;
+		}
+
+		session->opc_pending = false;
+
+		taskEXIT_CRITICAL();
+
+		session->context.user_context = NULL;
+		session->used = false;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Session of an id sent between tasks, NULL when it was closed meanwhile
+
+scpi_session_t* SCPI_SessionGet(uint8_t id)
+{
+	if((id < SCPI_SESSIONS) && scpi_sessions[id].used)
+	{
+		return &scpi_sessions[id];
+	}
+
+	return NULL;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint8_t SCPI_SessionId(scpi_t * context)
+{
+	return (uint8_t)((scpi_session_t*)context - scpi_sessions);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint32_t SCPI_SessionGeneration(scpi_t * context)
+{
+	return ((scpi_session_t*)context)->generation;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Context of a session remembered by id and generation, NULL when that connection was closed meanwhile. A session
+// taken again by a new connection does not get what was meant for the old one.
+
+scpi_t* SCPI_SessionFind(uint8_t id, uint32_t generation)
+{
+	scpi_session_t* session = SCPI_SessionGet(id);
+
+	if((NULL != session) && (generation == session->generation))
+	{
+		return &session->context;
+	}
+
+	return NULL;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// *OPC while an INITiate capture runs, call in the critical section which saw the capture busy
+
+void SCPI_SessionOpcArm(scpi_t * context)
+{
+	((scpi_session_t*)context)->opc_pending = true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// End of the INITiate capture, every session which sent *OPC meanwhile gets ESR_OPC
+
+void SCPI_SessionOpcComplete(void)
+{
+	for(uint32_t x = 0; x < SCPI_SESSIONS; x++)
+	{
+		bool pending;
+
+		taskENTER_CRITICAL();
+		pending = scpi_sessions[x].used && scpi_sessions[x].opc_pending;
+		scpi_sessions[x].opc_pending = false;
+		taskEXIT_CRITICAL();
+
+		if(pending)
+		{
+			SCPI_OperationComplete(&scpi_sessions[x].context);
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_session_type_t SCPI_SessionType(scpi_t * context)
+{
+	return ((scpi_session_t*)context)->type;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+format_t* SCPI_SessionFormat(scpi_t * context)
+{
+	return &((scpi_session_t*)context)->format;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Settings a new connection starts with, also restored by *RST of the session
+
+void SCPI_SessionReset(scpi_t * context)
+{
+	format_t* format = SCPI_SessionFormat(context);
+
+	format->data = FORMAT_DATA_ASCII;
+	format->border = FORMAT_BORDER_NORMAL;
+	format->precision = FTOA_PRECISION_DEF;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// ESR bits and an error (0 for none) raised by another task, e.g. the ADC task at the end of an INITiate. The error
+// queue and the registers of a session are only changed by the task which parses for it, the next command of the
+// session applies them (SCPI_SessionDeliver). An error is dropped when SCPI_SESSION_EVENTS are pending already.
+
+void SCPI_SessionPost(scpi_t * context, scpi_reg_val_t esr, int16_t err)
+{
+	scpi_session_t* session = (scpi_session_t*)context;
+
+	taskENTER_CRITICAL();
+
+	session->pending_esr |= esr;
+
+	if((0 != err) && (session->pending_count < SCPI_SESSION_EVENTS))
+	{
+		session->pending_errors[session->pending_count++] = err;
+	}
+
+	taskEXIT_CRITICAL();
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void SCPI_SessionDeliver(scpi_session_t* session)
+{
+	int16_t errors[SCPI_SESSION_EVENTS];
+	scpi_reg_val_t esr;
+	uint8_t count;
+
+	taskENTER_CRITICAL();
+
+	esr = session->pending_esr;
+	count = session->pending_count;
+	memcpy(errors, session->pending_errors, sizeof(errors));
+	session->pending_esr = 0;
+	session->pending_count = 0;
+
+	taskEXIT_CRITICAL();
+
+	for(uint8_t x = 0; x < count; x++)
+	{
+		SCPI_ErrorPush(&session->context, errors[x]);
+	}
+
+	if(0 != esr)
+	{
+		SCPI_RegSetBits(&session->context, SCPI_REG_ESR, esr);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Called by the parser before every command of every session, see scpi_interface_t.command. Events posted for the
+// session are applied first, *ESR? and SYSTem:ERRor? see them.
+
+scpi_result_t SCPI_SessionCommand(scpi_t * context)
+{
+	scpi_session_t* owner = scpi_lock_owner;
+	int32_t tag = SCPI_CmdTag(context);
+	const char* pattern = context->param_list.cmd->pattern;
+	bool query = ('?' == pattern[strlen(pattern) - 1]);
+
+	SCPI_SessionDeliver((scpi_session_t*)context);
+
+	if((NULL == owner) || (&owner->context == context) || (tag & SCPI_TAG_UNLOCKED))
+	{
+		return SCPI_RES_OK;
+	}
+
+	if(query && !(tag & SCPI_TAG_LOCKED))
+	{
+		return SCPI_RES_OK;
+	}
+
+	SCPI_ErrorPush(context, SCPI_ERROR_COMMAND_PROTECTED);
+	return SCPI_RES_ERR;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// 1 when the session holds the lock now, 0 when another one has it. -203 Command protected over UDP.
+
+scpi_result_t SCPI_SystemLockRequestQ(scpi_t * context)
+{
+	scpi_session_t* session = (scpi_session_t*)context;
+	bool granted = false;
+
+	if(SCPI_SESSION_UDP == SCPI_SessionType(context))
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_COMMAND_PROTECTED);
+		return SCPI_RES_ERR;
+	}
+
+	taskENTER_CRITICAL();
+
+	if((NULL == scpi_lock_owner) || (session == scpi_lock_owner))
+	{
+		scpi_lock_owner = session;
+		granted = true;
+	}
+
+	taskEXIT_CRITICAL();
+
+	SCPI_ResultBool(context, granted);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_SystemLockRelease(scpi_t * context)
+{
+	bool foreign = false;
+
+	taskENTER_CRITICAL();
+
+	if((scpi_session_t*)context == scpi_lock_owner)
+	{
+		scpi_lock_owner = NULL;
+	}
+	else
+	{
+		foreign = (NULL != scpi_lock_owner);
+	}
+
+	taskEXIT_CRITICAL();
+
+	if(foreign)
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_COMMAND_PROTECTED);
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Interface of the session holding the lock, NONE when nobody has it
+
+scpi_result_t SCPI_SystemLockOwnerQ(scpi_t * context)
+{
+	static const char* owners[] = {"SOCKET", "HISLIP", "UDP"};
+	scpi_session_t* owner = scpi_lock_owner;
+
+	if(NULL == owner)
+	{
+		SCPI_ResultMnemonic(context, "NONE");
+	}
+	else
+	{
+		SCPI_ResultMnemonic(context, owners[owner->type]);
+	}
+
+	return SCPI_RES_OK;
+}
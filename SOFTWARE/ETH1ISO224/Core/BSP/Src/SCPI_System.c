@@ -10,6 +10,7 @@
 #include "printf.h"
 #include "LED.h"
 #include "DEVICE_INFO.h"
+#include "UDP.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -405,6 +406,93 @@ scpi_result_t SCPI_SystemCommunicationLanUpdate(scpi_t *context) {
 }
 
 
+// --------------------------------------------------------------------------------------------------------------------
+
+// Stream the continuous acquisition to a multicast group (224.0.0.0 - 239.255.255.255), every receiver joined to
+// the group gets the same datagrams. "0.0.0.0" or port 0 stops it. Not stored in the EEPROM.
+
+scpi_result_t SCPI_SystemCommunicateUdpMulticast(scpi_t *context) {
+	char str[16] = { 0 };
+	uint8_t numb[4] = { 0 };
+	size_t len = 0;
+	uint32_t port = 0;
+	ip_addr_t group;
+
+	if (!SCPI_ParamCopyText(context, (char*) str, 16, &len, TRUE)) {
+		return SCPI_RES_ERR;
+	}
+
+	if (!SCPI_ParamUInt32(context, &port, TRUE)) {
+		return SCPI_RES_ERR;
+	}
+
+	switch (SCPI_StringToIp4Array(str, numb)) {
+	case NET_STR_OK:
+		break;
+	case NET_STR_WRONG_FORMAT:
+		SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+		return SCPI_RES_ERR;
+	default:
+		SCPI_ErrorPush(context, SCPI_ERROR_NUMERIC_DATA_NOT_ALLOWED);
+		return SCPI_RES_ERR;
+	}
+
+	if (port > ETH_PORT_MAX_VAL) {
+		SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+		return SCPI_RES_ERR;
+	}
+
+	IP4_ADDR(ip_2_ip4(&group), numb[0], numb[1], numb[2], numb[3]);
+
+	if (!ip_addr_isany_val(group) && !ip_addr_ismulticast(&group)) {
+		SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+		return SCPI_RES_ERR;
+	}
+
+	UDP_Multicast(&group, ip_addr_isany_val(group) ? 0 : (uint16_t) port);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_SystemCommunicateUdpMulticastQ(scpi_t *context) {
+	char str[16] = { 0 };
+
+	sprintf(str, "%d.%d.%d.%d", ip4_addr1(ip_2_ip4(&bsp.udp_multicast.group)),
+			ip4_addr2(ip_2_ip4(&bsp.udp_multicast.group)), ip4_addr3(ip_2_ip4(&bsp.udp_multicast.group)),
+			ip4_addr4(ip_2_ip4(&bsp.udp_multicast.group)));
+
+	SCPI_ResultMnemonic(context, (char* )str);
+	SCPI_ResultUInt32(context, bsp.udp_multicast.port);
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// UDP replies with a sequence header and retransmission of the datagrams a NACK reports missing, see UDP.c
+
+scpi_result_t SCPI_SystemCommunicateUdpReliable(scpi_t *context) {
+	int32_t state;
+
+	if (!SCPI_ParamChoice(context, scpi_boolean_select, &state, TRUE)) {
+		return SCPI_RES_ERR;
+	}
+
+	bsp.udp_client.reliable = (bool) state;
+
+	return SCPI_RES_OK;
+}
+
+
+scpi_result_t SCPI_SystemCommunicateUdpReliableQ(scpi_t *context) {
+	SCPI_ResultBool(context, bsp.udp_client.reliable);
+	return SCPI_RES_OK;
+}
+
+
 // --------------------------------------------------------------------------------------------------------------------
 
 scpi_result_t SCPI_SystemSecureState(scpi_t *context) {
@@ -0,0 +1,263 @@
+/*
+ * SCPI_Trigger.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: BehrensG
+ */
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#include "cmsis_os.h"
+
+#include "SCPI_Trigger.h"
+#include "SCPI_Measure.h"
+#include "BSP.h"
+#include "ADC.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+extern bsp_t bsp;
+extern SemaphoreHandle_t MeasMutex;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_choice_def_t trigger_source_select[] =
+{
+    {"IMMediate", TRIGGER_SOURCE_IMMEDIATE},
+    {"LEVel", TRIGGER_SOURCE_LEVEL},
+    {"BUS", TRIGGER_SOURCE_BUS},
+    SCPI_CHOICE_LIST_END
+};
+
+scpi_choice_def_t trigger_slope_select[] =
+{
+    {"POSitive", TRIGGER_SLOPE_POSITIVE},
+    {"NEGative", TRIGGER_SLOPE_NEGATIVE},
+    SCPI_CHOICE_LIST_END
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Records captured by one INITiate, the product with SAMPle:COUNt is checked when the capture is started
+
+scpi_result_t SCPI_TriggerCount(scpi_t * context)
+{
+	scpi_number_t count;
+
+	if(!SCPI_ParamNumber(context, scpi_special_numbers_def, &count, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if(count.special)
+	{
+		switch(count.content.tag)
+		{
+			case SCPI_NUM_MIN: bsp.trigger.count = 1; break;
+			case SCPI_NUM_MAX: bsp.trigger.count = ADC_RECORDS_MAX; break;
+			case SCPI_NUM_DEF: bsp.trigger.count = 1; break;
+			default: SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE); return SCPI_RES_ERR;
+		}
+	}
+	else
+	{
+		if((count.content.value > ADC_RECORDS_MAX) || (count.content.value < 1))
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+			return SCPI_RES_ERR;
+		}
+
+		bsp.trigger.count = count.content.value;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerCountQ(scpi_t * context)
+{
+	SCPI_ResultUInt32(context, bsp.trigger.count);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Applies to INITiate in single mode, MEASure? and the continuous stream always start immediately
+
+scpi_result_t SCPI_TriggerSource(scpi_t * context)
+{
+	int32_t value;
+
+	if(!SCPI_ParamChoice(context, trigger_source_select, &value, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	bsp.trigger.source = (trigger_source_t)value;
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerSourceQ(scpi_t * context)
+{
+	const char* name;
+
+	SCPI_ChoiceToName(trigger_source_select, bsp.trigger.source, &name);
+	SCPI_ResultMnemonic(context, name);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Level of TRIGger:SOURce LEVel in volts, compared by the analog watchdog of ADC3
+
+scpi_result_t SCPI_TriggerLevel(scpi_t * context)
+{
+	float level;
+
+	if(!SCPI_ParamFloat(context, &level, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	bsp.trigger.level = level;
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerLevelQ(scpi_t * context)
+{
+	SCPI_ResultFloat(context, bsp.trigger.level);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerSlope(scpi_t * context)
+{
+	int32_t value;
+
+	if(!SCPI_ParamChoice(context, trigger_slope_select, &value, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	bsp.trigger.slope = (trigger_slope_t)value;
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerSlopeQ(scpi_t * context)
+{
+	const char* name;
+
+	SCPI_ChoiceToName(trigger_slope_select, bsp.trigger.slope, &name);
+	SCPI_ResultMnemonic(context, name);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Samples of each record before the trigger, has to be below SAMPle:COUNt when the capture is started
+
+scpi_result_t SCPI_TriggerPosition(scpi_t * context)
+{
+	scpi_number_t position;
+
+	if(!SCPI_ParamNumber(context, scpi_special_numbers_def, &position, TRUE))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	if(position.special)
+	{
+		switch(position.content.tag)
+		{
+			case SCPI_NUM_MIN: bsp.trigger.position = 0; break;
+			case SCPI_NUM_MAX: bsp.trigger.position = ADC_MEMORY_SAMPLES - 1; break;
+			case SCPI_NUM_DEF: bsp.trigger.position = 0; break;
+			default: SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE); return SCPI_RES_ERR;
+		}
+	}
+	else
+	{
+		if((position.content.value > (ADC_MEMORY_SAMPLES - 1)) || (position.content.value < 0))
+		{
+			SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+			return SCPI_RES_ERR;
+		}
+
+		bsp.trigger.position = position.content.value;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_TriggerPositionQ(scpi_t * context)
+{
+	SCPI_ResultUInt32(context, bsp.trigger.position);
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// *TRG starts a capture as before, with TRIGger:SOURce BUS it triggers the capture which waits for it
+
+scpi_result_t SCPI_TriggerImmediate(scpi_t * context)
+{
+	if(TRIGGER_SOURCE_BUS != bsp.trigger.source)
+	{
+		return SCPI_Initiate(context);
+	}
+
+	if(!ADC_TriggerBus())
+	{
+		SCPI_ErrorPush(context, SCPI_ERROR_TRIGGER_IGNORED);
+		return SCPI_RES_ERR;
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// A pending INITiate capture does not hold MeasMutex, it is aborted as soon as no other session reads or measures
+
+scpi_result_t SCPI_Abort(scpi_t * context)
+{
+	if(pdTRUE != xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000)))
+	{
+		return SCPI_RES_ERR;
+	}
+
+	ADC_Abort();
+
+	xSemaphoreGive(MeasMutex);
+
+	return SCPI_RES_OK;
+}
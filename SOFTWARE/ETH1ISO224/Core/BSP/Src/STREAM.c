@@ -0,0 +1,369 @@
+/*
+ * STREAM.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: grzegorz
+ */
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "cmsis_os.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+
+#include "BSP.h"
+#include "ADC.h"
+#include "STREAM.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+extern bsp_t bsp;
+extern SemaphoreHandle_t MeasMutex;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Every client connected to STREAM_PORT gets the continuous acquisition pushed as frames, a stream_header_t
+// followed by ADC_BLOCK_SIZE raw codes (little endian, volts = FORMat:SCALe? scale * code + offset) per block. The
+// length field counts the bytes behind it. Nothing has to be sent, connecting subscribes and closing ends it.
+//
+// A frame is only written when the send buffer of the connection has room for all of it, otherwise it is dropped
+// and counted (SYSTem:COMMunicate:TCPip:STReam:OVERflow?). A slow client sees a gap in sequence, the acquisition
+// never waits for the network.
+
+#define STREAM_THREAD_STACKSIZE		512
+#define STREAM_CLIENTS				2
+#define STREAM_FRAME_SIZE			(sizeof(stream_header_t) + ADC_BLOCK_SIZE * sizeof(uint16_t))
+
+// A frame of 1.6 kB takes two segments with TCP_MSS 1460. Written behind a partly filled segment its header and
+// codes can spread over three, so three queue entries are reserved.
+#define STREAM_FRAME_SEGMENTS		3
+
+#pragma pack(push, 1)
+
+typedef struct {
+	uint32_t length;		// bytes of the frame behind this field
+	uint32_t sequence;		// block number since the stream start, a gap is a dropped frame
+	uint32_t stream;		// changes whenever the acquisition restarts, sequence starts again at 0
+	uint64_t offset;		// first sample of the block since the stream start
+	uint64_t timestamp;		// microseconds since the first block of the stream when the block was complete
+	uint8_t format;			// format_data_t of the samples, FORMAT_DATA_INT16
+	uint8_t border;			// format_border_t of the samples, FORMAT_BORDER_SWAPPED
+	uint16_t count;			// samples in the frame
+	uint32_t config;		// hash of the acquisition settings, compare before using a known scale and offset
+} stream_header_t;
+
+#pragma pack(pop)
+
+typedef struct {
+	struct netconn *conn;
+	uint32_t stream;
+	uint32_t next;			// next block to send
+	bool timed;				// cycles holds the stamp of a block of this stream
+	uint32_t cycles;		// DWT stamp of the last block sent
+	uint64_t elapsed;		// cycles since the first block
+} stream_client_t;
+
+typedef struct {
+	struct netconn *listen;
+	stream_client_t clients[STREAM_CLIENTS];
+	bool listening;					// the ADC notifies this task about committed blocks
+	uint32_t stream;
+	uint32_t config;
+	uint32_t overflow;				// frames dropped since power up
+} stream_t;
+
+static stream_t stream;
+
+static uint8_t stream_frame[STREAM_FRAME_SIZE] __ALIGNED(4);
+
+// --------------------------------------------------------------------------------------------------------------------
+
+TaskHandle_t stream_handler;
+uint32_t stream_buffer[STREAM_THREAD_STACKSIZE];
+StaticTask_t stream_control_block;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void StartStreamTask(void* argument);
+
+void STREAM_CreateTask(void) {
+	stream_handler = xTaskCreateStatic(StartStreamTask, "stream_Task",
+			STREAM_THREAD_STACKSIZE, NULL, tskIDLE_PRIORITY + 2,
+			stream_buffer, &stream_control_block);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t SCPI_SystemCommTcpipStreamOverflowQ(scpi_t * context) {
+	SCPI_ResultUInt32(context, stream.overflow);
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Runs in the lwIP thread for new connections and received data, the stream task does the rest
+
+static void STREAM_NetconnCallback(struct netconn *conn, enum netconn_evt evt, u16_t len) {
+	if ((NETCONN_EVT_RCVPLUS == evt) && (NULL != stream_handler)) {
+		xTaskNotifyGive(stream_handler);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// FNV-1a over the settings which change the meaning of a code
+
+static uint32_t STREAM_Hash(uint32_t hash, const void* data, size_t len) {
+	const uint8_t* byte = (const uint8_t*) data;
+
+	while (len--) {
+		hash = (hash ^ *byte++) * 16777619UL;
+	}
+
+	return hash;
+}
+
+static uint32_t STREAM_ConfigHash(void) {
+	uint32_t hash = 2166136261UL;
+
+	hash = STREAM_Hash(hash, &bsp.adc.gain.value, sizeof(bsp.adc.gain.value));
+	hash = STREAM_Hash(hash, &bsp.adc.oversampling, sizeof(bsp.adc.oversampling));
+	hash = STREAM_Hash(hash, &bsp.adc.bits, sizeof(bsp.adc.bits));
+	hash = STREAM_Hash(hash, &bsp.adc.sampling_time, sizeof(bsp.adc.sampling_time));
+	hash = STREAM_Hash(hash, &bsp.adc.right_bit_shift, sizeof(bsp.adc.right_bit_shift));
+	hash = STREAM_Hash(hash, &bsp.adc.source, sizeof(bsp.adc.source));
+	hash = STREAM_Hash(hash, &bsp.adc.rate, sizeof(bsp.adc.rate));
+	hash = STREAM_Hash(hash, &bsp.adc.offset, sizeof(bsp.adc.offset));
+	hash = STREAM_Hash(hash, &bsp.iso224, sizeof(bsp.iso224));
+
+	return hash;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void STREAM_Close(stream_client_t* client) {
+	netconn_close(client->conn);
+	netconn_delete(client->conn);
+	client->conn = NULL;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// New clients are taken while there is room, one too many is closed right away. All netconns of the task are non
+// blocking, it must not stall on a single client.
+
+static void STREAM_Accept(void) {
+	struct netconn *conn;
+
+	while (ERR_OK == netconn_accept(stream.listen, &conn)) {
+		netconn_set_nonblocking(conn, 1);
+
+		for (uint32_t x = 0; (NULL != conn) && (x < STREAM_CLIENTS); x++) {
+			if (NULL == stream.clients[x].conn) {
+				memset(&stream.clients[x], 0, sizeof(stream_client_t));
+				stream.clients[x].conn = conn;
+				conn = NULL;
+			}
+		}
+
+		if (NULL != conn) {
+			netconn_close(conn);
+			netconn_delete(conn);
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Anything the client sends is read and dropped, false once it closed the connection
+
+static bool STREAM_Receive(stream_client_t* client) {
+	struct netbuf *buf;
+	err_t err;
+
+	while (ERR_OK == (err = netconn_recv(client->conn, &buf))) {
+		netbuf_delete(buf);
+	}
+
+	return (ERR_WOULDBLOCK == err);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Write one frame or drop it when the send buffer is short, false when the connection is gone
+
+static bool STREAM_Frame(stream_client_t* client, uint32_t block, const adc_stream_block_t* info) {
+	stream_header_t* header = (stream_header_t*) stream_frame;
+	struct tcp_pcb *pcb;
+	bool gone, room = false;
+	size_t written = 0;
+
+	// The tcpip thread owns the pcb and may free it meanwhile, it is only read with the core locked
+	LOCK_TCPIP_CORE();
+	pcb = client->conn->pcb.tcp;
+	gone = (NULL == pcb);
+	if (!gone) {
+		room = (tcp_sndbuf(pcb) >= STREAM_FRAME_SIZE)
+				&& ((tcp_sndqueuelen(pcb) + STREAM_FRAME_SEGMENTS) <= TCP_SND_QUEUELEN);
+	}
+	UNLOCK_TCPIP_CORE();
+
+	if (gone) {
+		return false;
+	}
+
+	if (!room) {
+		stream.overflow++;
+		return true;
+	}
+
+	if (!client->timed) {
+		client->cycles = info->cycles;
+		client->timed = true;
+	}
+
+	client->elapsed += (uint32_t) (info->cycles - client->cycles);
+	client->cycles = info->cycles;
+
+	header->length = STREAM_FRAME_SIZE - sizeof(header->length);
+	header->sequence = block;
+	header->stream = client->stream;
+	header->offset = (uint64_t) info->half * ADC_BLOCK_SIZE;
+	header->timestamp = client->elapsed / (SystemCoreClock / 1000000UL);
+	header->format = FORMAT_DATA_INT16;
+	header->border = FORMAT_BORDER_SWAPPED;
+	header->count = ADC_BLOCK_SIZE;
+	header->config = stream.config;
+
+	memcpy(stream_frame + sizeof(stream_header_t), info->codes, ADC_BLOCK_SIZE * sizeof(uint16_t));
+
+	// The ring wrapped onto the block while it was copied
+	if ((ADC_StreamCommitted() - block) >= ADC_RING_BLOCKS) {
+		stream.overflow++;
+		return true;
+	}
+
+	// There was room for all of it, a part of a frame would break the framing for good
+	if (ERR_OK != netconn_write_partly(client->conn, stream_frame, STREAM_FRAME_SIZE, NETCONN_COPY, &written)) {
+		return false;
+	}
+
+	return (STREAM_FRAME_SIZE == written);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void STREAM_Client(stream_client_t* client, uint32_t id, uint32_t committed) {
+	adc_stream_block_t info;
+
+	if (id != client->stream) {
+		client->stream = id;
+		client->next = 0;
+		client->elapsed = 0;
+		client->timed = false;
+	}
+
+	// Fell more than the ring behind, continue with the oldest block which is still there
+	if ((committed - client->next) >= (ADC_RING_BLOCKS - 1)) {
+		stream.overflow += committed - (ADC_RING_BLOCKS - 2) - client->next;
+		client->next = committed - (ADC_RING_BLOCKS - 2);
+	}
+
+	while ((NULL != client->conn) && (client->next < committed)) {
+		if (ADC_StreamBlock(client->next, &info) && !STREAM_Frame(client, client->next, &info)) {
+			STREAM_Close(client);
+		}
+
+		client->next++;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// True while at least one client is connected. In ACQuire:MODE CONTinuous a stream stopped by a new setting is
+// restarted as soon as nobody else measures. In SINGle mode the sample memory belongs to INITiate and MEASure?, the
+// clients stay connected and get nothing until the mode changes.
+
+static bool STREAM_Service(void) {
+	uint32_t id;
+	uint32_t committed;
+	bool active = false;
+
+	for (uint32_t x = 0; x < STREAM_CLIENTS; x++) {
+		if ((NULL != stream.clients[x].conn) && !STREAM_Receive(&stream.clients[x])) {
+			STREAM_Close(&stream.clients[x]);
+		}
+
+		active |= (NULL != stream.clients[x].conn);
+	}
+
+	if (active != stream.listening) {
+		ADC_StreamListen(xTaskGetCurrentTaskHandle(), active);
+		stream.listening = active;
+	}
+
+	if (!active) {
+		return false;
+	}
+
+	id = ADC_StreamId();
+
+	if (0 == id) {
+		if (pdTRUE == xSemaphoreTake(MeasMutex, 0)) {
+			ADC_StreamResume();
+			xSemaphoreGive(MeasMutex);
+		}
+
+		return true;
+	}
+
+	if (id != stream.stream) {
+		stream.stream = id;
+		stream.config = STREAM_ConfigHash();
+	}
+
+	committed = ADC_StreamCommitted();
+
+	for (uint32_t x = 0; x < STREAM_CLIENTS; x++) {
+		if (NULL != stream.clients[x].conn) {
+			STREAM_Client(&stream.clients[x], id, committed);
+		}
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void StartStreamTask(void* argument) {
+
+	stream.listen = netconn_new_with_callback(NETCONN_TCP, STREAM_NetconnCallback);
+
+	if ((NULL == stream.listen) || (ERR_OK != netconn_bind(stream.listen, IP_ADDR_ANY, STREAM_PORT))
+			|| (ERR_OK != netconn_listen(stream.listen))) {
+		vTaskDelete(NULL);
+	}
+
+	netconn_set_nonblocking(stream.listen, 1);
+
+	for (;;) {
+		STREAM_Accept();
+
+		// Woken by the ADC for every block and by the callback for new clients and received data
+		ulTaskNotifyTake(pdTRUE, STREAM_Service() ? pdMS_TO_TICKS(1) : portMAX_DELAY);
+	}
+}
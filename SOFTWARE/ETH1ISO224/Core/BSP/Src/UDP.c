@@ -15,23 +15,24 @@
 #include "ip_addr.h"
 #include "udp.h"
 #include "api.h"
-#include "scpi/parser.h"
-#include "utils.h"
+#include "scpi/scpi.h"
 
 #include "BSP.h"
-#include "Utility.h"
 #include "LED.h"
 #include "ADC.h"
+#include "UDP.h"
+#include "SCPI_Def.h"
+#include "SCPI_Session.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
 extern bsp_t bsp;
-extern float measurements[];
 extern SemaphoreHandle_t MeasMutex;
 
 // --------------------------------------------------------------------------------------------------------------------
 
 #define UDP_THREAD_STACKSIZE	1024
+#define UDP_QUEUE_LENGTH		4
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -52,28 +53,63 @@ typedef enum {
 	UDP_STATE_ERROR,
 	UDP_STATE_CREATE,
 	UDP_STATE_LISTEN,
-	UDP_STATE_FETCHQ,
-	UDP_STATE_MEASQ,
-	UDP_STATE_INIT,
 	UDP_STATE_CONNECT,
+	UDP_STATE_SCPI,
+	UDP_STATE_NACK,
 	UDP_STATE_IDLE
 
 } udp_task_state_t;
 
+// The datagram is handed to the UDP task, the netconn callback runs in the lwIP thread and may not block
+
 typedef struct {
-	const char *pattern;
 	udp_task_state_t state;
-} _scpi_udp_command_t;
+	struct netbuf *buf;		// UDP_STATE_SCPI and UDP_STATE_NACK, deleted by the UDP task
+} udp_event_t;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// UDP:STReam:SUBScribe pushes every block of the continuous acquisition to the subscriber. A block of
+// ADC_BLOCK_SIZE raw codes (little endian, volts = FORMat:SCALe? scale * code + offset) goes out as
+// UDP_STREAM_PACKETS datagrams, each with a udp_stream_header_t in front and at most 1472 bytes, so there is no IP
+// fragmentation. A gap in block shows datagrams lost on the way or dropped because the device fell behind, a gap in
+// offset samples lost by the acquisition (ADC:ACQuire:OVERrun?).
+//
+// With SYSTem:COMMunicate:UDP:MULTicast set the same datagrams go to the multicast group instead, without a
+// subscription. Every receiver joined to the group gets them from one send, the acquisition and the network load do
+// not grow with the number of receivers.
+//
+// Both only stream in ACQuire:MODE CONTinuous. In SINGle mode the sample memory belongs to INITiate and MEASure?.
 
-#define UDP_CMD_LIST_END       {NULL, UDP_STATE_IDLE}
+#define UDP_STREAM_PACKETS		2
+#define UDP_STREAM_SAMPLES		(ADC_BLOCK_SIZE / UDP_STREAM_PACKETS)
+
+#pragma pack(push, 1)
+
+typedef struct {
+	uint32_t stream;		// changes whenever the acquisition restarts, block and offset start again at 0
+	uint32_t block;			// block sequence number
+	uint16_t packet;		// packet index within the block
+	uint16_t count;			// samples in this packet
+	uint64_t offset;		// first sample of the packet since the stream start
+	uint64_t timestamp;		// microseconds since the first block of the stream when the block was complete
+} udp_stream_header_t;
 
-_scpi_udp_command_t udp_commands[] = {
-		{ .pattern = "UDP:FETCh?", .state =	UDP_STATE_FETCHQ },
-		{ .pattern = "UDP:INITiate[:IMMediate]", .state = UDP_STATE_INIT },
-		{ .pattern = "UDP:READ?", .state = UDP_STATE_MEASQ },
-		{ .pattern = "UDP:MEASure?", .state = UDP_STATE_MEASQ },
-		{ .pattern = "UDP:R?", .state = UDP_STATE_MEASQ },
-		UDP_CMD_LIST_END };
+#pragma pack(pop)
+
+typedef struct {
+	bool subscribed;
+	bool listening;			// the ADC notifies this task about committed blocks
+	ip_addr_t addr;
+	uint16_t port;
+	uint32_t stream;
+	uint32_t next;			// next block to send
+	bool timed;				// cycles holds the stamp of a block of this stream
+	uint32_t cycles;		// DWT stamp of the last block sent
+	uint64_t elapsed;		// cycles since the first block
+} udp_stream_t;
+
+static udp_stream_t udp_stream;
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -95,36 +131,166 @@ void UDP_CreateTask(void) {
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static udp_task_state_t UDP_Match(const char *data, uint16_t len) {
-	udp_task_state_t state = UDP_STATE_ERROR;
-	uint16_t cmd_len;
-	int32_t ws_index;
-	size_t array_size;
-	char cmd[64];
+// The socket stays bound for good, replies are addressed to the client of the last command instead of connecting
+// to it. A connected netconn would drop the commands of every other client.
+
+#define UDP_PACKAGE_SIZE 1440
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// SYSTem:COMMunicate:UDP:RELiable ON puts a udp_reliable_header_t in front of every datagram of a reply and keeps a
+// copy of the last UDP_WINDOW_PACKETS of them. The client answers gaps in the sequence with a udp_nack_t datagram,
+// every set bit of the bitmap asks for datagram base + bit once more. A client which misses the datagram flagged
+// UDP_RELIABLE_LAST asks for the sequences behind the highest one it got, bits without a datagram in the window are
+// ignored. Large replies are sent at full rate, only the lost datagrams cost a round trip.
+
+#define UDP_WINDOW_PACKETS		96
+#define UDP_RELIABLE_LAST		0x0001
+#define UDP_NACK_TAG			"NACK"
+#define UDP_NACK_BITMAP			(UDP_WINDOW_PACKETS / 8)
+
+#pragma pack(push, 1)
+
+typedef struct {
+	uint32_t transfer;		// changes with every reply
+	uint16_t sequence;		// datagram within the reply, from 0
+	uint16_t flags;			// UDP_RELIABLE_LAST on the last datagram of the reply
+} udp_reliable_header_t;
+
+typedef struct {
+	char tag[4];			// UDP_NACK_TAG
+	uint32_t transfer;
+	uint16_t base;			// sequence of bit 0
+	uint8_t bitmap[UDP_NACK_BITMAP];	// LSB first, the datagram may end after any byte
+} udp_nack_t;
+
+#pragma pack(pop)
+
+#define UDP_NACK_HEADER			offsetof(udp_nack_t, bitmap)
+#define UDP_DATAGRAM_MAX		(sizeof(udp_reliable_header_t) + UDP_PACKAGE_SIZE)
+
+typedef struct {
+	uint32_t transfer;
+	uint16_t sequence;
+	uint16_t len;
+	uint8_t data[UDP_DATAGRAM_MAX];
+} udp_window_slot_t;
+
+typedef struct {
+	bool active;			// the reply being sent carries headers
+	uint32_t transfer;
+	uint16_t sequence;
+	ip_addr_t addr;			// client the transfer goes to, the only one whose NACK is answered
+	u16_t port;
+} udp_reliable_t;
 
-	if (len >= 64) {
-		return UDP_STATE_ERROR;
+static udp_reliable_t udp_reliable;
+
+// Read by the CPU only, the AXI SRAM is fine. The spare end of RAM_D2 behind the ETH Rx pool is too small for it.
+static udp_window_slot_t udp_window[UDP_WINDOW_PACKETS];
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Every reply is a new transfer
+
+static void UDP_ReliableBegin(void) {
+	udp_reliable.active = bsp.udp_client.reliable;
+	udp_reliable.transfer++;
+	udp_reliable.sequence = 0;
+	ip_addr_copy(udp_reliable.addr, bsp.udp_client.addr);
+	udp_reliable.port = bsp.udp_client.port;
+}
+
+// Payload of a datagram with room for the header in front
+
+static void* UDP_Alloc(struct netbuf *buf, uint32_t len) {
+	uint8_t *payload;
+
+	if (!udp_reliable.active) {
+		return netbuf_alloc(buf, len);
 	}
 
-	memcpy(cmd, data, len);
+	payload = netbuf_alloc(buf, len + sizeof(udp_reliable_header_t));
 
-	cmd_len = len;
-	ws_index = UTIL_WhiteSpace(cmd, cmd_len);
-	array_size = sizeof(udp_commands) / sizeof(udp_commands[0]);
+	return (NULL != payload) ? (payload + sizeof(udp_reliable_header_t)) : NULL;
+}
+
+// Fill in the header and keep a copy for a NACK before it goes out
 
-	if (-1 < ws_index) {
-		cmd[ws_index] = '\0';
-		cmd_len = strlen(cmd);
+static err_t UDP_Transmit(struct netbuf *buf, bool last) {
+	udp_reliable_header_t header;
+	udp_window_slot_t *slot;
+	void *data;
+	u16_t len;
+
+	if (udp_reliable.active) {
+		header.transfer = udp_reliable.transfer;
+		header.sequence = udp_reliable.sequence++;
+		header.flags = last ? UDP_RELIABLE_LAST : 0;
+
+		netbuf_data(buf, &data, &len);
+		memcpy(data, &header, sizeof(header));
+
+		slot = &udp_window[header.sequence % UDP_WINDOW_PACKETS];
+		slot->transfer = header.transfer;
+		slot->sequence = header.sequence;
+		slot->len = len;
+		memcpy(slot->data, data, len);
 	}
 
-	for (size_t x = 0; x < array_size; x++) {
-		if (TRUE == SCPI_Match(udp_commands[x].pattern, cmd, cmd_len)) {
-			state = udp_commands[x].state;
-			break;
-		}
+	return netconn_sendto(conn, buf, &udp_reliable.addr, udp_reliable.port);
+}
+
+static bool UDP_IsNack(const char *data, uint16_t len) {
+	return (len >= UDP_NACK_HEADER) && (len <= sizeof(udp_nack_t)) && !memcmp(data, UDP_NACK_TAG, 4);
+}
+
+static void UDP_Retransmit(struct netbuf *nack_buf) {
+	udp_nack_t nack;
+	uint16_t len;
+	udp_window_slot_t *slot;
+	struct netbuf *buf;
+	void *payload;
+
+	len = netbuf_copy(nack_buf, &nack, sizeof(nack));
+
+	// Only the current transfer is sent again and only to its own client, a command from another client meanwhile
+	// started a new transfer whose datagrams take over the window slots
+	if ((nack.transfer != udp_reliable.transfer) || (netbuf_fromport(nack_buf) != udp_reliable.port)
+			|| !ip_addr_cmp(netbuf_fromaddr(nack_buf), &udp_reliable.addr)) {
+		return;
 	}
 
-	return state;
+	for (uint32_t bit = 0; bit < (len - UDP_NACK_HEADER) * 8U; bit++) {
+		uint16_t sequence = (uint16_t) (nack.base + bit);
+
+		if (!(nack.bitmap[bit / 8U] & (1U << (bit % 8U)))) {
+			continue;
+		}
+
+		slot = &udp_window[sequence % UDP_WINDOW_PACKETS];
+
+		if ((0 == slot->len) || (slot->transfer != nack.transfer) || (slot->sequence != sequence)) {
+			continue;
+		}
+
+		buf = netbuf_new();
+
+		if (NULL == buf) {
+			return;
+		}
+
+		payload = netbuf_alloc(buf, slot->len);
+
+		if (NULL != payload) {
+			memcpy(payload, slot->data, slot->len);
+			netconn_sendto(conn, buf, &udp_reliable.addr, udp_reliable.port);
+		}
+
+		netbuf_delete(buf);
+	}
 }
 
 
@@ -135,7 +301,7 @@ void UDP_NetconnCallback(struct netconn *conn, enum netconn_evt even, u16_t len)
 	void *data;
 	err_t status;
 	uint16_t udp_len;
-	static udp_task_state_t state;
+	udp_event_t event;
 
 	if (NETCONN_EVT_RCVPLUS == even) {
 
@@ -145,16 +311,15 @@ void UDP_NetconnCallback(struct netconn *conn, enum netconn_evt even, u16_t len)
 			netbuf_delete(buf);
 		} else {
 
-			bsp.udp_client.addr = netbuf_fromaddr(buf); // get the address of the client
-			bsp.udp_client.port = netbuf_fromport(buf); // get the Port of the client
-
 			netbuf_data(buf, &data, &udp_len);
 
-			state = UDP_Match(data, udp_len);
+			event.state = UDP_IsNack(data, udp_len) ? UDP_STATE_NACK : UDP_STATE_SCPI;
+			event.buf = buf;
 
-			netbuf_delete(buf);
-
-			xQueueSend(QueueUDPHandle, &state, portMAX_DELAY);
+			// Dropped like on the wire when the task is that far behind
+			if (pdTRUE != xQueueSend(QueueUDPHandle, &event, 0)) {
+				netbuf_delete(buf);
+			}
 		}
 
 	}
@@ -175,20 +340,24 @@ static err_t UDP_Create() {
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static err_t UDP_Connect() {
-	return netconn_connect(conn, bsp.udp_client.addr, bsp.udp_client.port);
-
-}
+static err_t UDP_Send(const char *data, uint32_t bytes_count, bool last) {
+	struct netbuf *buf;
+	err_t err = ERR_MEM;
+	void *payload;
 
+	buf = netbuf_new();
 
-// --------------------------------------------------------------------------------------------------------------------
+	if (NULL != buf) {
+		payload = UDP_Alloc(buf, bytes_count);
 
-static err_t UDP_Close() {
+		if (NULL != payload) {
+			memcpy(payload, data, bytes_count);
 
-	err_t err;
+			err = UDP_Transmit(buf, last);
+		}
 
-	err = netconn_close(conn);
-	err = netconn_delete(conn);
+		netbuf_delete(buf);
+	}
 
 	return err;
 }
@@ -196,283 +365,276 @@ static err_t UDP_Close() {
 
 // --------------------------------------------------------------------------------------------------------------------
 
-#define UDP_PACKAGE_SIZE 20000
-#define UDP_PACKAGE_MAX_SIZE (UDP_PACKAGE_SIZE + 10)
+// Any SCPI program message sent to the UDP port is parsed in the UDP session by the UDP task. The response is cut
+// into datagrams of UDP_PACKAGE_SIZE, the one with the line end is the last, so
+// "CONF:GAIN 10;:SAMP:COUN 5000;:UDP:READ?" configures and measures with one datagram out and the data back.
+// A message has to fit into one datagram of at most SCPI_INPUT_BUFFER_LENGTH bytes.
 
-typedef enum {
-	ADD_NONE, ADD_HEAD, ADD_TAIL, ADD_HEAD_AND_TAIL
+static char udp_message[SCPI_INPUT_BUFFER_LENGTH];
+static char udp_reply[UDP_PACKAGE_SIZE];
+static size_t udp_reply_sum;
 
-} addon_t;
+// Opened when the task starts, all datagrams share it whoever sent them
+static scpi_session_t* udp_session;
 
+// A full datagram waits for more data, only the flush knows it is the last one
 
-// --------------------------------------------------------------------------------------------------------------------
+size_t UDP_Write(scpi_t * context, const char * data, size_t len) {
+	size_t rest = len;
 
-static err_t UDP_Send(char *data, uint32_t bytes_count, addon_t addon) {
-	struct netbuf *buf;
-	err_t err = ERR_OK;
-	void *payload;
-	char end[2] = { '\n', 0 };
+	while (rest) {
+		size_t part = UDP_PACKAGE_SIZE - udp_reply_sum;
 
-	buf = netbuf_new();
+		if (0 == part) {
+			if (ERR_OK != UDP_Send(udp_reply, udp_reply_sum, false)) {
+				len = 0;
+			}
 
-	if (NULL != buf) {
-		if (ADD_TAIL == addon) {
-			payload = netbuf_alloc(buf, bytes_count + strlen(end));
-		} else {
-			payload = netbuf_alloc(buf, bytes_count);
+			udp_reply_sum = 0;
+			part = UDP_PACKAGE_SIZE;
 		}
 
-		if (NULL != payload) {
-			memcpy(payload, data, bytes_count);
+		part = (rest < part) ? rest : part;
 
-			if (ADD_TAIL == addon)
-				memcpy(payload + bytes_count, end, strlen(end));
+		memcpy(udp_reply + udp_reply_sum, data, part);
+		udp_reply_sum += part;
+		data += part;
+		rest -= part;
+	}
 
-			//vTaskDelay(pdMS_TO_TICKS(1));
-			err = netconn_send(conn, buf);
+	return len;
+}
 
-			netbuf_delete(buf);
-		}
+
+scpi_result_t UDP_Flush(scpi_t * context) {
+	err_t err = ERR_OK;
+
+	if (udp_reply_sum) {
+		err = UDP_Send(udp_reply, udp_reply_sum, true);
+		udp_reply_sum = 0;
 	}
 
-	return err;
+	return (ERR_OK == err) ? SCPI_RES_OK : SCPI_RES_ERR;
 }
 
-/****************** NEW TEST CODE START *********************/
 
-typedef struct {
-	char data[12];
-	uint32_t len;
+// --------------------------------------------------------------------------------------------------------------------
 
-} udp_scpi_header_t;
+static void UDP_Input(struct netbuf *buf) {
+	uint16_t len = netbuf_len(buf);
+	size_t end = strlen(SCPI_LINE_ENDING);
 
-udp_scpi_header_t UDP_ResultArbitraryBlockHeader(uint32_t len) {
-	udp_scpi_header_t header;
+	// Replies go to the sender of the message being processed
+	ip_addr_copy(bsp.udp_client.addr, *netbuf_fromaddr(buf));
+	bsp.udp_client.port = netbuf_fromport(buf);
 
-	memset(&header.data[0], 0, 12);
+	if ((0 == len) || ((len + end) > sizeof(udp_message))) {
+		LED_osQueue(RED);
+		return;
+	}
 
-	header.data[0] = '#';
-	uint32_t tmp_len;
-	SCPI_UInt32ToStrBase(len, header.data + 2, 10, 10);
+	netbuf_copy(buf, udp_message, len);
 
-	tmp_len = strlen(header.data + 2);
+	// A datagram is a complete message, with or without the terminator
+	if ('\n' != udp_message[len - 1]) {
+		memcpy(udp_message + len, SCPI_LINE_ENDING, end);
+		len += end;
+	}
 
-	header.data[1] = (char) (tmp_len + '0');
-	header.len = strlen(header.data);
+	LED_osQueue(BLUE);
 
-	return header;
-}
+	UDP_ReliableBegin();
+	udp_reply_sum = 0;
 
-static err_t UDP_SendV2(char *data, uint32_t bytes_count, addon_t addon) {
-	struct netbuf *buf;
-	err_t err = ERR_OK;
-	void *payload;
-	udp_scpi_header_t start;
-	char end[2] = { '\n', 0 };
+	SCPI_Input(&udp_session->context, udp_message, len);
 
-	uint32_t size = bsp.adc.sample_count * sizeof(float);
+	if (udp_session->context.cmd_error) {
+		LED_osQueue(RED);
+	} else {
+		(bsp.default_cfg) ? LED_osQueue(BLUE) : LED_osQueue(GREEN);
+	}
+}
 
-	buf = netbuf_new();
 
-	if (NULL != buf) {
+// --------------------------------------------------------------------------------------------------------------------
 
-		start = UDP_ResultArbitraryBlockHeader(size);
+static void UDP_Subscribe(bool subscribe) {
+	udp_stream.subscribed = false;
 
-		switch (addon) {
-		case ADD_TAIL:
-			payload = netbuf_alloc(buf, bytes_count + strlen(end));
-			break;
-		case ADD_HEAD:
-			payload = netbuf_alloc(buf, bytes_count + start.len);
-			break;
-		case (ADD_HEAD_AND_TAIL):
-			payload = netbuf_alloc(buf, bytes_count + start.len + strlen(end));
-			break;
-		default:
-			payload = netbuf_alloc(buf, bytes_count);
-			break;
-		}
+	if (subscribe) {
+		ip_addr_copy(udp_stream.addr, bsp.udp_client.addr);
+		udp_stream.port = bsp.udp_client.port;
+		udp_stream.stream = 0;
+		udp_stream.subscribed = true;
+	}
+}
 
-		if (NULL != payload) {
 
-			switch (addon) {
-			case ADD_TAIL:
-				memcpy(payload + bytes_count, end, strlen(end));
-				break;
-			case ADD_HEAD: {
-				memcpy(payload, start.data, start.len);
-				memcpy(payload + start.len, data, bytes_count);
+// --------------------------------------------------------------------------------------------------------------------
 
-			}
-				;
-				break;
-			case (ADD_HEAD_AND_TAIL): {
-				memcpy(payload, start.data, start.len);
-				memcpy(payload + start.len, data, bytes_count);
-				memcpy(payload + start.len + bytes_count, end, strlen(end));
+// The subscriber is the sender of the command, only known on the UDP port
 
-			}
-				;
-				break;
-			default:
-				memcpy(payload, data, bytes_count);
-				break;
-			}
+scpi_result_t SCPI_UdpStreamSubscribe(scpi_t * context) {
+	if (SCPI_SESSION_UDP != SCPI_SessionType(context)) {
+		SCPI_ErrorPush(context, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_RES_ERR;
+	}
 
-			//vTaskDelay(pdMS_TO_TICKS(1));
-			err = netconn_send(conn, buf);
+	UDP_Subscribe(true);
+	return SCPI_RES_OK;
+}
 
-			netbuf_delete(buf);
-		}
+
+scpi_result_t SCPI_UdpStreamUnsubscribe(scpi_t * context) {
+	if (SCPI_SESSION_UDP != SCPI_SessionType(context)) {
+		SCPI_ErrorPush(context, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_RES_ERR;
 	}
 
-	return err;
+	UDP_Subscribe(false);
+	return SCPI_RES_OK;
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static err_t UDP_SendREAL() {
-	char *tx;
-	uint32_t sample_count = bsp.adc.sample_count;
-	uint32_t size, loop, rest, index;
-	addon_t addon = ADD_NONE;
-	err_t err;
-
-	tx = UTIL_FloatArrayToREAL(NULL, NETCONN_UDP, &measurements[0], sample_count, NULL);
-	size = sample_count * sizeof(float);
-	loop = size / UDP_PACKAGE_SIZE;
-	rest = size % UDP_PACKAGE_SIZE;
-	index = 0;
+void UDP_Multicast(const ip_addr_t* group, uint16_t port) {
+	udp_event_t event = { UDP_STATE_IDLE, NULL };
 
-	for (uint32_t x = 0; x < loop; x++) {
-		if (0 == x) {
-			addon += ADD_HEAD;
+	// Port last, the UDP task reads it first
+	bsp.udp_multicast.port = 0;
+	ip_addr_copy(bsp.udp_multicast.group, *group);
+	bsp.udp_multicast.port = port;
 
-		} else if (!rest) {
-			if ((loop - 1) == x)
-				addon += ADD_TAIL;
-		} else {
-			addon = ADD_NONE;
-		}
+	// Wake the task when it waits for a command
+	if (NULL != QueueUDPHandle) {
+		xQueueSend(QueueUDPHandle, &event, 0);
+	}
+}
 
-		err = UDP_SendV2(tx + index, UDP_PACKAGE_SIZE, addon);
 
-		index += UDP_PACKAGE_SIZE;
+// --------------------------------------------------------------------------------------------------------------------
 
-		if (ERR_OK != err)
-			break;
-	}
+static bool UDP_StreamActive(void) {
+	bool active = udp_stream.subscribed || (0 != bsp.udp_multicast.port);
 
-	if (rest) {
-		if (!loop) {
-			addon = ADD_HEAD_AND_TAIL;
-		} else {
-			addon = ADD_TAIL;
-		}
-		err = UDP_SendV2(tx + index, rest, addon);
+	if (active != udp_stream.listening) {
+		ADC_StreamListen(xTaskGetCurrentTaskHandle(), active);
+		udp_stream.listening = active;
 	}
 
-	return err;
+	return active;
 }
 
-/****************** NEW TEST CODE END *********************/
-
-static err_t UDP_SendASCII() {
-	char *tx;
-	uint32_t sample_count = bsp.adc.sample_count;
-	uint32_t size, loop, rest, index;
-	addon_t addon = ADD_NONE;
-	err_t err;
-
-	tx = UTIL_FloatArrayToASCII(NULL, NETCONN_UDP, &measurements[0], sample_count, NULL);
-	size = strlen(tx);
-	loop = size / UDP_PACKAGE_SIZE;
-	rest = size % UDP_PACKAGE_SIZE;
-	index = 0;
 
-	for (uint32_t x = 0; x < loop; x++) {
-		if (!rest) {
-			if ((loop - 1) == x)
-				addon = ADD_TAIL;
-		}
+// --------------------------------------------------------------------------------------------------------------------
 
-		err = UDP_Send(tx + index, UDP_PACKAGE_SIZE, addon);
+// Send one stream block, the rest of it is dropped when the ring wrapped onto it while it was copied
 
-		index += UDP_PACKAGE_SIZE;
+static void UDP_StreamSend(uint32_t block, const adc_stream_block_t* info) {
+	udp_stream_header_t header;
+	struct netbuf *buf;
+	uint8_t *payload;
+	bool valid = true;
+	uint16_t port = bsp.udp_multicast.port;
+	const ip_addr_t *addr = &udp_stream.addr;
 
-		if (ERR_OK != err)
-			break;
+	if (0 != port) {
+		addr = &bsp.udp_multicast.group;
+	} else {
+		port = udp_stream.port;
 	}
 
-	if (rest) {
-		err = UDP_Send(tx + index, rest, ADD_TAIL);
+	if (!udp_stream.timed) {
+		udp_stream.cycles = info->cycles;
+		udp_stream.timed = true;
 	}
 
-	return err;
-}
+	udp_stream.elapsed += (uint32_t) (info->cycles - udp_stream.cycles);
+	udp_stream.cycles = info->cycles;
 
+	header.stream = udp_stream.stream;
+	header.block = block;
+	header.count = UDP_STREAM_SAMPLES;
+	header.timestamp = udp_stream.elapsed / (SystemCoreClock / 1000000UL);
 
-// --------------------------------------------------------------------------------------------------------------------
+	for (uint16_t packet = 0; (packet < UDP_STREAM_PACKETS) && valid; packet++) {
+		header.packet = packet;
+		header.offset = (uint64_t) info->half * ADC_BLOCK_SIZE + packet * UDP_STREAM_SAMPLES;
 
-static void UDP_INITiate(void) {
+		buf = netbuf_new();
 
-	LED_osQueue(BLUE);
+		if (NULL == buf) {
+			return;
+		}
 
-	if (!ADC_Measurement(bsp.adc.sample_count))
-	{
-		LED_osQueue(RED);
-	}
-	else
-	{
-		(bsp.default_cfg) ? LED_osQueue(BLUE) : LED_osQueue(GREEN);
+		payload = netbuf_alloc(buf, sizeof(header) + UDP_STREAM_SAMPLES * sizeof(uint16_t));
+
+		if (NULL != payload) {
+			memcpy(payload, &header, sizeof(header));
+			memcpy(payload + sizeof(header), &info->codes[packet * UDP_STREAM_SAMPLES],
+					UDP_STREAM_SAMPLES * sizeof(uint16_t));
+
+			valid = ((ADC_StreamCommitted() - block) < ADC_RING_BLOCKS);
+
+			if (valid) {
+				netconn_sendto(conn, buf, addr, port);
+			}
+		}
+
+		netbuf_delete(buf);
 	}
 }
 
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static bool UDP_Measure(udp_task_state_t state) {
+// Push all blocks committed since the last call and wait for the next one. In ACQuire:MODE CONTinuous a stream stopped
+// by a new setting is restarted as soon as nobody else measures, in SINGle mode nothing is streamed.
 
-	LED_osQueue(BLUE);
+static void UDP_StreamService(void) {
+	adc_stream_block_t info;
+	uint32_t id = ADC_StreamId();
+	uint32_t committed;
 
-	if (UDP_STATE_FETCHQ != state) {
-		if (!ADC_Measurement(bsp.adc.sample_count)) {
-			LED_osQueue(RED);
-			return false;
-		}
+	if (!UDP_StreamActive()) {
+		vTaskDelay(pdMS_TO_TICKS(1));
+		return;
 	}
 
-	if (ERR_OK == UDP_Connect()) {
-		if (FORMAT_DATA_ASCII == bsp.format.data) {
-			if (ERR_OK != UDP_SendASCII()) {
-				LED_osQueue(RED);
-			} else {
-				(bsp.default_cfg) ? LED_osQueue(BLUE) : LED_osQueue(GREEN);
-			}
-		} else {
-
-			if (ERR_OK != UDP_SendREAL()) {
-				LED_osQueue(RED);
-			} else {
-				(bsp.default_cfg) ? LED_osQueue(BLUE) : LED_osQueue(GREEN);
-			}
+	if (0 == id) {
+		if (pdTRUE == xSemaphoreTake(MeasMutex, 0)) {
+			ADC_StreamResume();
+			xSemaphoreGive(MeasMutex);
 		}
+
+		vTaskDelay(pdMS_TO_TICKS(1));
+		return;
 	}
 
-	if (ERR_OK != UDP_Close()) {
-		LED_osQueue(RED);
-		return false;
+	if (id != udp_stream.stream) {
+		udp_stream.stream = id;
+		udp_stream.next = 0;
+		udp_stream.elapsed = 0;
+		udp_stream.timed = false;
 	}
 
-	if (ERR_OK != UDP_Create()) {
-		LED_osQueue(RED);
-		return false;
-	} else {
-		(bsp.default_cfg) ? LED_osQueue(BLUE) : LED_osQueue(GREEN);
+	committed = ADC_StreamCommitted();
+
+	// Fell more than the ring behind, continue with the oldest block which is still there
+	if ((committed - udp_stream.next) >= (ADC_RING_BLOCKS - 1)) {
+		udp_stream.next = committed - (ADC_RING_BLOCKS - 2);
 	}
 
-	return true;
+	while (udp_stream.next < committed) {
+		if (ADC_StreamBlock(udp_stream.next, &info)) {
+			UDP_StreamSend(udp_stream.next, &info);
+		}
+
+		udp_stream.next++;
+	}
+
+	ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1));
 }
 
 
@@ -480,55 +642,41 @@ static bool UDP_Measure(udp_task_state_t state) {
 
 static void StartUDPTask(void* argument) {
 
-	udp_task_state_t state = UDP_STATE_IDLE;
+	udp_event_t event;
+
+	QueueUDPHandle = xQueueCreate(UDP_QUEUE_LENGTH, sizeof(udp_event_t));
 
-	QueueUDPHandle = xQueueCreate(1, sizeof(udp_task_state_t));
+	udp_session = SCPI_SessionOpen(SCPI_SESSION_UDP, NULL);
+
+	if (NULL == udp_session) {
+		vTaskDelete(NULL);
+	}
 
 	UDP_Create();
 
 	for (;;) {
-		if (pdTRUE == xQueueReceive(QueueUDPHandle, &state, portMAX_DELAY)) {
-
-		} else {
-			state = UDP_STATE_IDLE;
+		// A subscriber or the multicast group is served between the commands
+		if (pdTRUE != xQueueReceive(QueueUDPHandle, &event, UDP_StreamActive() ? 0 : portMAX_DELAY)) {
+			event.state = UDP_STATE_IDLE;
+			event.buf = NULL;
 		}
 
-		switch (state) {
-		case UDP_STATE_FETCHQ: {
-			if (pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000))) {
-				UDP_Measure(UDP_STATE_FETCHQ);
-				xSemaphoreGive(MeasMutex);
-			} else {
-				LED_osQueue(RED);
-			}
-		}
-			;
-			break;
-		case UDP_STATE_MEASQ: {
-			if (pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000))) {
-				UDP_Measure(UDP_STATE_MEASQ);
-				xSemaphoreGive(MeasMutex);
-			} else {
-				LED_osQueue(RED);
-			}
-		}
-			;
+		switch (event.state) {
+		case UDP_STATE_SCPI:
+			UDP_Input(event.buf);
 			break;
-		case UDP_STATE_INIT: {
-			if (pdTRUE == xSemaphoreTake(MeasMutex, pdMS_TO_TICKS(20000))) {
-				UDP_INITiate();
-				xSemaphoreGive(MeasMutex);
-			} else {
-				LED_osQueue(RED);
-			}
-		}
-			;
+		case UDP_STATE_NACK:
+			UDP_Retransmit(event.buf);
 			break;
 		case UDP_STATE_ERROR:
 			LED_osQueue(RED);
 			break;
-		case UDP_STATE_IDLE: vTaskDelay(pdMS_TO_TICKS(1)); break;
+		case UDP_STATE_IDLE: UDP_StreamService(); break;
 		default: vTaskDelay(pdMS_TO_TICKS(1)); break;
 		}
+
+		if (NULL != event.buf) {
+			netbuf_delete(event.buf);
+		}
 	}
 }
@@ -13,8 +13,12 @@
 #include "Utility.h"
 #include "ADC.h"
 #include "FloatToString.h"
-#include "HiSLIP.h"
 #include "BSP.h"
+#include "SCPI_Server.h"
+#include "SCPI_Def.h"
+#include "SCPI_Session.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -23,6 +27,10 @@ extern float measurements[];
 
 // --------------------------------------------------------------------------------------------------------------------
 
+#define UTIL_DTCM_END		(D1_DTCMRAM_BASE + 0x20000UL)
+
+// --------------------------------------------------------------------------------------------------------------------
+
 inline bool UTIL_Timeout(uint32_t start, uint32_t timeout)
 {
 	if (((HAL_GetTick() - start) >= timeout) || (0U == timeout))
@@ -38,52 +46,59 @@ inline bool UTIL_Timeout(uint32_t start, uint32_t timeout)
 
 // --------------------------------------------------------------------------------------------------------------------
 
-char buffer[sizeof(hislip_msg_t) + ADC_MEASUREMENT_BUFFER * UTIL_ASCII_SIZE +1];
+static char util_chunk[UTIL_CHUNK_SIZE] __ALIGNED(8);
+
+// Format the values as comma separated text. Every chunk of about UTIL_CHUNK_SIZE bytes goes to send() before the
+// next one is formatted, the last one comes without the trailing ','.
 
-char* UTIL_FloatArrayToASCII(scpi_t * context, enum netconn_type conn_type, float* float_array, uint32_t num_floats, size_t* frame_size)
+err_t UTIL_FloatArrayToASCII(const float* float_array, uint32_t num_floats, uint8_t precision, util_chunk_t send,
+		void* arg)
 {
+	size_t sum = 0;
+	err_t err;
 
-    size_t size;
-    size_t sum = 0;
+	for (uint32_t x = 0; x < num_floats; x++)
+	{
+		sum += floatToString(util_chunk + sum, float_array[x], precision);
+
+		if(((x + 1) < num_floats) && ((sum + UTIL_ASCII_SIZE) > UTIL_CHUNK_SIZE))
+		{
+			err = send(arg, util_chunk, sum, false);
 
-    if((VISA_HISLIP == bsp.resource) && (NETCONN_TCP == conn_type))
-    {
-        size_t header_size = 0;
-        hislip_msg_t header;
+			if(ERR_OK != err)
+			{
+				return err;
+			}
 
-    	hislip_instr_t* hislip_instr = (hislip_instr_t*)context->user_context;
+			sum = 0;
+		}
+	}
 
-    	header_size = sizeof(hislip_msg_t);
+	// Delete last ','
+	return send(arg, util_chunk, (sum > 0) ? (sum - 1) : 0, true);
+}
 
-        for (uint32_t x = 0; x < num_floats; x++)
-        {
-        	size = floatToString(buffer + header_size + sum, float_array[x]);
-        	sum +=size;
 
-        }
+// --------------------------------------------------------------------------------------------------------------------
 
-    	buffer[sum - 1] = '\0'; // Delete last ','
+// The SCPI output frames the chunks, HiSLIP sessions get them as Data messages
 
-    	hislip_DataHeader(hislip_instr, &header, HISLIP_DATAEND, sum);
-    	memcpy(buffer, &header, sizeof(hislip_msg_t));
-    	memcpy(buffer + header_size + sum - 1, HISLIP_LINE_ENDING, strlen(HISLIP_LINE_ENDING));
-    	buffer[sum - 1 + strlen(HISLIP_LINE_ENDING)] = '\0';
+static err_t UTIL_ChunkOutput(void* arg, const char* data, size_t len, bool last)
+{
+	return (len == SCPI_WriteChunk((scpi_t*)arg, data, len)) ? ERR_OK : ERR_CONN;
+}
 
-    	*frame_size = header_size + sum;
 
-    }
-    else
-    {
-        for (uint32_t x = 0; x < num_floats; x++)
-        {
-        	size = floatToString(buffer + sum, float_array[x]);
-        	sum +=size;
-        }
+// --------------------------------------------------------------------------------------------------------------------
 
-        buffer[sum - 1] = '\0'; // Delete last ','
-    }
+scpi_result_t UTIL_ResultASCII(scpi_t * context, const float* float_array, uint32_t num_floats)
+{
+	// An empty result lets libscpi put the separator in front and count the result, the text follows directly and
+	// libscpi ends the message with the line end
+	SCPI_ResultCharacters(context, "", 0);
 
-    return buffer;
+	return (ERR_OK == UTIL_FloatArrayToASCII(float_array, num_floats, SCPI_SessionFormat(context)->precision,
+			UTIL_ChunkOutput, context)) ? SCPI_RES_OK : SCPI_RES_ERR;
 }
 
 
@@ -105,56 +120,479 @@ int32_t UTIL_WhiteSpace(const char* string, uint32_t size)
 
 // --------------------------------------------------------------------------------------------------------------------
 
-char* UTIL_FloatArrayToREAL(scpi_t * context, enum netconn_type conn_type, float* float_array, uint32_t num_floats, size_t* frame_size)
+// The Ethernet DMA can not read the DTCM, data there has to be copied into the lwIP heap
+
+static bool UTIL_DmaReachable(const void* data)
+{
+	uint32_t address = (uint32_t)data;
+
+	return !((address >= D1_DTCMRAM_BASE) && (address < UTIL_DTCM_END));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// AXI SRAM, D2 SRAM1 and D3 SRAM are cacheable write back, only the lwIP heap is not (MPU_Config). Whatever the CPU
+// wrote there may still sit in the D-cache, it has to reach the memory before the Ethernet DMA reads it.
+
+void UTIL_CleanDCache(const void* data, size_t len)
+{
+	uint32_t start = (uint32_t)data & ~(__SCB_DCACHE_LINE_SIZE - 1U);
+	uint32_t end = ((uint32_t)data + len + __SCB_DCACHE_LINE_SIZE - 1U) & ~(__SCB_DCACHE_LINE_SIZE - 1U);
+
+	if(0 != len)
+	{
+		SCB_CleanDCache_by_Addr((uint32_t*)start, (int32_t)(end - start));
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Write len bytes without copying them when the Ethernet DMA can read them. The data has to stay untouched until
+// the peer acknowledged it, see UTIL_NetconnWaitAcked().
+
+err_t UTIL_NetconnWriteInPlace(struct netconn* conn, const void* data, size_t len, uint8_t flags)
+{
+	if(UTIL_DmaReachable(data))
+	{
+		UTIL_CleanDCache(data, len);
+		flags |= NETCONN_NOCOPY;
+	}
+	else
+	{
+		flags |= NETCONN_COPY;
+	}
+
+	return netconn_write(conn, data, len, flags);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// True while a part of what was written to conn is in the send queue. The pcb is read with the lwIP core locked,
+// the tcpip thread may free it meanwhile.
+
+static bool UTIL_NetconnQueued(struct netconn* conn)
+{
+	bool queued;
+
+	LOCK_TCPIP_CORE();
+	queued = (NULL != conn->pcb.tcp) && (0 != conn->pcb.tcp->snd_queuelen);
+	UNLOCK_TCPIP_CORE();
+
+	return queued;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Wait until nothing written to conn is left in the send queue, false after timeout ms
+
+bool UTIL_NetconnWaitAcked(struct netconn* conn, uint32_t timeout)
+{
+	uint32_t start = HAL_GetTick();
+
+	while(UTIL_NetconnQueued(conn))
+	{
+		if(!UTIL_Timeout(start, timeout))
+		{
+			return false;
+		}
+
+		vTaskDelay(pdMS_TO_TICKS(1));
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// The samples are little endian in memory, FORMat:BORDer NORMal sends them big endian. REV swaps a word in one cycle.
+
+static void UTIL_Swap16(void* out, const void* in, uint32_t count)
+{
+	const uint16_t* src = (const uint16_t*)in;
+	uint16_t* dst = (uint16_t*)out;
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		dst[x] = (uint16_t)__REV16(src[x]);
+	}
+}
+
+static void UTIL_Swap32(void* out, const void* in, uint32_t count)
+{
+	const uint32_t* src = (const uint32_t*)in;
+	uint32_t* dst = (uint32_t*)out;
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		dst[x] = __REV(src[x]);
+	}
+}
+
+static void UTIL_FloatToDouble(void* out, const void* in, uint32_t count)
+{
+	const float* src = (const float*)in;
+	double* dst = (double*)out;
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		dst[x] = (double)src[x];
+	}
+}
+
+static void UTIL_FloatToDoubleSwap(void* out, const void* in, uint32_t count)
 {
+	const float* src = (const float*)in;
+	uint32_t* dst = (uint32_t*)out;
 
-    uint32_t size = num_floats * sizeof(float); // +1 for the null terminator
-    size_t header_size = 0;
+	for(uint32_t x = 0; x < count; x++)
+	{
+		double value = (double)src[x];
+		uint32_t words[2];
+
+		memcpy(words, &value, sizeof(words));
+
+		dst[2 * x] = __REV(words[1]);
+		dst[2 * x + 1] = __REV(words[0]);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static const util_encoding_t util_int16_normal = {UTIL_Swap16, sizeof(uint16_t), sizeof(uint16_t)};
+static const util_encoding_t util_real32_normal = {UTIL_Swap32, sizeof(float), sizeof(float)};
+static const util_encoding_t util_real64_normal = {UTIL_FloatToDoubleSwap, sizeof(float), sizeof(double)};
+static const util_encoding_t util_real64_swapped = {UTIL_FloatToDouble, sizeof(float), sizeof(double)};
 
-    if((VISA_HISLIP == bsp.resource) && (NETCONN_TCP == conn_type))
+// Conversion of the INT16 codes or REAL32 values in memory to the FORMat setting, NULL when they are sent as they are
+
+const util_encoding_t* UTIL_BlockEncoding(const format_t* format)
+{
+	bool normal = (FORMAT_BORDER_NORMAL == format->border);
+
+	switch(format->data)
 	{
-        hislip_msg_t header;
-     	hislip_instr_t* hislip_instr = (hislip_instr_t*)context->user_context;
-        size_t header_len;
-        char block_header[12];
+		case FORMAT_DATA_INT16: return normal ? &util_int16_normal : NULL;
+		case FORMAT_DATA_REAL32: return normal ? &util_real32_normal : NULL;
+		case FORMAT_DATA_REAL64: return normal ? &util_real64_normal : &util_real64_swapped;
+		default: return NULL;
+	}
+}
 
-    	// Create the REAL block data header
-    	// ----------------------------------------------------------------------------------
 
-        memset(block_header, 0, 12);
+// --------------------------------------------------------------------------------------------------------------------
+
+// Part of the block payload behind what libscpi wrote so far, see SCPI_WriteInPlace() and SCPI_WriteChunk()
+
+static bool UTIL_BlockPayload(scpi_t * context, const void* data, size_t len, bool in_place)
+{
+	if(in_place)
+	{
+		return (len == SCPI_WriteInPlace(context, data, len));
+	}
+
+	return (len == SCPI_WriteChunk(context, data, len));
+}
 
-    	block_header[0] = '#';
-        SCPI_UInt32ToStrBase((uint32_t) size, block_header + 2, 10, 10);
 
-        header_len = strlen(block_header + 2);
-        block_header[1] = (char) (header_len + '0');
+// --------------------------------------------------------------------------------------------------------------------
 
-        // ----------------------------------------------------------------------------------
+// A segment which needs a conversion is converted chunk by chunk into util_chunk and copied to TCP from there
 
+static bool UTIL_BlockSegment(scpi_t * context, const util_segment_t* segment, const util_encoding_t* encoding)
+{
+	const uint8_t* data = (const uint8_t*)segment->data;
+	uint32_t values = segment->size / encoding->in_size;
+	uint32_t chunk = UTIL_CHUNK_SIZE / encoding->out_size;
 
-        // Create the HiSLIP header
-        // ----------------------------------------------------------------------------------
+	while(0 != values)
+	{
+		uint32_t run = (values < chunk) ? values : chunk;
 
-    	hislip_DataHeader(hislip_instr, &header, HISLIP_DATAEND, strlen(block_header) + size + strlen(HISLIP_LINE_ENDING));
+		encoding->convert(util_chunk, data, run);
 
-        // Build the data frame
-    	// ----------------------------------------------------------------------------------
+		if(!UTIL_BlockPayload(context, util_chunk, run * encoding->out_size, false))
+		{
+			return false;
+		}
 
-    	header_size = sizeof(hislip_msg_t);
+		data += run * encoding->in_size;
+		values -= run;
+	}
 
-    	memcpy(buffer, &header, header_size);
-    	memcpy(buffer + header_size, &block_header, strlen(block_header));
-    	memcpy(buffer + header_size + strlen(block_header), float_array, size);
-     	memcpy(buffer + header_size + strlen(block_header) + size, HISLIP_LINE_ENDING, strlen(HISLIP_LINE_ENDING));
+	return true;
+}
 
-     	*frame_size = header_size + strlen(block_header) + size + strlen(HISLIP_LINE_ENDING);
-    }
-    else
-    {
-    	memcpy(buffer, float_array, size);
 
-    	buffer[size] = '\0';
-    }
+// --------------------------------------------------------------------------------------------------------------------
+
+// Definite length block written as header and payload segments, libscpi ends the message. The segments are written
+// in place without an encoding.
+
+scpi_result_t UTIL_ResultBlock(scpi_t * context, const util_segment_t* segments, uint32_t count,
+		const util_encoding_t* encoding)
+{
+	size_t size = 0;
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		size += segments[x].size;
+	}
+
+	if(NULL != encoding)
+	{
+		size = (size / encoding->in_size) * encoding->out_size;
+	}
+
+	SCPI_ResultArbitraryBlockHeader(context, size);
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		bool written = (NULL == encoding) ?
+				UTIL_BlockPayload(context, segments[x].data, segments[x].size, true) :
+				UTIL_BlockSegment(context, &segments[x], encoding);
+
+		if(!written)
+		{
+			return SCPI_RES_ERR;
+		}
+	}
+
+	return SCPI_RES_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Split sample_count raw codes of the last acquisition starting at index into the memory segments holding them
+
+uint32_t UTIL_MemorySegments(uint32_t index, uint32_t sample_count, util_segment_t* segments)
+{
+	uint32_t count = 0;
+
+	while((0 != sample_count) && (count < UTIL_SEGMENTS_MAX))
+	{
+		uint32_t run = sample_count;
+		const uint16_t* data = ADC_MemorySegment(index, &run);
+
+		if(NULL == data)
+		{
+			break;
+		}
+
+		segments[count].data = data;
+		segments[count].size = run * sizeof(uint16_t);
+		count++;
+
+		index += run;
+		sample_count -= run;
+	}
+
+	return count;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// FORMat:DATA PACKed, lossless delta coded raw codes. All fields are little endian:
+//
+//   uint32	number of samples
+//   per frame of UTIL_PACKED_FRAME samples, the last frame holds the rest:
+//     uint8	width w, 0..16
+//     		the differences to the previous sample (modulo 2^16, the first sample to 0) zigzag coded to
+//     		z = (d << 1) ^ (d >> 15), w bits each, packed LSB first and padded to a full byte
+//
+// A decoder takes d = (z >> 1) ^ -(z & 1) and sample = (uint16_t)(previous + d). Codes which move only a few LSB
+// from sample to sample need 3..5 bits instead of 16.
+
+typedef struct
+{
+	const util_segment_t* segments;
+	uint32_t count;
+	uint32_t segment;
+	uint32_t offset;
+	uint16_t previous;
+
+}util_packer_t;
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Next frame of zigzag coded differences, returns the number of samples and their bit width
+
+static uint32_t UTIL_PackFrame(util_packer_t* packer, uint16_t* zigzag, uint32_t* width)
+{
+	uint32_t n = 0;
+	uint32_t bits = 0;
+
+	while((n < UTIL_PACKED_FRAME) && (packer->segment < packer->count))
+	{
+		const util_segment_t* segment = &packer->segments[packer->segment];
+		const uint16_t* codes = (const uint16_t*)segment->data;
+		uint32_t size = segment->size / sizeof(uint16_t);
+
+		while((n < UTIL_PACKED_FRAME) && (packer->offset < size))
+		{
+			int16_t delta = (int16_t)(codes[packer->offset] - packer->previous);
+
+			zigzag[n] = (uint16_t)((delta << 1) ^ (delta >> 15));
+			bits |= zigzag[n];
+
+			packer->previous = codes[packer->offset];
+			packer->offset++;
+			n++;
+		}
+
+		if(packer->offset >= size)
+		{
+			packer->segment++;
+			packer->offset = 0;
+		}
+	}
+
+	*width = 32U - __CLZ(bits);
+
+	return n;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Pack n values of width bits, returns the bytes written
+
+static uint32_t UTIL_PackBits(uint8_t* out, const uint16_t* zigzag, uint32_t n, uint32_t width)
+{
+	uint8_t* start = out;
+	uint32_t accumulator = 0;
+	uint32_t bits = 0;
+
+	for(uint32_t x = 0; x < n; x++)
+	{
+		accumulator |= (uint32_t)zigzag[x] << bits;
+		bits += width;
+
+		while(bits >= 8)
+		{
+			*out++ = (uint8_t)accumulator;
+			accumulator >>= 8;
+			bits -= 8;
+		}
+	}
+
+	if(bits)
+	{
+		*out++ = (uint8_t)accumulator;
+	}
+
+	return (uint32_t)(out - start);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void UTIL_PackStart(util_packer_t* packer, const util_segment_t* segments, uint32_t count)
+{
+	packer->segments = segments;
+	packer->count = count;
+	packer->segment = 0;
+	packer->offset = 0;
+	packer->previous = 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Size of the PACKed stream, the block header needs it before the first byte is sent
+
+uint32_t UTIL_PackedSize(const util_segment_t* segments, uint32_t count)
+{
+	util_packer_t packer;
+	uint16_t zigzag[UTIL_PACKED_FRAME];
+	uint32_t size = sizeof(uint32_t);
+	uint32_t width;
+	uint32_t n;
+
+	UTIL_PackStart(&packer, segments, count);
+
+	while(0 != (n = UTIL_PackFrame(&packer, zigzag, &width)))
+	{
+		size += 1 + ((n * width + 7) / 8);
+	}
+
+	return size;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Encode the segments into util_chunk, every full chunk goes to send() before the next frames are packed
+
+err_t UTIL_Pack(const util_segment_t* segments, uint32_t count, util_chunk_t send, void* arg)
+{
+	util_packer_t packer;
+	uint16_t zigzag[UTIL_PACKED_FRAME];
+	uint8_t* out = (uint8_t*)util_chunk;
+	uint32_t samples = 0;
+	uint32_t sum = sizeof(uint32_t);
+	uint32_t width;
+	uint32_t n;
+	err_t err;
+
+	for(uint32_t x = 0; x < count; x++)
+	{
+		samples += segments[x].size / sizeof(uint16_t);
+	}
+
+	memcpy(out, &samples, sizeof(uint32_t));
+
+	UTIL_PackStart(&packer, segments, count);
+
+	while(0 != (n = UTIL_PackFrame(&packer, zigzag, &width)))
+	{
+		// Room for the largest frame
+		if((sum + 1 + UTIL_PACKED_FRAME * sizeof(uint16_t)) > UTIL_CHUNK_SIZE)
+		{
+			err = send(arg, util_chunk, sum, false);
+
+			if(ERR_OK != err)
+			{
+				return err;
+			}
+
+			sum = 0;
+		}
+
+		out[sum++] = (uint8_t)width;
+		sum += UTIL_PackBits(out + sum, zigzag, n, width);
+	}
+
+	return send(arg, util_chunk, sum, true);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static err_t UTIL_ChunkBlock(void* arg, const char* data, size_t len, bool last)
+{
+	return UTIL_BlockPayload((scpi_t*)arg, data, len, false) ? ERR_OK : ERR_CONN;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+scpi_result_t UTIL_ResultPacked(scpi_t * context, const util_segment_t* segments, uint32_t count)
+{
+	SCPI_ResultArbitraryBlockHeader(context, UTIL_PackedSize(segments, count));
+
+	if(ERR_OK != UTIL_Pack(segments, count, UTIL_ChunkBlock, context))
+	{
+		return SCPI_RES_ERR;
+	}
 
-    return buffer;
+	return SCPI_RES_OK;
 }
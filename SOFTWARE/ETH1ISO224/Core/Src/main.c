@@ -28,6 +28,7 @@
 #include "LED.h"
 #include "ADC.h"
 #include "UDP.h"
+#include "STREAM.h"
 
 
 #include "multicastDNS.h"
@@ -63,6 +64,7 @@ DMA_HandleTypeDef hdma_adc3;
 I2C_HandleTypeDef hi2c1;
 
 TIM_HandleTypeDef htim3;
+TIM_HandleTypeDef htim6;
 
 osThreadId defaultTaskHandle;
 uint32_t defaultTaskBuffer[ 512 ];
@@ -86,6 +88,7 @@ static void MX_DMA_Init(void);
 static void MX_ADC3_Init(void);
 static void MX_I2C1_Init(void);
 static void MX_TIM3_Init(void);
+static void MX_TIM6_Init(void);
 void StartDefaultTask(void const * argument);
 
 /* USER CODE BEGIN PFP */
@@ -144,6 +147,7 @@ int main(void)
   MX_ADC3_Init();
   MX_I2C1_Init();
   MX_TIM3_Init();
+  MX_TIM6_Init();
   /* USER CODE BEGIN 2 */
   LED_Control(BLUE, true);
   HAL_Delay(100);
@@ -441,6 +445,44 @@ static void MX_TIM3_Init(void)
 
 }
 
+/**
+  * @brief TIM6 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM6_Init(void)
+{
+
+  /* USER CODE BEGIN TIM6_Init 0 */
+
+  /* USER CODE END TIM6_Init 0 */
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM6_Init 1 */
+
+  /* USER CODE END TIM6_Init 1 */
+  htim6.Instance = TIM6;
+  htim6.Init.Prescaler = 0;
+  htim6.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim6.Init.Period = 2399;
+  htim6.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim6) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim6, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM6_Init 2 */
+
+  /* USER CODE END TIM6_Init 2 */
+
+}
+
 /**
   * Enable DMA controller clock
   */
@@ -557,8 +599,10 @@ void StartDefaultTask(void const * argument)
 
   vTaskDelay(pdMS_TO_TICKS(300)); // Need this wait to get lwip to work
 
+  ADC_CreateTask();
   SCPI_CreateTask();
   UDP_CreateTask();
+  STREAM_CreateTask();
 
   if(bsp.eeprom.structure.services.hislip)
   {
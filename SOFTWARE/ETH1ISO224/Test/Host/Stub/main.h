@@ -0,0 +1,14 @@
+/*
+ * main.h
+ *
+ * Host stand-in for the CubeMX main.h, the sources built here need the standard types only.
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#endif /* __MAIN_H */
@@ -0,0 +1,84 @@
+/*
+ * packed.c
+ *
+ * Host side reference decoder for FORMat:DATA PACKed, see packed.h. Plain C99 without dependencies, meant to be
+ * copied into client software.
+ */
+
+#include <string.h>
+
+#include "packed.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Number of samples in the payload, -1 when it is too short for the count
+
+int64_t packed_Count(const uint8_t* data, size_t size)
+{
+	if(size < 4)
+	{
+		return -1;
+	}
+
+	return (int64_t)((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16)
+			| ((uint32_t)data[3] << 24));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Decode the payload into codes, returns the number of samples or -1 when the payload is malformed, does not end
+// with the last frame or holds more than capacity samples
+
+int64_t packed_Decode(const uint8_t* data, size_t size, uint16_t* codes, size_t capacity)
+{
+	int64_t count = packed_Count(data, size);
+	size_t offset = 4;
+	uint16_t previous = 0;
+
+	if((count < 0) || ((uint64_t)count > capacity))
+	{
+		return -1;
+	}
+
+	for(int64_t index = 0; index < count; )
+	{
+		uint32_t n = ((count - index) > PACKED_FRAME) ? PACKED_FRAME : (uint32_t)(count - index);
+		uint32_t width;
+		uint32_t accumulator = 0;
+		uint32_t bits = 0;
+
+		if(offset >= size)
+		{
+			return -1;
+		}
+
+		width = data[offset++];
+
+		if((width > 16) || ((size - offset) < ((n * width + 7) / 8)))
+		{
+			return -1;
+		}
+
+		for(uint32_t x = 0; x < n; x++)
+		{
+			uint32_t zigzag;
+
+			while(bits < width)
+			{
+				accumulator |= (uint32_t)data[offset++] << bits;
+				bits += 8;
+			}
+
+			zigzag = accumulator & ((1U << width) - 1U);
+			accumulator >>= width;
+			bits -= width;
+
+			// d = (z >> 1) ^ -(z & 1), the sum wraps modulo 2^16
+			previous = (uint16_t)(previous + ((zigzag >> 1) ^ (0U - (zigzag & 1U))));
+			codes[index++] = previous;
+		}
+	}
+
+	return (offset == size) ? count : -1;
+}
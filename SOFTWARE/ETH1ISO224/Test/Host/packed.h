@@ -0,0 +1,26 @@
+/*
+ * packed.h
+ *
+ * Host side reference decoder for FORMat:DATA PACKed, the payload of the definite length block:
+ *
+ *   uint32	number of samples, little endian
+ *   per frame of PACKED_FRAME samples, the last frame holds the rest:
+ *     uint8	width w, 0..16
+ *     		zigzag coded differences to the previous sample (the first one to 0), w bits each, LSB first,
+ *     		padded to a full byte
+ */
+
+#ifndef PACKED_H_
+#define PACKED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PACKED_FRAME		64
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int64_t packed_Count(const uint8_t* data, size_t size);
+int64_t packed_Decode(const uint8_t* data, size_t size, uint16_t* codes, size_t capacity);
+
+#endif /* PACKED_H_ */
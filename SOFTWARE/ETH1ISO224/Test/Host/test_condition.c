@@ -0,0 +1,177 @@
+/*
+ * test_condition.c
+ *
+ * ADC_ConditionBlock() with the coefficients of ADC_Coefficients() against the two step conditioning it replaced,
+ * and the time per sample of both.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define ADC_VREF				3.3f
+#define ADC_VCOM				3.3f/2.0f
+
+#define SAMPLES					32768
+#define RUNS					200
+
+static struct
+{
+	struct
+	{
+		float resolution;
+		float vcom;
+	}adc;
+
+	struct
+	{
+		float multiply;
+		float gain;
+	}iso224;
+
+}bsp;
+
+#include "adc_condition.inc"
+
+static uint16_t adc_data[SAMPLES];
+static float measurements[SAMPLES];
+static float reference[SAMPLES];
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// The per sample code which ADC_ConditionBlock() replaced, reads the settings for every sample
+
+static void __attribute__((noinline)) ConditionReference(uint8_t gain, uint32_t sample_count, float offset,
+		float calib_gain, float math_offset)
+{
+	float adc = 0.0f;
+	float inv_gain = 1.0f/(float)gain;
+
+	for(uint32_t x = 0; x < sample_count; x++)
+	{
+		adc = inv_gain * (bsp.adc.resolution * adc_data[x] - bsp.adc.vcom) + offset;
+		reference[x] = calib_gain * bsp.iso224.multiply * bsp.iso224.gain * adc + math_offset;
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static int Compare(uint8_t gain, float offset, float calib_gain, float math_offset)
+{
+	adc_coeff_t coeff;
+	float full_scale = fabsf(calib_gain * bsp.iso224.multiply * bsp.iso224.gain * (ADC_VREF / 2.0f) / (float)gain);
+	float worst = 0.0f;
+
+	ADC_Coefficients(&coeff, gain, offset, calib_gain, math_offset);
+	ADC_ConditionBlock(adc_data, measurements, SAMPLES, &coeff);
+	ConditionReference(gain, SAMPLES, offset, calib_gain, math_offset);
+
+	for(uint32_t x = 0; x < SAMPLES; x++)
+	{
+		float error = fabsf(measurements[x] - reference[x]);
+
+		worst = (error > worst) ? error : worst;
+	}
+
+	// Folding the steps changes the rounding only, a few float steps of the full scale
+	if(worst > (full_scale * 4e-6f))
+	{
+		printf("FAIL gain %u offset %g calibration %g math %g: error %g of %g\n", gain, offset, calib_gain,
+				math_offset, worst, full_scale);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(void)
+{
+	static const uint8_t gains[] = {1, 2, 4};
+	static const float offsets[] = {0.0f, 1.25e-3f, -0.3f};
+	static const float calib_gains[] = {1.0f, 0.9987f, 1.0213f};
+	static const float math_offsets[] = {0.0f, -2.5f, 17.0f};
+	adc_coeff_t coeff;
+	double start, fused, two_step;
+	int failed = 0;
+
+	bsp.adc.vcom = ADC_VCOM;
+	bsp.adc.resolution = (float)(ADC_VREF/pow(2.0, 16.0));
+	bsp.iso224.multiply = 200.0f;
+	bsp.iso224.gain = 3.0f;
+
+	srand(1);
+
+	for(uint32_t x = 0; x < SAMPLES; x++)
+	{
+		adc_data[x] = (x < 4) ? (uint16_t)(x * 21845) : (uint16_t)rand();
+	}
+
+	for(uint32_t g = 0; g < 3; g++)
+		for(uint32_t o = 0; o < 3; o++)
+			for(uint32_t c = 0; c < 3; c++)
+				for(uint32_t m = 0; m < 3; m++)
+				{
+					failed += Compare(gains[g], offsets[o], calib_gains[c], math_offsets[m]);
+				}
+
+	// Odd counts run through the tail loop
+	ADC_Coefficients(&coeff, 2, 1.25e-3f, 0.9987f, -2.5f);
+	ConditionReference(2, SAMPLES, 1.25e-3f, 0.9987f, -2.5f);
+
+	for(uint32_t count = 0; count < 8; count++)
+	{
+		measurements[count] = NAN;
+		ADC_ConditionBlock(adc_data, measurements, count, &coeff);
+
+		if(!isnan(measurements[count]) || ((count > 0) && isnan(measurements[count - 1])))
+		{
+			printf("FAIL count %u\n", count);
+			failed++;
+		}
+	}
+
+	// Both outputs were written above, the pages are mapped and in the cache
+	start = Now();
+	for(uint32_t r = 0; r < RUNS; r++)
+	{
+		ADC_Coefficients(&coeff, 2, 1.25e-3f, 0.9987f, -2.5f);
+		ADC_ConditionBlock(adc_data, measurements, SAMPLES, &coeff);
+		__asm__ volatile("" : : "r"(measurements) : "memory");
+	}
+	fused = (Now() - start) / ((double)RUNS * SAMPLES);
+
+	start = Now();
+	for(uint32_t r = 0; r < RUNS; r++)
+	{
+		ConditionReference(2, SAMPLES, 1.25e-3f, 0.9987f, -2.5f);
+		__asm__ volatile("" : : "r"(reference) : "memory");
+	}
+	two_step = (Now() - start) / ((double)RUNS * SAMPLES);
+
+	printf("condition: %u samples, fused %.3f ns/sample, two step %.3f ns/sample\n", SAMPLES, fused * 1e9,
+			two_step * 1e9);
+
+	printf("condition: %s\n", failed ? "FAILED" : "OK");
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/*
+ * test_ftoa.c
+ *
+ * floatToString() against glibc snprintf("%.*E,", precision - 1, value) for every precision, and the time per value
+ * against the fixed point floatToString() it replaced.
+ *
+ *   test_ftoa [step]	checks every step-th float bit pattern, step 211 gives 183M cases
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FloatToString.h"
+
+size_t floatToStringBaseline(char* outstr, float value);
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define STEP_DEF				4099
+#define BENCH_VALUES			100000
+#define BENCH_RUNS				30
+
+static uint64_t cases;
+static uint64_t failures;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void Check(uint32_t bits)
+{
+	char text[FTOA_SIZE + 1];
+	char expected[64];
+	float value;
+
+	memcpy(&value, &bits, sizeof(value));
+
+	// NaN and infinity are the SCPI values, printf does not know them
+	if(0xFFU == ((bits >> 23) & 0xFFU))
+	{
+		return;
+	}
+
+	for(uint8_t precision = FTOA_PRECISION_MIN; precision <= FTOA_PRECISION_MAX; precision++)
+	{
+		size_t length = floatToString(text, value, precision);
+		int size = snprintf(expected, sizeof(expected), "%.*E,", precision - 1, (double)value);
+
+		cases++;
+
+		if((length > FTOA_SIZE) || ((size_t)size != length) || memcmp(text, expected, length))
+		{
+			if(failures++ < 10)
+			{
+				text[(length > FTOA_SIZE) ? FTOA_SIZE : length] = '\0';
+				printf("FAIL %08X precision %u: %s expected %s\n", bits, precision, text, expected);
+			}
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void CheckSpecial(float value, const char* expected)
+{
+	char text[FTOA_SIZE + 1];
+	size_t length = floatToString(text, value, FTOA_PRECISION_DEF);
+
+	cases++;
+
+	if((strlen(expected) != length) || memcmp(text, expected, length))
+	{
+		failures++;
+		text[length] = '\0';
+		printf("FAIL %g: %s expected %s\n", value, text, expected);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Fastest of BENCH_RUNS interleaved runs, the host is shared and noisy
+
+static void Bench(const char* name, double scale)
+{
+	static float values[BENCH_VALUES];
+	static char text[BENCH_VALUES * FTOA_SIZE];
+	double fast = 1.0, fixed = 1.0;
+	double start, time;
+	size_t sum;
+
+	srand(2);
+
+	for(uint32_t x = 0; x < BENCH_VALUES; x++)
+	{
+		values[x] = (float)(((double)rand() / RAND_MAX * 2.0 - 1.0) * scale);
+	}
+
+	for(uint32_t run = 0; run < BENCH_RUNS; run++)
+	{
+		sum = 0;
+		start = Now();
+		for(uint32_t x = 0; x < BENCH_VALUES; x++)
+		{
+			sum += floatToString(text + sum, values[x], FTOA_PRECISION_DEF);
+		}
+		time = Now() - start;
+		fast = (time < fast) ? time : fast;
+
+		sum = 0;
+		start = Now();
+		for(uint32_t x = 0; x < BENCH_VALUES; x++)
+		{
+			sum += floatToStringBaseline(text + sum, values[x]);
+		}
+		time = Now() - start;
+		fixed = (time < fixed) ? time : fixed;
+	}
+
+	printf("ftoa: %-12s %5.1f ns/value, fixed point %5.1f ns/value\n", name, fast * 1e9 / BENCH_VALUES,
+			fixed * 1e9 / BENCH_VALUES);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+	uint64_t step = (argc > 1) ? strtoull(argv[1], NULL, 0) : STEP_DEF;
+
+	step = step ? step : 1;
+
+	for(uint64_t bits = 0; bits <= UINT32_MAX; bits += step)
+	{
+		Check((uint32_t)bits);
+	}
+
+	// Short mantissas of every exponent, the exact ties which round half to even
+	for(uint64_t bits = 0; bits <= UINT32_MAX; bits += 1U << 15)
+	{
+		Check((uint32_t)bits);
+	}
+
+	for(uint32_t bits = 0; bits < 256; bits++)
+	{
+		Check(bits);
+		Check(0x7F7FFFFFU - bits);
+	}
+
+	CheckSpecial(0.0f, "0.000000E+00,");
+	CheckSpecial(-0.0f, "-0.000000E+00,");
+	CheckSpecial(__builtin_nanf(""), "9.91E+37,");
+	CheckSpecial(__builtin_inff(), "9.9E+37,");
+	CheckSpecial(-__builtin_inff(), "-9.9E+37,");
+
+	printf("ftoa: %llu cases against snprintf, %llu failed\n", (unsigned long long)cases,
+			(unsigned long long)failures);
+
+	Bench("+-1e6", 1e6);
+	Bench("+-1000", 1000.0);
+	Bench("+-10", 10.0);
+	Bench("+-1e-3", 1e-3);
+
+	printf("ftoa: %s\n", failures ? "FAILED" : "OK");
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
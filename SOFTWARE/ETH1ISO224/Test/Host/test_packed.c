@@ -0,0 +1,197 @@
+/*
+ * test_packed.c
+ *
+ * UTIL_Pack() and UTIL_PackedSize() from Utility.c against the reference decoder in packed.c: every code has to
+ * come back, in one segment or split over several, and the size announced in the block header has to be the size
+ * sent.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packed.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef int8_t err_t;
+
+#define ERR_OK					0
+#define __ALIGNED(x)			__attribute__((aligned(x)))
+
+// ARM CLZ of 0 is 32, the builtin leaves it undefined
+static inline uint32_t __CLZ(uint32_t value)
+{
+	return value ? (uint32_t)__builtin_clz(value) : 32U;
+}
+
+#include "util_pack.inc"
+
+static char util_chunk[UTIL_CHUNK_SIZE] __ALIGNED(8);
+
+#include "util_pack_code.inc"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define SAMPLES_MAX				97536
+#define BENCH_RUNS				20
+
+static uint16_t codes[SAMPLES_MAX];
+static uint16_t decoded[SAMPLES_MAX];
+static uint8_t stream[sizeof(uint32_t) + (SAMPLES_MAX / UTIL_PACKED_FRAME + 1) * (1 + UTIL_PACKED_FRAME * 2)];
+
+static size_t stream_size;
+static bool stream_last;
+static uint32_t chunks_late;
+static uint32_t failures;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static err_t Collect(void* arg, const char* data, size_t len, bool last)
+{
+	(void)arg;
+
+	// Nothing may follow the last chunk, no chunk may be larger than the buffer it comes from
+	chunks_late += stream_last || (len > UTIL_CHUNK_SIZE);
+	stream_last = last;
+
+	memcpy(stream + stream_size, data, len);
+	stream_size += len;
+
+	return ERR_OK;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void RoundTrip(const char* name, uint32_t count, const uint32_t* cuts, uint32_t segments)
+{
+	util_segment_t segment[UTIL_SEGMENTS_MAX];
+	uint32_t start = 0;
+	uint32_t size;
+	int64_t result;
+
+	for(uint32_t x = 0; x < segments; x++)
+	{
+		uint32_t end = (x == (segments - 1)) ? count : cuts[x];
+
+		segment[x].data = &codes[start];
+		segment[x].size = (end - start) * sizeof(uint16_t);
+		start = end;
+	}
+
+	stream_size = 0;
+	stream_last = false;
+	chunks_late = 0;
+
+	size = UTIL_PackedSize(segment, segments);
+
+	if((ERR_OK != UTIL_Pack(segment, segments, Collect, NULL)) || !stream_last || chunks_late)
+	{
+		printf("FAIL %s: chunks\n", name);
+		failures++;
+		return;
+	}
+
+	if(size != stream_size)
+	{
+		printf("FAIL %s: UTIL_PackedSize %u, sent %zu\n", name, size, stream_size);
+		failures++;
+		return;
+	}
+
+	memset(decoded, 0xA5, sizeof(decoded));
+	result = packed_Decode(stream, stream_size, decoded, SAMPLES_MAX);
+
+	if((result != count) || memcmp(codes, decoded, count * sizeof(uint16_t)))
+	{
+		printf("FAIL %s: decoded %lld of %u samples\n", name, (long long)result, count);
+		failures++;
+		return;
+	}
+
+	printf("packed: %-18s %6u samples, %7u bytes, %5.2f bits/sample\n", name, count, size,
+			count ? (8.0 * size / count) : 0.0);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(void)
+{
+	static const uint32_t none[1] = {0};
+	static const uint32_t cuts[3] = {1000, 65536 - 7, 80001};
+	util_segment_t segment = {codes, SAMPLES_MAX * sizeof(uint16_t)};
+	double fastest = 1.0;
+	int32_t code = 32768;
+
+	srand(3);
+
+	// Oversampled ISO224 codes move a few LSB from sample to sample
+	for(uint32_t x = 0; x < SAMPLES_MAX; x++)
+	{
+		code += (rand() % 9) - 4;
+		codes[x] = (uint16_t)code;
+	}
+
+	RoundTrip("empty", 0, none, 1);
+	RoundTrip("one sample", 1, none, 1);
+	RoundTrip("one frame", UTIL_PACKED_FRAME, none, 1);
+	RoundTrip("part frame", UTIL_PACKED_FRAME + 13, none, 1);
+	RoundTrip("random walk", SAMPLES_MAX, none, 1);
+	RoundTrip("four segments", SAMPLES_MAX, cuts, 4);
+
+	for(uint32_t x = 0; x < SAMPLES_MAX; x++)
+	{
+		codes[x] = 12345;
+	}
+
+	RoundTrip("constant", SAMPLES_MAX, none, 1);
+
+	// Full swing steps wrap modulo 2^16 and take 16 bits
+	for(uint32_t x = 0; x < SAMPLES_MAX; x++)
+	{
+		codes[x] = (x & 1) ? 0xFFFF : (uint16_t)rand();
+	}
+
+	RoundTrip("full swing", SAMPLES_MAX, cuts, 4);
+
+	// A truncated payload is refused
+	if(packed_Decode(stream, stream_size - 1, decoded, SAMPLES_MAX) >= 0)
+	{
+		printf("FAIL truncated payload decoded\n");
+		failures++;
+	}
+
+	for(uint32_t run = 0; run < BENCH_RUNS; run++)
+	{
+		double start = Now();
+
+		stream_size = 0;
+		stream_last = false;
+		UTIL_Pack(&segment, 1, Collect, NULL);
+
+		start = Now() - start;
+		fastest = (start < fastest) ? start : fastest;
+	}
+
+	printf("packed: UTIL_Pack %.2f ns/sample\n", fastest * 1e9 / SAMPLES_MAX);
+	printf("packed: %s\n", failures ? "FAILED" : "OK");
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
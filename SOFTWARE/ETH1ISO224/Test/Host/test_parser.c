@@ -0,0 +1,273 @@
+/*
+ * test_parser.c
+ *
+ * The command index of libscpi against the linear scan it replaced, with the scpi_commands[] patterns of
+ * SCPI_Def.c: every header derived from the patterns has to find the same command both ways, then a recorded
+ * command mix is replayed to compare the lookup time.
+ *
+ * parser.c is included to reach the static findCommandHeader(). Clearing cmdindex.cmdlist after SCPI_Init() makes
+ * it fall back to the linear scan.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.c"
+#include "scpi/units.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define HEADERS_MAX				16384
+#define HEADER_SIZE				64
+#define BENCH_RUNS				30
+#define BENCH_REPEAT			200
+
+static const scpi_command_t scpi_commands[] =
+{
+#include "scpi_commands.inc"
+	SCPI_CMD_LIST_END
+};
+
+static scpi_interface_t scpi_interface;
+static scpi_error_t scpi_error_queue[4];
+static char scpi_input[256];
+
+static scpi_t indexed;
+static scpi_t linear;
+
+static char headers[HEADERS_MAX][HEADER_SIZE];
+static uint32_t header_count;
+
+// Headers of the commands sent by the test stand, in the proportion they came in
+static const char* command_mix[] =
+{
+	"READ?", "FETCh?", "DATA?", "READ?", "FETC?", "DATA:DATA?", "READ?", "R?", "FETCh?", "DATA?",
+	"MEAS?", "*OPC?", "INIT", "READ?", "FETCh?", "DATA:REC?", "SYST:ERR?", "READ?", "FETCh?", "DATA?",
+	"*IDN?", "CONF:GAIN?", "SAMP:COUN", "TRIG:SOUR", "READ?", "FETCh?", "DATA?", "FORM:DATA", "CALC:AVER?",
+	"READ?", "FETCh?", "DATA?", "SYSTem:ERRor:NEXT?", "UDP:READ?", "*CLS", "ABOR", "READ?", "FETCh?", "DATA?",
+};
+
+#define COMMAND_MIX		(sizeof(command_mix) / sizeof(command_mix[0]))
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void AddHeader(const char* header)
+{
+	if((header_count < HEADERS_MAX) && (strlen(header) < HEADER_SIZE))
+	{
+		for(uint32_t x = 0; x < header_count; x++)
+		{
+			if(0 == strcmp(headers[x], header))
+			{
+				return;
+			}
+		}
+
+		strcpy(headers[header_count++], header);
+	}
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Header from pattern: optional nodes in or out, each mnemonic in its short or long form, upper or lower case.
+// form bit 0 takes the long form of even mnemonics, bit 1 of odd ones, bit 2 writes lower case.
+
+static void Derive(const char* pattern, uint32_t optional, uint32_t form, bool colon)
+{
+	char header[HEADER_SIZE];
+	uint32_t length = 0;
+	uint32_t mnemonic = 0;
+	uint32_t node = 0;
+	bool skip = false;
+	bool lower = (form & 4U);
+
+	if(colon && (':' != pattern[0]) && ('*' != pattern[0]))
+	{
+		header[length++] = ':';
+	}
+
+	for(const char* p = pattern; *p && (length < (HEADER_SIZE - 2)); p++)
+	{
+		if('[' == *p)
+		{
+			skip = !(optional & (1U << node++));
+			continue;
+		}
+
+		if(']' == *p)
+		{
+			skip = false;
+			continue;
+		}
+
+		if(skip)
+		{
+			continue;
+		}
+
+		if(':' == *p)
+		{
+			mnemonic++;
+			header[length++] = ':';
+			continue;
+		}
+
+		// Lower case letters are the long form only
+		if(islower((unsigned char)*p) && !(form & (1U << (mnemonic & 1U))))
+		{
+			continue;
+		}
+
+		header[length++] = lower ? (char)tolower((unsigned char)*p) : (char)toupper((unsigned char)*p);
+	}
+
+	header[length] = '\0';
+	AddHeader(header);
+
+	// Headers which must not match: cut short, one character more, a numeric suffix
+	if(length > 1)
+	{
+		header[length - 1] = '\0';
+		AddHeader(header);
+		header[length - 1] = pattern[strlen(pattern) - 1];
+	}
+
+	header[length] = 'X';
+	header[length + 1] = '\0';
+	AddHeader(header);
+
+	header[length] = '2';
+	AddHeader(header);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static double Replay(scpi_t* context)
+{
+	double fastest = 1.0;
+	uint32_t found = 0;
+
+	for(uint32_t run = 0; run < BENCH_RUNS; run++)
+	{
+		double start = Now();
+
+		for(uint32_t repeat = 0; repeat < BENCH_REPEAT; repeat++)
+		{
+			for(uint32_t x = 0; x < COMMAND_MIX; x++)
+			{
+				found += findCommandHeader(context, command_mix[x], (int)strlen(command_mix[x]));
+			}
+		}
+
+		start = Now() - start;
+		fastest = (start < fastest) ? start : fastest;
+	}
+
+	if(found != (BENCH_RUNS * BENCH_REPEAT * COMMAND_MIX))
+	{
+		printf("FAIL command mix: %u of %u found\n", found, (uint32_t)(BENCH_RUNS * BENCH_REPEAT * COMMAND_MIX));
+		return -1.0;
+	}
+
+	return fastest * 1e9 / (BENCH_REPEAT * COMMAND_MIX);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(void)
+{
+	uint32_t patterns = 0;
+	uint32_t matched = 0;
+	uint32_t failures = 0;
+	double time_indexed, time_linear;
+
+	SCPI_Init(&indexed, scpi_commands, &scpi_interface, scpi_units_def, "", "", "", "", scpi_input,
+			sizeof(scpi_input), scpi_error_queue, 4);
+	SCPI_Init(&linear, scpi_commands, &scpi_interface, scpi_units_def, "", "", "", "", scpi_input,
+			sizeof(scpi_input), scpi_error_queue, 4);
+
+	linear.cmdindex.cmdlist = NULL;
+
+	if(indexed.cmdindex.cmdlist != scpi_commands)
+	{
+		printf("FAIL the table does not fit SCPI_COMMAND_INDEX_SIZE\n");
+		return EXIT_FAILURE;
+	}
+
+	for(; NULL != scpi_commands[patterns].pattern; patterns++)
+	{
+		for(uint32_t optional = 0; optional < 4; optional++)
+			for(uint32_t form = 0; form < 8; form++)
+			{
+				Derive(scpi_commands[patterns].pattern, optional, form, false);
+				Derive(scpi_commands[patterns].pattern, optional, form, true);
+			}
+	}
+
+	AddHeader("");
+	AddHeader(":");
+	AddHeader("*");
+	AddHeader("R");
+	AddHeader("r?");
+	AddHeader("::READ?");
+
+	if(header_count >= HEADERS_MAX)
+	{
+		printf("FAIL more than %u headers\n", HEADERS_MAX);
+		return EXIT_FAILURE;
+	}
+
+	for(uint32_t x = 0; x < header_count; x++)
+	{
+		int len = (int)strlen(headers[x]);
+		bool found_indexed = findCommandHeader(&indexed, headers[x], len);
+		bool found_linear = findCommandHeader(&linear, headers[x], len);
+
+		matched += found_linear;
+
+		if((found_indexed != found_linear)
+				|| (found_linear && (indexed.param_list.cmd != linear.param_list.cmd)))
+		{
+			if(failures++ < 10)
+			{
+				printf("FAIL \"%s\": index %s, scan %s\n", headers[x],
+						found_indexed ? indexed.param_list.cmd->pattern : "-",
+						found_linear ? linear.param_list.cmd->pattern : "-");
+			}
+		}
+	}
+
+	printf("parser: %u patterns, index %u of %u entries, %u headers (%u matching) the same both ways\n", patterns,
+			indexed.cmdindex.bucket[SCPI_COMMAND_INDEX_BUCKETS], SCPI_COMMAND_INDEX_SIZE, header_count - failures,
+			matched);
+
+	time_indexed = Replay(&indexed);
+	time_linear = Replay(&linear);
+
+	failures += (time_indexed < 0.0) || (time_linear < 0.0);
+
+	printf("parser: command mix of %u headers, index %.1f ns/header, linear scan %.1f ns/header\n",
+			(uint32_t)COMMAND_MIX, time_indexed, time_linear);
+
+	printf("parser: %s\n", failures ? "FAILED" : "OK");
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}